@@ -30,12 +30,13 @@
 #include <string.h>
 
 #include "gsm-app-glue.h"
+#include "gsm-util.h"
 
 typedef struct {
-  char *id;
+  const char *id;
   char *app_id;
   int phase;
-  char *startup_id;
+  const char *startup_id;
   DBusGConnection *connection;
 } GsmAppPrivate;
 
@@ -97,6 +98,7 @@ static GObject *gsm_app_constructor(
     GObjectConstructParam *construct_properties) {
   GsmApp *app;
   gboolean res;
+  char id[64];
   GsmAppPrivate *priv;
 
   app = GSM_APP(
@@ -104,9 +106,10 @@ static GObject *gsm_app_constructor(
           ->constructor(type, n_construct_properties, construct_properties));
   priv = gsm_app_get_instance_private(app);
 
-  g_free(priv->id);
-  priv->id =
-      g_strdup_printf("/org/gnome/SessionManager/App%u", get_next_app_serial());
+  gsm_util_release_id(priv->id);
+  g_snprintf(id, sizeof(id), "/org/gnome/SessionManager/App%u",
+             get_next_app_serial());
+  priv->id = gsm_util_intern_id(id);
 
   res = register_app(app);
   if (!res) {
@@ -133,9 +136,9 @@ static void gsm_app_set_id(GsmApp *app, const char *id) {
 
   priv = gsm_app_get_instance_private(app);
 
-  g_free(priv->id);
+  gsm_util_release_id(priv->id);
 
-  priv->id = g_strdup(id);
+  priv->id = gsm_util_intern_id(id);
   g_object_notify(G_OBJECT(app), "id");
 }
 static void gsm_app_set_startup_id(GsmApp *app, const char *startup_id) {
@@ -144,9 +147,9 @@ static void gsm_app_set_startup_id(GsmApp *app, const char *startup_id) {
 
   priv = gsm_app_get_instance_private(app);
 
-  g_free(priv->startup_id);
+  gsm_util_release_id(priv->startup_id);
 
-  priv->startup_id = g_strdup(startup_id);
+  priv->startup_id = gsm_util_intern_id(startup_id);
   g_object_notify(G_OBJECT(app), "startup-id");
 }
 
@@ -197,10 +200,10 @@ static void gsm_app_dispose(GObject *object) {
 
   priv = gsm_app_get_instance_private(app);
 
-  g_free(priv->startup_id);
+  gsm_util_release_id(priv->startup_id);
   priv->startup_id = NULL;
 
-  g_free(priv->id);
+  gsm_util_release_id(priv->id);
   priv->id = NULL;
 
   G_OBJECT_CLASS(gsm_app_parent_class)->dispose(object);
@@ -218,6 +221,7 @@ static void gsm_app_class_init(GsmAppClass *klass) {
   klass->impl_get_app_id = NULL;
   klass->impl_get_autorestart = NULL;
   klass->impl_provides = NULL;
+  klass->impl_peek_provides = NULL;
   klass->impl_is_running = NULL;
   klass->impl_peek_autostart_delay = NULL;
 
@@ -335,6 +339,16 @@ gboolean gsm_app_provides(GsmApp *app, const char *service) {
   }
 }
 
+/* Returns the services provided by @app, as a 0-terminated array of
+ * quarks, or NULL */
+const GQuark *gsm_app_peek_provides(GsmApp *app) {
+  if (GSM_APP_GET_CLASS(app)->impl_peek_provides) {
+    return GSM_APP_GET_CLASS(app)->impl_peek_provides(app);
+  } else {
+    return NULL;
+  }
+}
+
 gboolean gsm_app_has_autostart_condition(GsmApp *app, const char *condition) {
   if (GSM_APP_GET_CLASS(app)->impl_has_autostart_condition) {
     return GSM_APP_GET_CLASS(app)->impl_has_autostart_condition(app, condition);
@@ -50,6 +50,7 @@ struct _GsmAppClass {
   gboolean (*impl_stop)(GsmApp *app, GError **error);
   int (*impl_peek_autostart_delay)(GsmApp *app);
   gboolean (*impl_provides)(GsmApp *app, const char *service);
+  const GQuark *(*impl_peek_provides)(GsmApp *app);
   gboolean (*impl_has_autostart_condition)(GsmApp *app, const char *service);
   gboolean (*impl_is_running)(GsmApp *app);
 
@@ -88,6 +89,7 @@ void gsm_app_exited(GsmApp *app);
 void gsm_app_died(GsmApp *app);
 
 gboolean gsm_app_provides(GsmApp *app, const char *service);
+const GQuark *gsm_app_peek_provides(GsmApp *app);
 gboolean gsm_app_has_autostart_condition(GsmApp *app, const char *condition);
 void gsm_app_registered(GsmApp *app);
 int gsm_app_peek_autostart_delay(GsmApp *app);
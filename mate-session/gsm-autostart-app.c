@@ -24,33 +24,32 @@
 #include <config.h>
 #endif
 
-#include <ctype.h>
 #include <errno.h>
 #include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
 #include <sys/wait.h>
 /* Needed for FreeBSD */
 #include <gio/gio.h>
+#include <glib-unix.h>
 #include <glib.h>
+#include <glib/gstdio.h>
 #include <signal.h>
+#include <unistd.h>
 
 #include "gsm-autostart-app.h"
+#include "gsm-condition.h"
 #include "gsm-util.h"
 
-#ifdef __GNUC__
-#define UNUSED_VARIABLE __attribute__((unused))
-#else
-#define UNUSED_VARIABLE
-#endif
-
 enum { AUTOSTART_LAUNCH_SPAWN = 0, AUTOSTART_LAUNCH_ACTIVATE };
 
+/* How an app that doesn't register with XSMP or D-Bus tells us it is up */
 enum {
-  GSM_CONDITION_NONE = 0,
-  GSM_CONDITION_IF_EXISTS = 1,
-  GSM_CONDITION_UNLESS_EXISTS = 2,
-  GSM_CONDITION_MATE = 3,
-  GSM_CONDITION_GSETTINGS = 4,
-  GSM_CONDITION_UNKNOWN = 5
+  AUTOSTART_NOTIFY_NONE = 0,
+  /* sd_notify() style "READY=1" datagram on $NOTIFY_SOCKET */
+  AUTOSTART_NOTIFY_SOCKET,
+  /* the X-MATE-DBus-Name name gets an owner */
+  AUTOSTART_NOTIFY_DBUS_NAME
 };
 
 #define GSM_SESSION_CLIENT_DBUS_INTERFACE "org.mate.SessionClient"
@@ -62,21 +61,26 @@ typedef struct {
 
   EggDesktopFile *desktop_file;
 
-  /* desktop file state */
+  /* desktop file state, decoded once in load_desktop_file() */
+  gboolean disabled;
+  GQuark *provides; /* 0-terminated, or NULL */
   char *condition_string;
+  GsmCondition *parsed_condition;
   gboolean condition;
   gboolean autorestart;
   int autostart_delay;
 
-  GFileMonitor *condition_monitor;
-  GSettings *condition_settings;
-
   int launch_type;
   GPid pid;
   guint child_watch_id;
 
-  GDBusConnection *connection;
-  GDBusProxy *proxy;
+  GCancellable *start_cancellable;
+
+  int notify_type;
+  char *notify_path;
+  int notify_fd;
+  guint notify_fd_id;
+  guint notify_name_watch_id;
 } GsmAutostartAppPrivate;
 
 enum { CONDITION_CHANGED, LAST_SIGNAL };
@@ -85,6 +89,15 @@ enum { PROP_0, PROP_DESKTOP_FILENAME };
 
 static guint signals[LAST_SIGNAL] = {0};
 
+/* D-Bus activated apps are all started on the shared session bus
+ * connection; apps started before it is available wait in
+ * pending_activations. */
+static GDBusConnection *session_bus = NULL;
+static gboolean session_bus_requested = FALSE;
+static GSList *pending_activations = NULL;
+
+static void stop_readiness_notification(GsmAutostartApp *app);
+
 G_DEFINE_TYPE_WITH_PRIVATE(GsmAutostartApp, gsm_autostart_app, GSM_TYPE_APP)
 
 static void gsm_autostart_app_init(GsmAutostartApp *app) {
@@ -93,7 +106,7 @@ static void gsm_autostart_app_init(GsmAutostartApp *app) {
   priv = gsm_autostart_app_get_instance_private(app);
 
   priv->pid = -1;
-  priv->condition_monitor = NULL;
+  priv->notify_fd = -1;
   priv->condition = FALSE;
   priv->autostart_delay = -1;
 }
@@ -103,6 +116,14 @@ static gboolean is_disabled(GsmApp *app) {
 
   priv = gsm_autostart_app_get_instance_private(GSM_AUTOSTART_APP(app));
 
+  return priv->disabled;
+}
+
+static gboolean load_disabled(GsmApp *app) {
+  GsmAutostartAppPrivate *priv;
+
+  priv = gsm_autostart_app_get_instance_private(GSM_AUTOSTART_APP(app));
+
   /* Hidden key, used by autostart spec */
   if (egg_desktop_file_get_boolean(priv->desktop_file,
                                    EGG_DESKTOP_FILE_KEY_HIDDEN, NULL)) {
@@ -122,252 +143,81 @@ static gboolean is_disabled(GsmApp *app) {
   return FALSE;
 }
 
-static gboolean parse_condition_string(const char *condition_string,
-                                       guint *condition_kindp, char **keyp) {
-  const char *space;
-  const char *key;
-  int len;
-  guint kind;
-
-  space = condition_string + strcspn(condition_string, " ");
-  len = space - condition_string;
-  key = space;
-  while (isspace((unsigned char)*key)) {
-    key++;
-  }
-
-  if (!g_ascii_strncasecmp(condition_string, "if-exists", len) && key) {
-    kind = GSM_CONDITION_IF_EXISTS;
-  } else if (!g_ascii_strncasecmp(condition_string, "unless-exists", len) &&
-             key) {
-    kind = GSM_CONDITION_UNLESS_EXISTS;
-  } else if (!g_ascii_strncasecmp(condition_string, "MATE", len)) {
-    kind = GSM_CONDITION_MATE;
-  } else if (!g_ascii_strncasecmp(condition_string, "GSettings", len)) {
-    kind = GSM_CONDITION_GSETTINGS;
-  } else {
-    key = NULL;
-    kind = GSM_CONDITION_UNKNOWN;
-  }
-
-  if (keyp != NULL) {
-    *keyp = g_strdup(key);
-  }
-
-  if (condition_kindp != NULL) {
-    *condition_kindp = kind;
-  }
-
-  return (kind != GSM_CONDITION_UNKNOWN);
-}
-
-static void if_exists_condition_cb(GFileMonitor *monitor, GFile *file,
-                                   GFile *other_file, GFileMonitorEvent event,
-                                   GsmApp *app) {
-  GsmAutostartAppPrivate *priv;
-  gboolean condition = FALSE;
-
-  priv = gsm_autostart_app_get_instance_private(GSM_AUTOSTART_APP(app));
+static GQuark *load_provides(EggDesktopFile *desktop_file) {
+  char **provides;
+  GQuark *quarks;
+  gsize len;
+  gsize i;
 
-  switch (event) {
-    case G_FILE_MONITOR_EVENT_CREATED:
-      condition = TRUE;
-      break;
-    case G_FILE_MONITOR_EVENT_DELETED:
-      condition = FALSE;
-      break;
-    default:
-      /* Ignore any other monitor event */
-      return;
+  provides = egg_desktop_file_get_string_list(
+      desktop_file, GSM_AUTOSTART_APP_PROVIDES_KEY, &len, NULL);
+  if (provides == NULL || len == 0) {
+    g_strfreev(provides);
+    return NULL;
   }
 
-  /* Emit only if the condition actually changed */
-  if (condition != priv->condition) {
-    priv->condition = condition;
-    g_signal_emit(app, signals[CONDITION_CHANGED], 0, condition);
+  quarks = g_new0(GQuark, len + 1);
+  for (i = 0; i < len; i++) {
+    quarks[i] = g_quark_from_string(provides[i]);
   }
-}
-
-static void unless_exists_condition_cb(GFileMonitor *monitor, GFile *file,
-                                       GFile *other_file,
-                                       GFileMonitorEvent event, GsmApp *app) {
-  GsmAutostartAppPrivate *priv;
-  gboolean condition = FALSE;
 
-  priv = gsm_autostart_app_get_instance_private(GSM_AUTOSTART_APP(app));
-
-  switch (event) {
-    case G_FILE_MONITOR_EVENT_CREATED:
-      condition = FALSE;
-      break;
-    case G_FILE_MONITOR_EVENT_DELETED:
-      condition = TRUE;
-      break;
-    default:
-      /* Ignore any other monitor event */
-      return;
-  }
+  g_strfreev(provides);
 
-  /* Emit only if the condition actually changed */
-  if (condition != priv->condition) {
-    priv->condition = condition;
-    g_signal_emit(app, signals[CONDITION_CHANGED], 0, condition);
-  }
+  return quarks;
 }
 
-static void gsettings_condition_cb(GSettings *settings, const char *key,
-                                   gpointer user_data) {
+static void on_condition_changed(GsmCondition *condition, gboolean value,
+                                 gpointer user_data) {
   GsmApp *app;
   GsmAutostartAppPrivate *priv;
-  gboolean condition;
-
-  g_return_if_fail(GSM_IS_APP(user_data));
 
   app = GSM_APP(user_data);
-
   priv = gsm_autostart_app_get_instance_private(GSM_AUTOSTART_APP(app));
 
-  condition = g_settings_get_boolean(settings, key);
-
   g_debug("GsmAutostartApp: app:%s condition changed condition:%d",
-          gsm_app_peek_id(app), condition);
+          gsm_app_peek_id(app), value);
 
   /* Emit only if the condition actually changed */
-  if (condition != priv->condition) {
-    priv->condition = condition;
-    g_signal_emit(app, signals[CONDITION_CHANGED], 0, condition);
+  if (value != priv->condition) {
+    priv->condition = value;
+    g_signal_emit(app, signals[CONDITION_CHANGED], 0, value);
   }
 }
 
-static gboolean setup_gsettings_condition_monitor(GsmAutostartApp *app,
-                                                  const char *key) {
-  GSettingsSchemaSource *source;
-  GSettingsSchema *schema;
-  GSettings *settings;
-  char **elems;
-  gboolean retval = FALSE;
-  char *signal;
-  GsmAutostartAppPrivate *priv;
-
-  elems = g_strsplit(key, " ", 2);
-
-  priv = gsm_autostart_app_get_instance_private(app);
-
-  if (elems == NULL) goto out;
-
-  if (elems[0] == NULL || elems[1] == NULL) goto out;
-
-  source = g_settings_schema_source_get_default();
-
-  schema = g_settings_schema_source_lookup(source, elems[0], TRUE);
-
-  if (schema == NULL) goto out;
-
-  settings = g_settings_new_full(schema, NULL, NULL);
-  g_settings_schema_unref(schema);
-
-  signal = g_strdup_printf("changed::%s", elems[1]);
-  g_signal_connect(settings, signal,
-                   G_CALLBACK(gsettings_condition_cb), app);
-  g_free(signal);
-
-  retval = g_settings_get_boolean(settings, elems[1]);
-
-  priv->condition_settings = settings;
-
-out:
-  g_strfreev(elems);
-
-  return retval;
-}
-
 static void setup_condition_monitor(GsmAutostartApp *app) {
-  guint kind;
-  char *key;
-  gboolean res;
-  gboolean UNUSED_VARIABLE disabled;
   GsmAutostartAppPrivate *priv;
 
   priv = gsm_autostart_app_get_instance_private(app);
 
-  if (priv->condition_monitor != NULL) {
-    g_file_monitor_cancel(priv->condition_monitor);
-  }
-
-  if (priv->condition_settings != NULL) {
-    g_object_unref(priv->condition_settings);
-    priv->condition_settings = NULL;
+  if (priv->parsed_condition != NULL) {
+    gsm_condition_free(priv->parsed_condition);
+    priv->parsed_condition = NULL;
   }
 
   if (priv->condition_string == NULL) {
     return;
   }
 
-  /* if it is disabled outright there is no point in monitoring */
-  if (is_disabled(GSM_APP(app))) {
+  priv->parsed_condition = gsm_condition_new(priv->condition_string);
+  if (priv->parsed_condition == NULL) {
+    g_warning("Invalid AutostartCondition '%s' for %s", priv->condition_string,
+              gsm_app_peek_id(GSM_APP(app)));
     return;
   }
 
-  key = NULL;
-  res = parse_condition_string(priv->condition_string, &kind, &key);
-  if (!res) {
-    g_free(key);
-    return;
-  }
-
-  if (key == NULL) {
+  /* if it is disabled outright there is no point in monitoring */
+  if (is_disabled(GSM_APP(app))) {
     return;
   }
 
-  if (kind == GSM_CONDITION_IF_EXISTS) {
-    char *file_path;
-    GFile *file;
-
-    file_path = g_build_filename(g_get_user_config_dir(), key, NULL);
-
-    disabled = !g_file_test(file_path, G_FILE_TEST_EXISTS);
-
-    file = g_file_new_for_path(file_path);
-    priv->condition_monitor = g_file_monitor_file(file, 0, NULL, NULL);
-
-    g_signal_connect(priv->condition_monitor, "changed",
-                     G_CALLBACK(if_exists_condition_cb), app);
-
-    g_object_unref(file);
-    g_free(file_path);
-  } else if (kind == GSM_CONDITION_UNLESS_EXISTS) {
-    char *file_path;
-    GFile *file;
-
-    file_path = g_build_filename(g_get_user_config_dir(), key, NULL);
-
-    disabled = g_file_test(file_path, G_FILE_TEST_EXISTS);
-
-    file = g_file_new_for_path(file_path);
-    priv->condition_monitor = g_file_monitor_file(file, 0, NULL, NULL);
-
-    g_signal_connect(priv->condition_monitor, "changed",
-                     G_CALLBACK(unless_exists_condition_cb), app);
-
-    g_object_unref(file);
-    g_free(file_path);
-  } else if (kind == GSM_CONDITION_MATE) {
-    disabled = !setup_gsettings_condition_monitor(app, key);
-  } else if (kind == GSM_CONDITION_GSETTINGS) {
-    disabled = !setup_gsettings_condition_monitor(app, key);
-  } else {
-    disabled = TRUE;
-  }
-
-  g_free(key);
-
-  /* FIXME: cache the disabled value? */
+  gsm_condition_watch(priv->parsed_condition, on_condition_changed, app);
 }
 
 static gboolean load_desktop_file(GsmAutostartApp *app) {
   char *dbus_name;
   char *startup_id;
   char *phase_str;
+  char *notify_str;
   int phase;
   gboolean res;
   GsmAutostartAppPrivate *priv;
@@ -432,6 +282,28 @@ static gboolean load_desktop_file(GsmAutostartApp *app) {
     priv->autorestart = FALSE;
   }
 
+  notify_str = egg_desktop_file_get_string(priv->desktop_file,
+                                           GSM_AUTOSTART_APP_NOTIFY_KEY, NULL);
+  priv->notify_type = AUTOSTART_NOTIFY_NONE;
+  if (notify_str != NULL) {
+    if (strcmp(notify_str, "socket") == 0 &&
+        priv->launch_type == AUTOSTART_LAUNCH_SPAWN) {
+      priv->notify_type = AUTOSTART_NOTIFY_SOCKET;
+    } else if (strcmp(notify_str, "dbus-name") == 0 && dbus_name != NULL) {
+      priv->notify_type = AUTOSTART_NOTIFY_DBUS_NAME;
+    } else {
+      g_warning("Invalid %s value '%s' for %s", GSM_AUTOSTART_APP_NOTIFY_KEY,
+                notify_str, gsm_app_peek_id(GSM_APP(app)));
+    }
+
+    g_free(notify_str);
+  }
+
+  priv->disabled = load_disabled(GSM_APP(app));
+
+  g_free(priv->provides);
+  priv->provides = load_provides(priv->desktop_file);
+
   g_free(priv->condition_string);
   priv->condition_string = egg_desktop_file_get_string(
       priv->desktop_file, "AutostartCondition", NULL);
@@ -525,6 +397,17 @@ static void gsm_autostart_app_get_property(GObject *object, guint prop_id,
   }
 }
 
+static void cancel_start_call(GsmAutostartApp *app) {
+  GsmAutostartAppPrivate *priv;
+
+  priv = gsm_autostart_app_get_instance_private(app);
+
+  if (priv->start_cancellable != NULL) {
+    g_cancellable_cancel(priv->start_cancellable);
+    g_clear_object(&priv->start_cancellable);
+  }
+}
+
 static void gsm_autostart_app_dispose(GObject *object) {
   GsmAutostartAppPrivate *priv;
 
@@ -540,11 +423,13 @@ static void gsm_autostart_app_dispose(GObject *object) {
     priv->condition_string = NULL;
   }
 
-  if (priv->condition_settings) {
-    g_object_unref(priv->condition_settings);
-    priv->condition_settings = NULL;
+  if (priv->parsed_condition) {
+    gsm_condition_free(priv->parsed_condition);
+    priv->parsed_condition = NULL;
   }
 
+  g_clear_pointer(&priv->provides, g_free);
+
   if (priv->desktop_file) {
     egg_desktop_file_free(priv->desktop_file);
     priv->desktop_file = NULL;
@@ -560,19 +445,9 @@ static void gsm_autostart_app_dispose(GObject *object) {
     priv->child_watch_id = 0;
   }
 
-  if (priv->proxy != NULL) {
-    g_object_unref(priv->proxy);
-    priv->proxy = NULL;
-  }
-
-  if (priv->connection != NULL) {
-    g_object_unref(priv->connection);
-    priv->connection = NULL;
-  }
+  stop_readiness_notification(GSM_AUTOSTART_APP(object));
 
-  if (priv->condition_monitor) {
-    g_file_monitor_cancel(priv->condition_monitor);
-  }
+  cancel_start_call(GSM_AUTOSTART_APP(object));
 
   G_OBJECT_CLASS(gsm_autostart_app_parent_class)->dispose(object);
 }
@@ -593,10 +468,7 @@ static gboolean is_running(GsmApp *app) {
 }
 
 static gboolean is_conditionally_disabled(GsmApp *app) {
-  gboolean res;
   gboolean disabled;
-  char *key;
-  guint kind;
   GsmAutostartAppPrivate *priv;
 
   priv = gsm_autostart_app_get_instance_private(GSM_AUTOSTART_APP(app));
@@ -606,52 +478,168 @@ static gboolean is_conditionally_disabled(GsmApp *app) {
     return FALSE;
   }
 
-  key = NULL;
-  res = parse_condition_string(priv->condition_string, &kind, &key);
-  if (!res) {
-    g_free(key);
+  if (priv->parsed_condition == NULL) {
     return TRUE;
   }
 
-  if (key == NULL) {
-    return TRUE;
+  /* A pending condition reads as false; the app is started from
+   * on_condition_changed() if it turns out to be true */
+  if (gsm_condition_is_pending(priv->parsed_condition)) {
+    g_debug("GsmAutostartApp: app:%s condition pending",
+            gsm_app_peek_id(app));
   }
 
-  if (kind == GSM_CONDITION_IF_EXISTS) {
-    char *file_path;
-
-    file_path = g_build_filename(g_get_user_config_dir(), key, NULL);
-    disabled = !g_file_test(file_path, G_FILE_TEST_EXISTS);
-    g_free(file_path);
-  } else if (kind == GSM_CONDITION_UNLESS_EXISTS) {
-    char *file_path;
-
-    file_path = g_build_filename(g_get_user_config_dir(), key, NULL);
-    disabled = g_file_test(file_path, G_FILE_TEST_EXISTS);
-    g_free(file_path);
-  } else if (kind == GSM_CONDITION_MATE && priv->condition_settings != NULL) {
-    char **elems;
-    elems = g_strsplit(key, " ", 2);
-    disabled = !g_settings_get_boolean(priv->condition_settings, elems[1]);
-    g_strfreev(elems);
-  } else if (kind == GSM_CONDITION_GSETTINGS &&
-             priv->condition_settings != NULL) {
-    char **elems;
-    elems = g_strsplit(key, " ", 2);
-    disabled = !g_settings_get_boolean(priv->condition_settings, elems[1]);
-    g_strfreev(elems);
-  } else {
-    disabled = TRUE;
-  }
+  disabled = !gsm_condition_evaluate(priv->parsed_condition);
 
   /* Set initial condition */
   priv->condition = !disabled;
 
-  g_free(key);
-
   return disabled;
 }
 
+static void stop_readiness_notification(GsmAutostartApp *app) {
+  GsmAutostartAppPrivate *priv;
+
+  priv = gsm_autostart_app_get_instance_private(app);
+
+  if (priv->notify_fd_id > 0) {
+    g_source_remove(priv->notify_fd_id);
+    priv->notify_fd_id = 0;
+  }
+
+  if (priv->notify_fd >= 0) {
+    close(priv->notify_fd);
+    priv->notify_fd = -1;
+  }
+
+  if (priv->notify_path != NULL) {
+    g_unlink(priv->notify_path);
+    g_free(priv->notify_path);
+    priv->notify_path = NULL;
+  }
+
+  if (priv->notify_name_watch_id > 0) {
+    g_bus_unwatch_name(priv->notify_name_watch_id);
+    priv->notify_name_watch_id = 0;
+  }
+}
+
+static void app_ready(GsmAutostartApp *app) {
+  GsmAutostartAppPrivate *priv;
+
+  priv = gsm_autostart_app_get_instance_private(app);
+  g_debug("GsmAutostartApp: %s notified readiness", priv->desktop_id);
+
+  stop_readiness_notification(app);
+
+  /* Being ready releases the startup phase the same way registering
+   * does, so apps that can't register don't hold up the session. */
+  gsm_app_registered(GSM_APP(app));
+}
+
+static gboolean notify_socket_cb(int fd, GIOCondition condition,
+                                 GsmAutostartApp *app) {
+  char buffer[4096];
+  ssize_t len;
+  char **lines;
+  gboolean ready;
+  int i;
+
+  len = recv(fd, buffer, sizeof(buffer) - 1, MSG_DONTWAIT);
+  if (len <= 0) {
+    return TRUE;
+  }
+  buffer[len] = '\0';
+
+  ready = FALSE;
+  lines = g_strsplit(buffer, "\n", -1);
+  for (i = 0; lines[i] != NULL; i++) {
+    if (strcmp(lines[i], "READY=1") == 0) {
+      ready = TRUE;
+    }
+  }
+  g_strfreev(lines);
+
+  if (ready) {
+    GsmAutostartAppPrivate *priv;
+
+    /* app_ready() removes this source */
+    priv = gsm_autostart_app_get_instance_private(app);
+    priv->notify_fd_id = 0;
+    app_ready(app);
+    return FALSE;
+  }
+
+  return TRUE;
+}
+
+static gboolean setup_notify_socket(GsmAutostartApp *app) {
+  static guint notify_serial = 0;
+  struct sockaddr_un addr;
+  char *dir;
+  GsmAutostartAppPrivate *priv;
+
+  priv = gsm_autostart_app_get_instance_private(app);
+
+  dir = g_build_filename(g_get_user_runtime_dir(), "mate-session", NULL);
+  if (g_mkdir_with_parents(dir, 0700) != 0) {
+    g_warning("Unable to create %s: %s", dir, g_strerror(errno));
+    g_free(dir);
+    return FALSE;
+  }
+
+  priv->notify_path = g_strdup_printf("%s/notify-%d-%u", dir, (int)getpid(),
+                                      ++notify_serial);
+  g_free(dir);
+
+  if (strlen(priv->notify_path) >= sizeof(addr.sun_path)) {
+    g_warning("Notify socket path %s is too long", priv->notify_path);
+    goto error;
+  }
+
+  priv->notify_fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+  if (priv->notify_fd < 0) {
+    g_warning("Unable to create notify socket: %s", g_strerror(errno));
+    goto error;
+  }
+
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strcpy(addr.sun_path, priv->notify_path);
+
+  g_unlink(priv->notify_path);
+  if (bind(priv->notify_fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+    g_warning("Unable to bind notify socket %s: %s", priv->notify_path,
+              g_strerror(errno));
+    goto error;
+  }
+
+  priv->notify_fd_id = g_unix_fd_add(priv->notify_fd, G_IO_IN,
+                                     (GUnixFDSourceFunc)notify_socket_cb, app);
+
+  return TRUE;
+
+error:
+  stop_readiness_notification(app);
+  return FALSE;
+}
+
+static void notify_name_appeared_cb(GDBusConnection *connection,
+                                    const char *name, const char *name_owner,
+                                    GsmAutostartApp *app) {
+  app_ready(app);
+}
+
+static void setup_notify_name_watch(GsmAutostartApp *app, const char *name) {
+  GsmAutostartAppPrivate *priv;
+
+  priv = gsm_autostart_app_get_instance_private(app);
+
+  priv->notify_name_watch_id = g_bus_watch_name(
+      G_BUS_TYPE_SESSION, name, G_BUS_NAME_WATCHER_FLAGS_NONE,
+      (GBusNameAppearedCallback)notify_name_appeared_cb, NULL, app, NULL);
+}
+
 static void app_exited(GPid pid, int status, GsmAutostartApp *app) {
   GsmAutostartAppPrivate *priv;
 
@@ -668,6 +656,8 @@ static void app_exited(GPid pid, int status, GsmAutostartApp *app) {
   priv->pid = -1;
   priv->child_watch_id = 0;
 
+  stop_readiness_notification(app);
+
   if (WIFEXITED(status)) {
     gsm_app_exited(GSM_APP(app));
   } else if (WIFSIGNALED(status)) {
@@ -749,7 +739,7 @@ static gboolean gsm_autostart_app_stop(GsmApp *app, GError **error) {
 
 static gboolean autostart_app_start_spawn(GsmAutostartApp *app,
                                           GError **error) {
-  char *env[2] = {NULL, NULL};
+  char *env[3] = {NULL, NULL, NULL};
   gboolean success;
   GError *local_error;
   const char *startup_id;
@@ -762,6 +752,12 @@ static gboolean autostart_app_start_spawn(GsmAutostartApp *app,
 
   env[0] = g_strdup_printf("DESKTOP_AUTOSTART_ID=%s", startup_id);
 
+  stop_readiness_notification(app);
+  if (priv->notify_type == AUTOSTART_NOTIFY_SOCKET &&
+      setup_notify_socket(app)) {
+    env[1] = g_strdup_printf("NOTIFY_SOCKET=%s", priv->notify_path);
+  }
+
   local_error = NULL;
   command = egg_desktop_file_parse_exec(priv->desktop_file, NULL, &local_error);
   if (command == NULL) {
@@ -783,12 +779,14 @@ static gboolean autostart_app_start_spawn(GsmAutostartApp *app,
       EGG_DESKTOP_FILE_LAUNCH_RETURN_PID, &priv->pid,
       EGG_DESKTOP_FILE_LAUNCH_RETURN_STARTUP_ID, &priv->startup_id, NULL);
   g_free(env[0]);
+  g_free(env[1]);
 
   if (success) {
     g_debug("GsmAutostartApp: started pid:%d", priv->pid);
     priv->child_watch_id =
         g_child_watch_add(priv->pid, (GChildWatchFunc)app_exited, app);
   } else {
+    stop_readiness_notification(app);
     g_set_error(error, GSM_APP_ERROR, GSM_APP_ERROR_START,
                 "Unable to start application: %s", local_error->message);
     g_error_free(local_error);
@@ -808,48 +806,37 @@ static void start_notify(GObject *source_object, GAsyncResult *res,
   priv = gsm_autostart_app_get_instance_private(app);
 
   error = NULL;
-  if (priv->proxy == NULL) return;
-
-  variant = g_dbus_proxy_call_finish(priv->proxy, res, &error);
+  variant = g_dbus_connection_call_finish(G_DBUS_CONNECTION(source_object),
+                                          res, &error);
   if (variant == NULL) {
+    if (g_error_matches(error, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
+      /* the call was replaced by a newer one, leave that one alone */
+      g_error_free(error);
+      g_object_unref(app);
+      return;
+    }
+
     g_warning("GsmAutostartApp: Error starting application: %s",
               error->message);
     g_error_free(error);
-    return;
   } else {
     g_debug("GsmAutostartApp: Started application %s", priv->desktop_id);
     g_variant_unref(variant);
   }
 
-  g_object_unref(priv->proxy);
-  priv->proxy = NULL;
-
-  g_object_unref(priv->connection);
-  priv->connection = NULL;
+  g_clear_object(&priv->start_cancellable);
+  g_object_unref(app);
 }
 
-static gboolean autostart_app_start_activate(GsmAutostartApp *app,
-                                             GError **error) {
+static void send_start_call(GsmAutostartApp *app) {
   const char *name;
   char *path;
   char *arguments;
-  GError *local_error;
   GsmAutostartAppPrivate *priv;
 
   priv = gsm_autostart_app_get_instance_private(app);
 
-  local_error = NULL;
-  priv->connection = g_bus_get_sync(G_BUS_TYPE_SESSION, NULL, &local_error);
-  if (priv->connection == NULL) {
-    if (local_error != NULL) {
-      g_warning("error getting session bus: %s", local_error->message);
-    }
-    g_propagate_error(error, local_error);
-    return FALSE;
-  }
-
   name = gsm_app_peek_startup_id(GSM_APP(app));
-  g_assert(name != NULL);
 
   path = egg_desktop_file_get_string(priv->desktop_file,
                                      GSM_AUTOSTART_APP_DBUS_PATH_KEY, NULL);
@@ -861,18 +848,93 @@ static gboolean autostart_app_start_activate(GsmAutostartApp *app,
   arguments = egg_desktop_file_get_string(
       priv->desktop_file, GSM_AUTOSTART_APP_DBUS_ARGS_KEY, NULL);
 
-  local_error = NULL;
-  priv->proxy = g_dbus_proxy_new_sync(
-      priv->connection, G_DBUS_PROXY_FLAGS_NONE, NULL, name, path,
-      GSM_SESSION_CLIENT_DBUS_INTERFACE, NULL, &local_error);
-  if (priv->proxy == NULL) {
-    g_propagate_error(error, local_error);
-    return FALSE;
+  /* No proxy: we don't need its name owner tracking, and building it
+   * would cost a round-trip before the call can even be sent. */
+  g_dbus_connection_call(
+      session_bus, name, path, GSM_SESSION_CLIENT_DBUS_INTERFACE, "Start",
+      g_variant_new("(s)", arguments != NULL ? arguments : ""), NULL,
+      G_DBUS_CALL_FLAGS_NONE, -1, priv->start_cancellable, start_notify,
+      g_object_ref(app));
+
+  g_free(path);
+  g_free(arguments);
+}
+
+static void on_session_bus_ready(GObject *source_object, GAsyncResult *res,
+                                 gpointer data) {
+  GSList *apps;
+  GSList *l;
+  GError *error;
+
+  error = NULL;
+  session_bus = g_bus_get_finish(res, &error);
+  session_bus_requested = FALSE;
+
+  apps = pending_activations;
+  pending_activations = NULL;
+
+  for (l = apps; l != NULL; l = l->next) {
+    GsmAutostartApp *app = l->data;
+    GsmAutostartAppPrivate *priv;
+
+    priv = gsm_autostart_app_get_instance_private(app);
+
+    if (priv->start_cancellable == NULL ||
+        g_cancellable_is_cancelled(priv->start_cancellable)) {
+      /* stopped while we were waiting for the bus */
+    } else if (session_bus == NULL) {
+      g_warning("GsmAutostartApp: Error starting application %s: %s",
+                priv->desktop_id, error->message);
+      g_clear_object(&priv->start_cancellable);
+      /* start_activate() already succeeded, so this is how the manager
+       * learns the app is not coming */
+      gsm_app_died(GSM_APP(app));
+    } else {
+      send_start_call(app);
+    }
+
+    g_object_unref(app);
+  }
+
+  g_slist_free(apps);
+  g_clear_error(&error);
+}
+
+static gboolean autostart_app_start_activate(GsmAutostartApp *app,
+                                             GError **error) {
+  const char *name;
+  GsmAutostartAppPrivate *priv;
+
+  priv = gsm_autostart_app_get_instance_private(app);
+
+  name = gsm_app_peek_startup_id(GSM_APP(app));
+  g_assert(name != NULL);
+
+  cancel_start_call(app);
+
+  stop_readiness_notification(app);
+  if (priv->notify_type == AUTOSTART_NOTIFY_DBUS_NAME) {
+    setup_notify_name_watch(app, name);
+  }
+
+  priv->start_cancellable = g_cancellable_new();
+
+  /* Nothing here waits for a reply, so the Start calls of all the apps
+   * of a phase are in flight at the same time. */
+  if (session_bus != NULL) {
+    send_start_call(app);
+    return TRUE;
   }
 
-  g_dbus_proxy_call(priv->proxy, "Start", g_variant_new("(s)", arguments),
-                    G_DBUS_CALL_FLAGS_NONE, -1, NULL,
-                    (GAsyncReadyCallback)start_notify, app);
+  if (g_slist_find(pending_activations, app) == NULL) {
+    pending_activations =
+        g_slist_append(pending_activations, g_object_ref(app));
+  }
+
+  if (!session_bus_requested) {
+    session_bus_requested = TRUE;
+    g_bus_get(G_BUS_TYPE_SESSION, NULL, on_session_bus_ready, NULL);
+  }
 
   return TRUE;
 }
@@ -924,38 +986,41 @@ static gboolean gsm_autostart_app_restart(GsmApp *app, GError **error) {
 }
 
 static gboolean gsm_autostart_app_provides(GsmApp *app, const char *service) {
-  char **provides;
-  gsize len;
-  gsize i;
-  GsmAutostartApp *aapp;
+  GQuark quark;
   GsmAutostartAppPrivate *priv;
+  gsize i;
 
   g_return_val_if_fail(GSM_IS_APP(app), FALSE);
 
-  aapp = GSM_AUTOSTART_APP(app);
-  priv = gsm_autostart_app_get_instance_private(aapp);
+  priv = gsm_autostart_app_get_instance_private(GSM_AUTOSTART_APP(app));
 
-  if (priv->desktop_file == NULL) {
+  if (priv->provides == NULL) {
     return FALSE;
   }
 
-  provides = egg_desktop_file_get_string_list(
-      priv->desktop_file, GSM_AUTOSTART_APP_PROVIDES_KEY, &len, NULL);
-  if (!provides) {
+  /* nothing provides a service that was never interned */
+  quark = g_quark_try_string(service);
+  if (quark == 0) {
     return FALSE;
   }
 
-  for (i = 0; i < len; i++) {
-    if (!strcmp(provides[i], service)) {
-      g_strfreev(provides);
+  for (i = 0; priv->provides[i] != 0; i++) {
+    if (priv->provides[i] == quark) {
       return TRUE;
     }
   }
 
-  g_strfreev(provides);
   return FALSE;
 }
 
+static const GQuark *gsm_autostart_app_peek_provides(GsmApp *app) {
+  GsmAutostartAppPrivate *priv;
+
+  priv = gsm_autostart_app_get_instance_private(GSM_AUTOSTART_APP(app));
+
+  return priv->provides;
+}
+
 static gboolean gsm_autostart_app_has_autostart_condition(
     GsmApp *app, const char *condition) {
   GsmAutostartApp *aapp;
@@ -979,26 +1044,11 @@ static gboolean gsm_autostart_app_has_autostart_condition(
 }
 
 static gboolean gsm_autostart_app_get_autorestart(GsmApp *app) {
-  gboolean res;
-  gboolean autorestart;
   GsmAutostartAppPrivate *priv;
 
   priv = gsm_autostart_app_get_instance_private(GSM_AUTOSTART_APP(app));
 
-  if (priv->desktop_file == NULL) {
-    return FALSE;
-  }
-
-  autorestart = FALSE;
-
-  res = egg_desktop_file_has_key(priv->desktop_file,
-                                 GSM_AUTOSTART_APP_AUTORESTART_KEY, NULL);
-  if (res) {
-    autorestart = egg_desktop_file_get_boolean(
-        priv->desktop_file, GSM_AUTOSTART_APP_AUTORESTART_KEY, NULL);
-  }
-
-  return autorestart;
+  return priv->autorestart;
 }
 
 static const char *gsm_autostart_app_get_app_id(GsmApp *app) {
@@ -1064,6 +1114,7 @@ static void gsm_autostart_app_class_init(GsmAutostartAppClass *klass) {
   app_class->impl_restart = gsm_autostart_app_restart;
   app_class->impl_stop = gsm_autostart_app_stop;
   app_class->impl_provides = gsm_autostart_app_provides;
+  app_class->impl_peek_provides = gsm_autostart_app_peek_provides;
   app_class->impl_has_autostart_condition =
       gsm_autostart_app_has_autostart_condition;
   app_class->impl_get_app_id = gsm_autostart_app_get_app_id;
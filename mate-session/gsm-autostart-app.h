@@ -53,6 +53,7 @@ GsmApp *gsm_autostart_app_new(const char *desktop_file);
 #define GSM_AUTOSTART_APP_DBUS_ARGS_KEY "X-MATE-DBus-Start-Arguments"
 #define GSM_AUTOSTART_APP_DISCARD_KEY "X-MATE-Autostart-discard-exec"
 #define GSM_AUTOSTART_APP_DELAY_KEY "X-MATE-Autostart-Delay"
+#define GSM_AUTOSTART_APP_NOTIFY_KEY "X-MATE-Autostart-Notify"
 
 G_END_DECLS
 
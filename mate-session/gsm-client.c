@@ -31,14 +31,15 @@
 #include "eggdesktopfile.h"
 #include "gsm-client-glue.h"
 #include "gsm-marshal.h"
+#include "gsm-util.h"
 
 static guint32 client_serial = 1;
 
 typedef struct {
   GObject parent;
-  char *id;
-  char *startup_id;
-  char *app_id;
+  const char *id;
+  const char *startup_id;
+  const char *app_id;
   guint status;
   DBusGConnection *connection;
 } GsmClientPrivate;
@@ -118,15 +119,17 @@ static GObject *gsm_client_constructor(
     GObjectConstructParam *construct_properties) {
   GsmClient *client;
   gboolean res;
+  char id[64];
   GsmClientPrivate *priv;
 
   client = GSM_CLIENT(
       G_OBJECT_CLASS(gsm_client_parent_class)
           ->constructor(type, n_construct_properties, construct_properties));
   priv = gsm_client_get_instance_private(client);
-  g_free(priv->id);
-  priv->id = g_strdup_printf("/org/gnome/SessionManager/Client%u",
-                             get_next_client_serial());
+  gsm_util_release_id(priv->id);
+  g_snprintf(id, sizeof(id), "/org/gnome/SessionManager/Client%u",
+             get_next_client_serial());
+  priv->id = gsm_util_intern_id(id);
 
   res = register_client(client);
   if (!res) {
@@ -150,9 +153,9 @@ static void gsm_client_finalize(GObject *object) {
 
   g_return_if_fail(priv != NULL);
 
-  g_free(priv->id);
-  g_free(priv->startup_id);
-  g_free(priv->app_id);
+  gsm_util_release_id(priv->id);
+  gsm_util_release_id(priv->startup_id);
+  gsm_util_release_id(priv->app_id);
 
   G_OBJECT_CLASS(gsm_client_parent_class)->finalize(object);
 }
@@ -175,12 +178,12 @@ static void gsm_client_set_startup_id(GsmClient *client,
 
   priv = gsm_client_get_instance_private(client);
 
-  g_free(priv->startup_id);
+  gsm_util_release_id(priv->startup_id);
 
   if (startup_id != NULL) {
-    priv->startup_id = g_strdup(startup_id);
+    priv->startup_id = gsm_util_intern_id(startup_id);
   } else {
-    priv->startup_id = g_strdup("");
+    priv->startup_id = gsm_util_intern_id("");
   }
   g_object_notify(G_OBJECT(client), "startup-id");
 }
@@ -191,12 +194,12 @@ void gsm_client_set_app_id(GsmClient *client, const char *app_id) {
 
   priv = gsm_client_get_instance_private(client);
 
-  g_free(priv->app_id);
+  gsm_util_release_id(priv->app_id);
 
   if (app_id != NULL) {
-    priv->app_id = g_strdup(app_id);
+    priv->app_id = gsm_util_intern_id(app_id);
   } else {
-    priv->app_id = g_strdup("");
+    priv->app_id = gsm_util_intern_id("");
   }
   g_object_notify(G_OBJECT(client), "app-id");
 }
@@ -255,6 +258,10 @@ static gboolean default_stop(GsmClient *client, GError **error) {
   return TRUE;
 }
 
+static char *default_get_protocol_trace(GsmClient *client) {
+  return NULL;
+}
+
 static void gsm_client_dispose(GObject *object) {
   GsmClient *client;
   GsmClientPrivate *priv;
@@ -280,6 +287,7 @@ static void gsm_client_class_init(GsmClientClass *klass) {
   object_class->dispose = gsm_client_dispose;
 
   klass->impl_stop = default_stop;
+  klass->impl_get_protocol_trace = default_get_protocol_trace;
 
   signals[DISCONNECTED] = g_signal_new(
       "disconnected", G_OBJECT_CLASS_TYPE(object_class), G_SIGNAL_RUN_LAST,
@@ -414,6 +422,32 @@ gboolean gsm_client_get_unix_process_id(GsmClient *client, guint *pid,
   return TRUE;
 }
 
+gboolean gsm_client_get_protocol_trace(GsmClient *client, char **trace,
+                                       GError **error) {
+  g_return_val_if_fail(GSM_IS_CLIENT(client), FALSE);
+
+  *trace = gsm_client_get_protocol_trace_text(client);
+  if (*trace == NULL) {
+    *trace = g_strdup("");
+  }
+
+  return TRUE;
+}
+
+/**
+ * gsm_client_get_protocol_trace_text:
+ * @client: a #GsmClient.
+ *
+ * Returns: a report of the recent session management protocol messages
+ * exchanged with the client and of its response times, or %NULL if the
+ * client type keeps no trace.
+ **/
+char *gsm_client_get_protocol_trace_text(GsmClient *client) {
+  g_return_val_if_fail(GSM_IS_CLIENT(client), NULL);
+
+  return GSM_CLIENT_GET_CLASS(client)->impl_get_protocol_trace(client);
+}
+
 /**
  * gsm_client_get_app_name:
  * @client: a #GsmClient.
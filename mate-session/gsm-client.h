@@ -70,6 +70,7 @@ struct _GsmClientClass {
   gboolean (*impl_cancel_end_session)(GsmClient *client, GError **error);
   gboolean (*impl_stop)(GsmClient *client, GError **error);
   GKeyFile *(*impl_save)(GsmClient *client, GError **error);
+  char *(*impl_get_protocol_trace)(GsmClient *client);
 };
 
 typedef enum {
@@ -92,6 +93,7 @@ guint gsm_client_peek_restart_style_hint(GsmClient *client);
 guint gsm_client_peek_status(GsmClient *client);
 
 char *gsm_client_get_app_name(GsmClient *client);
+char *gsm_client_get_protocol_trace_text(GsmClient *client);
 void gsm_client_set_app_id(GsmClient *client, const char *app_id);
 void gsm_client_set_status(GsmClient *client, guint status);
 
@@ -115,6 +117,8 @@ gboolean gsm_client_get_status(GsmClient *client, guint *status,
                                GError **error);
 gboolean gsm_client_get_unix_process_id(GsmClient *client, guint *pid,
                                         GError **error);
+gboolean gsm_client_get_protocol_trace(GsmClient *client, char **trace,
+                                       GError **error);
 
 /* private */
 
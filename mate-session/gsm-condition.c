@@ -0,0 +1,1169 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*-
+ * gsm-condition.c
+ * Copyright (C) 2012-2021 MATE Developers
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include "gsm-condition.h"
+
+#include <ctype.h>
+#include <gdk/gdk.h>
+#include <gio/gio.h>
+#include <glib.h>
+#include <string.h>
+
+/* AutostartCondition values are compiled once, when the desktop file is
+ * loaded, into a small tree of and/or/not nodes over these atoms:
+ *
+ *   if-exists FILE          FILE exists in the user config dir
+ *   unless-exists FILE      the same as "not if-exists FILE"
+ *   GSettings SCHEMA KEY    the boolean KEY of SCHEMA is set ("MATE" too)
+ *   on-battery              UPower reports that the system is on battery
+ *   session-type TYPE       $XDG_SESSION_TYPE is TYPE
+ *   dbus-name NAME          NAME has an owner on the session bus
+ *   outputs N               at least N monitors are connected
+ *
+ * Atoms are combined with "and", "or" and "not" (or "&&", "||" and "!")
+ * and grouped with parentheses; arguments containing spaces can be
+ * double-quoted. A string that does not compile as an expression is read
+ * the old way, as a single atom whose argument is the rest of the string.
+ *
+ * Watched conditions share the monitors their atoms need: one directory
+ * monitor per parent directory, one GSettings object per schema, one name
+ * watch per bus name, and a single UPower proxy and display. Each keeps an
+ * index from its inputs to the atoms depending on them, so that a change
+ * only re-evaluates the conditions it affects.
+ *
+ * Bus names and the power source are only known once the name watch or the
+ * UPower proxy reports back from the main loop. Until then their atoms are
+ * pending, and so is any watched condition using them: it reads as false
+ * and is not notified, so that the app neither starts nor gets killed on a
+ * value nobody has seen yet. */
+
+#define UPOWER_DBUS_NAME "org.freedesktop.UPower"
+#define UPOWER_DBUS_PATH "/org/freedesktop/UPower"
+#define UPOWER_DBUS_INTERFACE "org.freedesktop.UPower"
+
+typedef enum {
+  ATOM_FILE_EXISTS,
+  ATOM_GSETTINGS,
+  ATOM_ON_BATTERY,
+  ATOM_SESSION_TYPE,
+  ATOM_DBUS_NAME,
+  ATOM_OUTPUTS
+} AtomKind;
+
+typedef struct {
+  GsmCondition *condition;
+  AtomKind kind;
+
+  /* directory, schema id, session type or bus name */
+  char *name;
+  /* file name or settings key */
+  char *key;
+  /* number of outputs */
+  guint count;
+
+  /* kept up to date by the monitors while the condition is watched */
+  gboolean value;
+  /* watched, but the monitor has not reported a value yet */
+  gboolean pending;
+} ConditionAtom;
+
+typedef enum { NODE_ATOM, NODE_NOT, NODE_AND, NODE_OR } NodeType;
+
+typedef struct _ConditionNode ConditionNode;
+
+struct _ConditionNode {
+  NodeType type;
+  ConditionAtom *atom;
+  ConditionNode *left;
+  ConditionNode *right;
+};
+
+struct _GsmCondition {
+  ConditionNode *root;
+  GPtrArray *atoms;
+
+  gboolean value;
+  guint n_pending; /* number of pending atoms */
+  GsmConditionFunc func;
+  gpointer user_data;
+};
+
+typedef struct {
+  GFileMonitor *monitor;
+  GHashTable *watchers; /* basename -> GSList of ConditionAtom */
+} DirectoryMonitor;
+
+typedef struct {
+  GSettingsSchema *schema;
+  GSettings *settings;
+  GHashTable *watchers; /* key -> GSList of ConditionAtom */
+} SettingsMonitor;
+
+typedef struct {
+  guint watch_id;
+  /* FALSE until the first appeared or vanished callback */
+  gboolean known;
+  gboolean has_owner;
+  GSList *watchers;
+} NameWatch;
+
+static GHashTable *directory_monitors = NULL; /* dirname -> DirectoryMonitor */
+static GHashTable *settings_monitors = NULL;  /* schema id -> SettingsMonitor */
+static GHashTable *name_watches = NULL;       /* bus name -> NameWatch */
+
+static GDBusProxy *upower_proxy = NULL;
+/* set while the proxy is being created */
+static GCancellable *upower_cancellable = NULL;
+static GSList *battery_watchers = NULL;
+
+static GdkDisplay *outputs_display = NULL;
+static GSList *outputs_watchers = NULL;
+static guint outputs_idle_id = 0;
+
+static void index_add(GHashTable *index, const char *name,
+                      ConditionAtom *atom) {
+  GSList *list;
+
+  list = g_hash_table_lookup(index, name);
+  g_hash_table_insert(index, g_strdup(name), g_slist_prepend(list, atom));
+}
+
+static void index_remove(GHashTable *index, const char *name,
+                         ConditionAtom *atom) {
+  GSList *list;
+
+  list = g_hash_table_lookup(index, name);
+  list = g_slist_remove(list, atom);
+  if (list == NULL) {
+    g_hash_table_remove(index, name);
+  } else {
+    g_hash_table_insert(index, g_strdup(name), list);
+  }
+}
+
+static gboolean node_evaluate(ConditionNode *node) {
+  switch (node->type) {
+    case NODE_ATOM:
+      return node->atom->value;
+    case NODE_NOT:
+      return !node_evaluate(node->left);
+    case NODE_AND:
+      return node_evaluate(node->left) && node_evaluate(node->right);
+    case NODE_OR:
+      return node_evaluate(node->left) || node_evaluate(node->right);
+    default:
+      g_assert_not_reached();
+  }
+
+  return FALSE;
+}
+
+static void atom_set_value(ConditionAtom *atom, gboolean value) {
+  GsmCondition *condition;
+
+  if (value == atom->value && !atom->pending) {
+    return;
+  }
+
+  condition = atom->condition;
+  atom->value = value;
+  if (atom->pending) {
+    atom->pending = FALSE;
+    condition->n_pending--;
+  }
+
+  if (condition->func == NULL || condition->n_pending > 0) {
+    return;
+  }
+
+  value = node_evaluate(condition->root);
+
+  /* Notify only if the condition actually changed */
+  if (value != condition->value) {
+    condition->value = value;
+    condition->func(condition, value, condition->user_data);
+  }
+}
+
+static void dispatch(GSList *watchers, gboolean value) {
+  GSList *copy;
+  GSList *l;
+
+  /* the callbacks may unwatch conditions */
+  copy = g_slist_copy(watchers);
+  for (l = copy; l != NULL; l = l->next) {
+    atom_set_value(l->data, value);
+  }
+  g_slist_free(copy);
+}
+
+static void on_directory_changed(GFileMonitor *monitor, GFile *file,
+                                 GFile *other_file, GFileMonitorEvent event,
+                                 DirectoryMonitor *dir) {
+  gboolean exists;
+  char *basename;
+  GSList *watchers;
+
+  switch (event) {
+    case G_FILE_MONITOR_EVENT_CREATED:
+      exists = TRUE;
+      break;
+    case G_FILE_MONITOR_EVENT_DELETED:
+      exists = FALSE;
+      break;
+    default:
+      /* Ignore any other monitor event */
+      return;
+  }
+
+  basename = g_file_get_basename(file);
+  watchers = g_hash_table_lookup(dir->watchers, basename);
+  if (watchers != NULL) {
+    g_debug("GsmCondition: %s %s", basename, exists ? "created" : "deleted");
+    dispatch(watchers, exists);
+  }
+  g_free(basename);
+}
+
+static void directory_monitor_free(DirectoryMonitor *dir) {
+  g_signal_handlers_disconnect_by_func(dir->monitor, on_directory_changed, dir);
+  g_file_monitor_cancel(dir->monitor);
+  g_object_unref(dir->monitor);
+  g_hash_table_destroy(dir->watchers);
+  g_free(dir);
+}
+
+static DirectoryMonitor *directory_monitor_get(const char *dirname) {
+  DirectoryMonitor *dir;
+  GFileMonitor *monitor;
+  GFile *file;
+  GError *error;
+
+  if (directory_monitors == NULL) {
+    directory_monitors =
+        g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
+                              (GDestroyNotify)directory_monitor_free);
+  }
+
+  dir = g_hash_table_lookup(directory_monitors, dirname);
+  if (dir != NULL) {
+    return dir;
+  }
+
+  error = NULL;
+  file = g_file_new_for_path(dirname);
+  monitor = g_file_monitor_directory(file, G_FILE_MONITOR_NONE, NULL, &error);
+  g_object_unref(file);
+
+  if (monitor == NULL) {
+    g_warning("Unable to monitor %s: %s", dirname, error->message);
+    g_error_free(error);
+    return NULL;
+  }
+
+  g_debug("GsmCondition: monitoring %s", dirname);
+
+  dir = g_new0(DirectoryMonitor, 1);
+  dir->monitor = monitor;
+  dir->watchers = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+  g_signal_connect(monitor, "changed", G_CALLBACK(on_directory_changed), dir);
+
+  g_hash_table_insert(directory_monitors, g_strdup(dirname), dir);
+
+  return dir;
+}
+
+static void on_settings_changed(GSettings *settings, const char *key,
+                                SettingsMonitor *monitor) {
+  GSList *watchers;
+
+  watchers = g_hash_table_lookup(monitor->watchers, key);
+  if (watchers != NULL) {
+    gboolean value;
+
+    value = g_settings_get_boolean(settings, key);
+    g_debug("GsmCondition: %s changed to %d", key, value);
+    dispatch(watchers, value);
+  }
+}
+
+static void settings_monitor_free(SettingsMonitor *monitor) {
+  g_signal_handlers_disconnect_by_func(monitor->settings, on_settings_changed,
+                                       monitor);
+  g_object_unref(monitor->settings);
+  g_settings_schema_unref(monitor->schema);
+  g_hash_table_destroy(monitor->watchers);
+  g_free(monitor);
+}
+
+static SettingsMonitor *settings_monitor_get(const char *schema_id) {
+  SettingsMonitor *monitor;
+  GSettingsSchemaSource *source;
+  GSettingsSchema *schema;
+
+  if (settings_monitors == NULL) {
+    settings_monitors =
+        g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
+                              (GDestroyNotify)settings_monitor_free);
+  }
+
+  monitor = g_hash_table_lookup(settings_monitors, schema_id);
+  if (monitor != NULL) {
+    return monitor;
+  }
+
+  source = g_settings_schema_source_get_default();
+  if (source == NULL) {
+    return NULL;
+  }
+
+  schema = g_settings_schema_source_lookup(source, schema_id, TRUE);
+  if (schema == NULL) {
+    g_debug("GsmCondition: schema %s is not installed", schema_id);
+    return NULL;
+  }
+
+  monitor = g_new0(SettingsMonitor, 1);
+  monitor->schema = schema;
+  monitor->settings = g_settings_new_full(schema, NULL, NULL);
+  monitor->watchers =
+      g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+  g_signal_connect(monitor->settings, "changed",
+                   G_CALLBACK(on_settings_changed), monitor);
+
+  g_hash_table_insert(settings_monitors, g_strdup(schema_id), monitor);
+
+  return monitor;
+}
+
+static gboolean settings_monitor_has_key(SettingsMonitor *monitor,
+                                         const char *key) {
+  GSettingsSchemaKey *schema_key;
+  gboolean is_boolean;
+
+  if (!g_settings_schema_has_key(monitor->schema, key)) {
+    return FALSE;
+  }
+
+  schema_key = g_settings_schema_get_key(monitor->schema, key);
+  is_boolean = g_variant_type_equal(
+      g_settings_schema_key_get_value_type(schema_key), G_VARIANT_TYPE_BOOLEAN);
+  g_settings_schema_key_unref(schema_key);
+
+  return is_boolean;
+}
+
+static void on_name_appeared(GDBusConnection *connection, const char *name,
+                             const char *name_owner, NameWatch *watch) {
+  g_debug("GsmCondition: %s appeared", name);
+  watch->known = TRUE;
+  watch->has_owner = TRUE;
+  dispatch(watch->watchers, TRUE);
+}
+
+static void on_name_vanished(GDBusConnection *connection, const char *name,
+                             NameWatch *watch) {
+  g_debug("GsmCondition: %s vanished", name);
+  watch->known = TRUE;
+  watch->has_owner = FALSE;
+  dispatch(watch->watchers, FALSE);
+}
+
+static void name_watch_free(NameWatch *watch) {
+  g_bus_unwatch_name(watch->watch_id);
+  g_slist_free(watch->watchers);
+  g_free(watch);
+}
+
+static NameWatch *name_watch_get(const char *name) {
+  NameWatch *watch;
+
+  if (name_watches == NULL) {
+    name_watches = g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
+                                         (GDestroyNotify)name_watch_free);
+  }
+
+  watch = g_hash_table_lookup(name_watches, name);
+  if (watch != NULL) {
+    return watch;
+  }
+
+  /* One of the callbacks is always called, from the main loop; if the bus
+   * cannot be reached, the name vanishes */
+  watch = g_new0(NameWatch, 1);
+  watch->watch_id = g_bus_watch_name(
+      G_BUS_TYPE_SESSION, name, G_BUS_NAME_WATCHER_FLAGS_NONE,
+      (GBusNameAppearedCallback)on_name_appeared,
+      (GBusNameVanishedCallback)on_name_vanished, watch, NULL);
+
+  g_hash_table_insert(name_watches, g_strdup(name), watch);
+
+  return watch;
+}
+
+static gboolean upower_get_on_battery(void) {
+  GVariant *variant;
+  gboolean on_battery;
+
+  if (upower_proxy == NULL) {
+    return FALSE;
+  }
+
+  on_battery = FALSE;
+  variant = g_dbus_proxy_get_cached_property(upower_proxy, "OnBattery");
+  if (variant != NULL) {
+    if (g_variant_is_of_type(variant, G_VARIANT_TYPE_BOOLEAN)) {
+      on_battery = g_variant_get_boolean(variant);
+    }
+    g_variant_unref(variant);
+  }
+
+  return on_battery;
+}
+
+static void on_upower_properties_changed(GDBusProxy *proxy,
+                                         GVariant *changed_properties,
+                                         GStrv invalidated_properties,
+                                         gpointer user_data) {
+  dispatch(battery_watchers, upower_get_on_battery());
+}
+
+static void on_upower_proxy_ready(GObject *source, GAsyncResult *result,
+                                  GCancellable *cancellable) {
+  GDBusProxy *proxy;
+  GError *error;
+
+  error = NULL;
+  proxy = g_dbus_proxy_new_for_bus_finish(result, &error);
+
+  /* the last watcher went away in the meantime */
+  if (g_cancellable_is_cancelled(cancellable)) {
+    g_clear_object(&proxy);
+    g_clear_error(&error);
+    g_object_unref(cancellable);
+    return;
+  }
+  g_object_unref(cancellable);
+
+  if (proxy == NULL) {
+    g_warning("Unable to watch the power source: %s", error->message);
+    g_error_free(error);
+  }
+
+  g_clear_object(&upower_cancellable);
+
+  upower_proxy = proxy;
+  if (upower_proxy != NULL) {
+    g_signal_connect(upower_proxy, "g-properties-changed",
+                     G_CALLBACK(on_upower_properties_changed), NULL);
+  }
+
+  /* also the first value of the pending atoms; without a proxy the system
+   * is taken to be on mains power */
+  dispatch(battery_watchers, upower_get_on_battery());
+}
+
+/* Returns TRUE if the value of @atom is pending */
+static gboolean upower_watch(ConditionAtom *atom) {
+  if (battery_watchers == NULL) {
+    upower_cancellable = g_cancellable_new();
+    g_dbus_proxy_new_for_bus(
+        G_BUS_TYPE_SYSTEM, G_DBUS_PROXY_FLAGS_DO_NOT_AUTO_START, NULL,
+        UPOWER_DBUS_NAME, UPOWER_DBUS_PATH, UPOWER_DBUS_INTERFACE,
+        upower_cancellable, (GAsyncReadyCallback)on_upower_proxy_ready,
+        g_object_ref(upower_cancellable));
+  }
+
+  battery_watchers = g_slist_prepend(battery_watchers, atom);
+
+  return upower_cancellable != NULL;
+}
+
+static void upower_unwatch(ConditionAtom *atom) {
+  battery_watchers = g_slist_remove(battery_watchers, atom);
+
+  if (battery_watchers != NULL) {
+    return;
+  }
+
+  if (upower_cancellable != NULL) {
+    g_cancellable_cancel(upower_cancellable);
+    g_clear_object(&upower_cancellable);
+  }
+
+  if (upower_proxy != NULL) {
+    g_signal_handlers_disconnect_by_func(upower_proxy,
+                                         on_upower_properties_changed, NULL);
+    g_clear_object(&upower_proxy);
+  }
+}
+
+static guint count_outputs(void) {
+  GdkDisplay *display;
+
+  display = gdk_display_get_default();
+  if (display == NULL) {
+    return 0;
+  }
+
+  return (guint)gdk_display_get_n_monitors(display);
+}
+
+static gboolean update_outputs_idle(gpointer user_data) {
+  GSList *copy;
+  GSList *l;
+  guint n_outputs;
+
+  outputs_idle_id = 0;
+
+  n_outputs = count_outputs();
+  g_debug("GsmCondition: %u outputs connected", n_outputs);
+
+  copy = g_slist_copy(outputs_watchers);
+  for (l = copy; l != NULL; l = l->next) {
+    ConditionAtom *atom = l->data;
+
+    atom_set_value(atom, n_outputs >= atom->count);
+  }
+  g_slist_free(copy);
+
+  return FALSE;
+}
+
+static void on_outputs_changed(GdkDisplay *display, GdkMonitor *monitor,
+                               gpointer user_data) {
+  /* a removed monitor is still counted while the signal is emitted, and
+   * outputs tend to change several at a time */
+  if (outputs_idle_id == 0) {
+    outputs_idle_id = g_idle_add(update_outputs_idle, NULL);
+  }
+}
+
+static void outputs_watch(ConditionAtom *atom) {
+  if (outputs_display == NULL) {
+    outputs_display = gdk_display_get_default();
+    if (outputs_display == NULL) {
+      return;
+    }
+
+    g_object_ref(outputs_display);
+    g_signal_connect(outputs_display, "monitor-added",
+                     G_CALLBACK(on_outputs_changed), NULL);
+    g_signal_connect(outputs_display, "monitor-removed",
+                     G_CALLBACK(on_outputs_changed), NULL);
+  }
+
+  outputs_watchers = g_slist_prepend(outputs_watchers, atom);
+}
+
+static void outputs_unwatch(ConditionAtom *atom) {
+  outputs_watchers = g_slist_remove(outputs_watchers, atom);
+
+  if (outputs_watchers == NULL && outputs_display != NULL) {
+    g_signal_handlers_disconnect_by_func(outputs_display, on_outputs_changed,
+                                         NULL);
+    g_clear_object(&outputs_display);
+
+    if (outputs_idle_id > 0) {
+      g_source_remove(outputs_idle_id);
+      outputs_idle_id = 0;
+    }
+  }
+}
+
+static gboolean atom_compute_value(ConditionAtom *atom) {
+  SettingsMonitor *monitor;
+  NameWatch *watch;
+  char *file_path;
+  gboolean exists;
+
+  switch (atom->kind) {
+    case ATOM_FILE_EXISTS:
+      file_path = g_build_filename(atom->name, atom->key, NULL);
+      exists = g_file_test(file_path, G_FILE_TEST_EXISTS);
+      g_free(file_path);
+      return exists;
+    case ATOM_GSETTINGS:
+      /* Keys are only read through the shared settings objects; a
+       * condition nobody watches sees them as false */
+      monitor = settings_monitors != NULL
+                    ? g_hash_table_lookup(settings_monitors, atom->name)
+                    : NULL;
+      if (monitor == NULL || !settings_monitor_has_key(monitor, atom->key)) {
+        return FALSE;
+      }
+      return g_settings_get_boolean(monitor->settings, atom->key);
+    case ATOM_ON_BATTERY:
+      return upower_get_on_battery();
+    case ATOM_SESSION_TYPE:
+      return g_strcmp0(g_getenv("XDG_SESSION_TYPE"), atom->name) == 0;
+    case ATOM_DBUS_NAME:
+      watch = name_watches != NULL
+                  ? g_hash_table_lookup(name_watches, atom->name)
+                  : NULL;
+      return watch != NULL && watch->has_owner;
+    case ATOM_OUTPUTS:
+      return count_outputs() >= atom->count;
+    default:
+      g_assert_not_reached();
+  }
+
+  return FALSE;
+}
+
+static void atom_watch(ConditionAtom *atom) {
+  DirectoryMonitor *dir;
+  SettingsMonitor *monitor;
+  NameWatch *watch;
+
+  switch (atom->kind) {
+    case ATOM_FILE_EXISTS:
+      dir = directory_monitor_get(atom->name);
+      if (dir != NULL) {
+        index_add(dir->watchers, atom->key, atom);
+      }
+      break;
+    case ATOM_GSETTINGS:
+      monitor = settings_monitor_get(atom->name);
+      if (monitor == NULL) {
+        break;
+      }
+
+      if (settings_monitor_has_key(monitor, atom->key)) {
+        index_add(monitor->watchers, atom->key, atom);
+      } else {
+        g_debug("GsmCondition: %s has no boolean key %s", atom->name,
+                atom->key);
+        if (g_hash_table_size(monitor->watchers) == 0) {
+          g_hash_table_remove(settings_monitors, atom->name);
+        }
+      }
+      break;
+    case ATOM_ON_BATTERY:
+      atom->pending = upower_watch(atom);
+      break;
+    case ATOM_SESSION_TYPE:
+      /* fixed for the lifetime of the session */
+      break;
+    case ATOM_DBUS_NAME:
+      watch = name_watch_get(atom->name);
+      watch->watchers = g_slist_prepend(watch->watchers, atom);
+      atom->pending = !watch->known;
+      break;
+    case ATOM_OUTPUTS:
+      outputs_watch(atom);
+      break;
+    default:
+      g_assert_not_reached();
+  }
+
+  if (atom->pending) {
+    atom->value = FALSE;
+    atom->condition->n_pending++;
+  } else {
+    atom->value = atom_compute_value(atom);
+  }
+}
+
+static void atom_unwatch(ConditionAtom *atom) {
+  DirectoryMonitor *dir;
+  SettingsMonitor *monitor;
+  NameWatch *watch;
+
+  switch (atom->kind) {
+    case ATOM_FILE_EXISTS:
+      dir = directory_monitors != NULL
+                ? g_hash_table_lookup(directory_monitors, atom->name)
+                : NULL;
+      if (dir != NULL) {
+        index_remove(dir->watchers, atom->key, atom);
+        if (g_hash_table_size(dir->watchers) == 0) {
+          g_hash_table_remove(directory_monitors, atom->name);
+        }
+      }
+      break;
+    case ATOM_GSETTINGS:
+      monitor = settings_monitors != NULL
+                    ? g_hash_table_lookup(settings_monitors, atom->name)
+                    : NULL;
+      if (monitor != NULL) {
+        index_remove(monitor->watchers, atom->key, atom);
+        if (g_hash_table_size(monitor->watchers) == 0) {
+          g_hash_table_remove(settings_monitors, atom->name);
+        }
+      }
+      break;
+    case ATOM_ON_BATTERY:
+      upower_unwatch(atom);
+      break;
+    case ATOM_SESSION_TYPE:
+      break;
+    case ATOM_DBUS_NAME:
+      watch = name_watches != NULL
+                  ? g_hash_table_lookup(name_watches, atom->name)
+                  : NULL;
+      if (watch != NULL) {
+        watch->watchers = g_slist_remove(watch->watchers, atom);
+        if (watch->watchers == NULL) {
+          g_hash_table_remove(name_watches, atom->name);
+        }
+      }
+      break;
+    case ATOM_OUTPUTS:
+      outputs_unwatch(atom);
+      break;
+    default:
+      g_assert_not_reached();
+  }
+
+  atom->pending = FALSE;
+}
+
+static void atom_free(ConditionAtom *atom) {
+  g_free(atom->name);
+  g_free(atom->key);
+  g_free(atom);
+}
+
+static void node_free(ConditionNode *node) {
+  if (node == NULL) {
+    return;
+  }
+
+  node_free(node->left);
+  node_free(node->right);
+  g_free(node);
+}
+
+static ConditionNode *node_new(NodeType type, ConditionNode *left,
+                               ConditionNode *right) {
+  ConditionNode *node;
+
+  node = g_new0(ConditionNode, 1);
+  node->type = type;
+  node->left = left;
+  node->right = right;
+
+  return node;
+}
+
+static ConditionNode *node_new_atom(GsmCondition *condition, AtomKind kind,
+                                    char *name, char *key) {
+  ConditionAtom *atom;
+  ConditionNode *node;
+
+  atom = g_new0(ConditionAtom, 1);
+  atom->condition = condition;
+  atom->kind = kind;
+  atom->name = name;
+  atom->key = key;
+  g_ptr_array_add(condition->atoms, atom);
+
+  node = node_new(NODE_ATOM, NULL, NULL);
+  node->atom = atom;
+
+  return node;
+}
+
+static ConditionNode *node_new_file_exists(GsmCondition *condition,
+                                           const char *path) {
+  char *file_path;
+  ConditionNode *node;
+
+  file_path = g_build_filename(g_get_user_config_dir(), path, NULL);
+  node = node_new_atom(condition, ATOM_FILE_EXISTS,
+                       g_path_get_dirname(file_path),
+                       g_path_get_basename(file_path));
+  g_free(file_path);
+
+  return node;
+}
+
+typedef struct {
+  GsmCondition *condition;
+  const char *p;
+  char *token; /* NULL at the end of the string */
+  gboolean quoted;
+  gboolean error;
+} Parser;
+
+static void next_token(Parser *parser) {
+  const char *p;
+  const char *start;
+
+  g_clear_pointer(&parser->token, g_free);
+  parser->quoted = FALSE;
+
+  p = parser->p;
+  while (isspace((unsigned char)*p)) {
+    p++;
+  }
+
+  if (*p == '\0') {
+    parser->p = p;
+    return;
+  }
+
+  if (*p == '(' || *p == ')' || *p == '!') {
+    parser->token = g_strndup(p, 1);
+    p++;
+  } else if (*p == '"') {
+    start = ++p;
+    while (*p != '\0' && *p != '"') {
+      p++;
+    }
+    if (*p != '"') {
+      parser->error = TRUE;
+      parser->p = p;
+      return;
+    }
+    parser->token = g_strndup(start, p - start);
+    parser->quoted = TRUE;
+    p++;
+  } else {
+    start = p;
+    while (*p != '\0' && !isspace((unsigned char)*p) && *p != '(' &&
+           *p != ')') {
+      p++;
+    }
+    parser->token = g_strndup(start, p - start);
+  }
+
+  parser->p = p;
+}
+
+static gboolean token_is(Parser *parser, const char *word) {
+  return parser->token != NULL && !parser->quoted &&
+         g_ascii_strcasecmp(parser->token, word) == 0;
+}
+
+static char *take_argument(Parser *parser) {
+  char *argument;
+
+  if (parser->token == NULL || token_is(parser, "(") ||
+      token_is(parser, ")")) {
+    parser->error = TRUE;
+    return NULL;
+  }
+
+  argument = parser->token;
+  parser->token = NULL;
+  next_token(parser);
+
+  return argument;
+}
+
+static ConditionNode *parse_or(Parser *parser);
+
+static ConditionNode *parse_atom(Parser *parser) {
+  GsmCondition *condition;
+  ConditionNode *node;
+  char *name;
+  char *key;
+
+  condition = parser->condition;
+  node = NULL;
+
+  if (token_is(parser, "if-exists") || token_is(parser, "unless-exists")) {
+    gboolean negate = token_is(parser, "unless-exists");
+
+    next_token(parser);
+    name = take_argument(parser);
+    if (name != NULL) {
+      node = node_new_file_exists(condition, name);
+      if (negate) {
+        node = node_new(NODE_NOT, node, NULL);
+      }
+      g_free(name);
+    }
+  } else if (token_is(parser, "GSettings") || token_is(parser, "MATE")) {
+    next_token(parser);
+    name = take_argument(parser);
+    key = take_argument(parser);
+    if (name != NULL && key != NULL) {
+      node = node_new_atom(condition, ATOM_GSETTINGS, name, key);
+    } else {
+      g_free(name);
+      g_free(key);
+    }
+  } else if (token_is(parser, "on-battery")) {
+    next_token(parser);
+    node = node_new_atom(condition, ATOM_ON_BATTERY, NULL, NULL);
+  } else if (token_is(parser, "session-type")) {
+    next_token(parser);
+    name = take_argument(parser);
+    if (name != NULL) {
+      node = node_new_atom(condition, ATOM_SESSION_TYPE, name, NULL);
+    }
+  } else if (token_is(parser, "dbus-name")) {
+    next_token(parser);
+    name = take_argument(parser);
+    if (name != NULL && g_dbus_is_name(name)) {
+      node = node_new_atom(condition, ATOM_DBUS_NAME, name, NULL);
+    } else {
+      parser->error = TRUE;
+      g_free(name);
+    }
+  } else if (token_is(parser, "outputs")) {
+    guint64 count;
+
+    next_token(parser);
+    name = take_argument(parser);
+    if (name != NULL &&
+        g_ascii_string_to_unsigned(name, 10, 0, G_MAXUINT, &count, NULL)) {
+      node = node_new_atom(condition, ATOM_OUTPUTS, NULL, NULL);
+      node->atom->count = (guint)count;
+    } else {
+      parser->error = TRUE;
+    }
+    g_free(name);
+  } else {
+    parser->error = TRUE;
+  }
+
+  return node;
+}
+
+static ConditionNode *parse_unary(Parser *parser) {
+  ConditionNode *node;
+
+  if (token_is(parser, "not") || token_is(parser, "!")) {
+    next_token(parser);
+    node = parse_unary(parser);
+    return node != NULL ? node_new(NODE_NOT, node, NULL) : NULL;
+  }
+
+  if (token_is(parser, "(")) {
+    next_token(parser);
+    node = parse_or(parser);
+    if (node == NULL || !token_is(parser, ")")) {
+      parser->error = TRUE;
+      node_free(node);
+      return NULL;
+    }
+    next_token(parser);
+    return node;
+  }
+
+  return parse_atom(parser);
+}
+
+static ConditionNode *parse_and(Parser *parser) {
+  ConditionNode *left;
+
+  left = parse_unary(parser);
+  while (left != NULL && (token_is(parser, "and") || token_is(parser, "&&"))) {
+    ConditionNode *right;
+
+    next_token(parser);
+    right = parse_unary(parser);
+    if (right == NULL) {
+      node_free(left);
+      return NULL;
+    }
+    left = node_new(NODE_AND, left, right);
+  }
+
+  return left;
+}
+
+static ConditionNode *parse_or(Parser *parser) {
+  ConditionNode *left;
+
+  left = parse_and(parser);
+  while (left != NULL && (token_is(parser, "or") || token_is(parser, "||"))) {
+    ConditionNode *right;
+
+    next_token(parser);
+    right = parse_and(parser);
+    if (right == NULL) {
+      node_free(left);
+      return NULL;
+    }
+    left = node_new(NODE_OR, left, right);
+  }
+
+  return left;
+}
+
+static ConditionNode *compile_expression(GsmCondition *condition,
+                                         const char *condition_string) {
+  Parser parser = {0};
+  ConditionNode *root;
+
+  parser.condition = condition;
+  parser.p = condition_string;
+  next_token(&parser);
+
+  root = parse_or(&parser);
+  if (parser.error || parser.token != NULL) {
+    node_free(root);
+    root = NULL;
+  }
+
+  g_free(parser.token);
+
+  return root;
+}
+
+/* A single atom, with the argument running to the end of the string, as
+ * conditions were written before they could be combined */
+static ConditionNode *compile_legacy(GsmCondition *condition,
+                                     const char *condition_string) {
+  ConditionNode *node;
+  const char *space;
+  const char *key;
+  int len;
+
+  space = condition_string + strcspn(condition_string, " ");
+  len = space - condition_string;
+  key = space;
+  while (isspace((unsigned char)*key)) {
+    key++;
+  }
+
+  if (*key == '\0') {
+    return NULL;
+  }
+
+  if (!g_ascii_strncasecmp(condition_string, "if-exists", len)) {
+    node = node_new_file_exists(condition, key);
+  } else if (!g_ascii_strncasecmp(condition_string, "unless-exists", len)) {
+    node = node_new(NODE_NOT, node_new_file_exists(condition, key), NULL);
+  } else if (!g_ascii_strncasecmp(condition_string, "MATE", len) ||
+             !g_ascii_strncasecmp(condition_string, "GSettings", len)) {
+    char **elems;
+
+    elems = g_strsplit(key, " ", 2);
+    if (elems[0] == NULL || elems[1] == NULL) {
+      g_strfreev(elems);
+      return NULL;
+    }
+
+    node = node_new_atom(condition, ATOM_GSETTINGS, elems[0], elems[1]);
+    g_free(elems);
+  } else {
+    return NULL;
+  }
+
+  return node;
+}
+
+GsmCondition *gsm_condition_new(const char *condition_string) {
+  GsmCondition *condition;
+
+  g_return_val_if_fail(condition_string != NULL, NULL);
+
+  condition = g_new0(GsmCondition, 1);
+  condition->atoms = g_ptr_array_new_with_free_func((GDestroyNotify)atom_free);
+
+  condition->root = compile_expression(condition, condition_string);
+  if (condition->root == NULL) {
+    g_ptr_array_set_size(condition->atoms, 0);
+    condition->root = compile_legacy(condition, condition_string);
+  }
+
+  if (condition->root == NULL) {
+    g_debug("GsmCondition: invalid condition '%s'", condition_string);
+    gsm_condition_free(condition);
+    return NULL;
+  }
+
+  g_debug("GsmCondition: compiled '%s' with %u atoms", condition_string,
+          condition->atoms->len);
+
+  return condition;
+}
+
+void gsm_condition_free(GsmCondition *condition) {
+  if (condition == NULL) {
+    return;
+  }
+
+  gsm_condition_unwatch(condition);
+
+  node_free(condition->root);
+  g_ptr_array_unref(condition->atoms);
+  g_free(condition);
+}
+
+gboolean gsm_condition_is_pending(GsmCondition *condition) {
+  g_return_val_if_fail(condition != NULL, FALSE);
+
+  return condition->n_pending > 0;
+}
+
+gboolean gsm_condition_evaluate(GsmCondition *condition) {
+  guint i;
+
+  g_return_val_if_fail(condition != NULL, FALSE);
+
+  if (condition->func != NULL) {
+    return condition->value;
+  }
+
+  for (i = 0; i < condition->atoms->len; i++) {
+    ConditionAtom *atom = g_ptr_array_index(condition->atoms, i);
+
+    atom->value = atom_compute_value(atom);
+  }
+
+  return node_evaluate(condition->root);
+}
+
+void gsm_condition_watch(GsmCondition *condition, GsmConditionFunc func,
+                         gpointer user_data) {
+  guint i;
+
+  g_return_if_fail(condition != NULL);
+  g_return_if_fail(func != NULL);
+  g_return_if_fail(condition->func == NULL);
+
+  for (i = 0; i < condition->atoms->len; i++) {
+    atom_watch(g_ptr_array_index(condition->atoms, i));
+  }
+
+  condition->value =
+      condition->n_pending == 0 && node_evaluate(condition->root);
+  condition->func = func;
+  condition->user_data = user_data;
+}
+
+void gsm_condition_unwatch(GsmCondition *condition) {
+  guint i;
+
+  g_return_if_fail(condition != NULL);
+
+  if (condition->func == NULL) {
+    return;
+  }
+
+  for (i = 0; i < condition->atoms->len; i++) {
+    atom_unwatch(g_ptr_array_index(condition->atoms, i));
+  }
+
+  condition->n_pending = 0;
+  condition->func = NULL;
+  condition->user_data = NULL;
+}
@@ -0,0 +1,50 @@
+/* gsm-condition.h
+ * Copyright (C) 2012-2021 MATE Developers
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+#ifndef __GSM_CONDITION_H__
+#define __GSM_CONDITION_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+typedef struct _GsmCondition GsmCondition;
+
+typedef void (*GsmConditionFunc)(GsmCondition *condition, gboolean value,
+                                 gpointer user_data);
+
+/* Returns NULL if @condition_string is not a valid AutostartCondition */
+GsmCondition *gsm_condition_new(const char *condition_string);
+void gsm_condition_free(GsmCondition *condition);
+
+/* A watched condition is pending until all of its inputs have reported a
+ * value, such as whether a bus name has an owner; it evaluates to FALSE
+ * meanwhile, and @func is called once it is known to be TRUE */
+gboolean gsm_condition_is_pending(GsmCondition *condition);
+gboolean gsm_condition_evaluate(GsmCondition *condition);
+
+/* @func is called whenever the value of @condition changes, until the
+ * condition is unwatched or freed */
+void gsm_condition_watch(GsmCondition *condition, GsmConditionFunc func,
+                         gpointer user_data);
+void gsm_condition_unwatch(GsmCondition *condition);
+
+G_END_DECLS
+
+#endif /* __GSM_CONDITION_H__ */
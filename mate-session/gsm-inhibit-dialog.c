@@ -67,6 +67,7 @@ struct _GsmInhibitDialog {
   GsmStore *clients;
   GtkListStore *list_store;
   gboolean have_xrender;
+  GSList *thumbnail_requests;
   int xrender_event_base;
   int xrender_error_base;
 };
@@ -244,50 +245,57 @@ static GdkPixbuf *_load_icon(GtkIconTheme *icon_theme, const char *icon_name,
   return retval;
 }
 
-static GdkPixbuf *scale_pixbuf(GdkPixbuf *pixbuf, int max_width, int max_height,
-                               gboolean no_stretch_hint) {
-  int pw;
-  int ph;
-  float scale_factor_x = 1.0;
-  float scale_factor_y = 1.0;
-  float scale_factor = 1.0;
+#ifdef HAVE_XRENDER
+/* Window snapshots are scaled by the X server while compositing them into a
+ * thumbnail-sized pixmap, and only that pixmap is read back, on a later main
+ * loop iteration, so that showing the dialog never waits for them. */
+typedef struct {
+  GsmInhibitDialog *dialog;
+  char *inhibitor_id;
+  Window xwindow;
+  Pixmap xpixmap;
+  Visual *visual;
+  int width;
+  int height;
+  guint idle_id;
+} ThumbnailRequest;
 
-  pw = gdk_pixbuf_get_width(pixbuf);
-  ph = gdk_pixbuf_get_height(pixbuf);
+static void thumbnail_request_free(ThumbnailRequest *request) {
+  if (request->idle_id > 0) {
+    g_source_remove(request->idle_id);
+  }
 
-  /* Determine which dimension requires the smallest scale. */
-  scale_factor_x = (float)max_width / (float)pw;
-  scale_factor_y = (float)max_height / (float)ph;
+  if (request->xpixmap != None) {
+    GdkDisplay *gdkdisplay;
 
-  if (scale_factor_x > scale_factor_y) {
-    scale_factor = scale_factor_y;
-  } else {
-    scale_factor = scale_factor_x;
+    gdkdisplay = gtk_widget_get_display(GTK_WIDGET(request->dialog));
+    gdk_x11_display_error_trap_push(gdkdisplay);
+    XFreePixmap(GDK_DISPLAY_XDISPLAY(gdkdisplay), request->xpixmap);
+    gdk_x11_display_error_trap_pop_ignored(gdkdisplay);
   }
 
-  /* always scale down, allow to disable scaling up */
-  if (scale_factor < 1.0 || !no_stretch_hint) {
-    int scale_x = (int)(scale_factor * (float)pw);
-    int scale_y = (int)(scale_factor * (float)ph);
-    g_debug("Scaling to %dx%d", scale_x, scale_y);
-    return gdk_pixbuf_scale_simple(pixbuf, scale_x, scale_y,
-                                   GDK_INTERP_BILINEAR);
-  } else {
-    return g_object_ref(pixbuf);
-  }
+  g_free(request->inhibitor_id);
+  g_free(request);
+}
+
+static void thumbnail_request_done(ThumbnailRequest *request) {
+  GsmInhibitDialog *dialog;
+
+  dialog = request->dialog;
+  dialog->thumbnail_requests =
+      g_slist_remove(dialog->thumbnail_requests, request);
+  thumbnail_request_free(request);
 }
 
-#ifdef HAVE_XRENDER
 static GdkPixbuf *pixbuf_get_from_pixmap(Display *display, Pixmap xpixmap,
-                                         int width, int height) {
+                                         Visual *visual, int width,
+                                         int height) {
   GdkPixbuf *retval;
   cairo_surface_t *surface;
-  Visual *visual;
   retval = NULL;
 
   g_debug("GsmInhibitDialog: getting foreign pixmap for %u", (guint)xpixmap);
 
-  visual = DefaultVisual(display, 0);
   surface = cairo_xlib_surface_create(display, xpixmap, visual, width, height);
   if (surface != NULL) {
     g_debug("GsmInhibitDialog: getting pixbuf w=%d h=%d", width, height);
@@ -299,7 +307,9 @@ static GdkPixbuf *pixbuf_get_from_pixmap(Display *display, Pixmap xpixmap,
 }
 
 static Pixmap get_pixmap_for_window(Display *display, Window window,
-                                    int *widthp, int *heightp) {
+                                    int max_width, int max_height,
+                                    Visual **visualp, int *widthp,
+                                    int *heightp) {
   XWindowAttributes attr;
   XRenderPictureAttributes pa;
   Pixmap pixmap;
@@ -307,27 +317,59 @@ static Pixmap get_pixmap_for_window(Display *display, Window window,
   Picture src_picture;
   Picture dst_picture;
   gboolean has_alpha;
+  double scale;
   int width;
   int height;
 
-  XGetWindowAttributes(display, window, &attr);
+  if (!XGetWindowAttributes(display, window, &attr)) {
+    return None;
+  }
 
   format = XRenderFindVisualFormat(display, attr.visual);
+  if (format == NULL || attr.width <= 0 || attr.height <= 0) {
+    return None;
+  }
+
   has_alpha = (format->type == PictTypeDirect && format->direct.alphaMask);
-  width = attr.width;
-  height = attr.height;
+
+  /* always scale down, never up */
+  scale = MIN((double)max_width / (double)attr.width,
+              (double)max_height / (double)attr.height);
+  scale = MIN(scale, 1.0);
+  width = MAX((int)(scale * (double)attr.width), 1);
+  height = MAX((int)(scale * (double)attr.height), 1);
 
   pa.subwindow_mode = IncludeInferiors; /* Don't clip child widgets */
 
   src_picture =
       XRenderCreatePicture(display, window, format, CPSubwindowMode, &pa);
 
+  if (scale < 1.0) {
+    /* The transform maps destination to source coordinates */
+    XTransform transform = {
+        {{XDoubleToFixed(1.0 / scale), XDoubleToFixed(0), XDoubleToFixed(0)},
+         {XDoubleToFixed(0), XDoubleToFixed(1.0 / scale), XDoubleToFixed(0)},
+         {XDoubleToFixed(0), XDoubleToFixed(0), XDoubleToFixed(1.0)}}};
+
+    XRenderSetPictureTransform(display, src_picture, &transform);
+    XRenderSetPictureFilter(display, src_picture, FilterGood, NULL, 0);
+  }
+
+  g_debug("GsmInhibitDialog: scaling window %u from w=%d h=%d to w=%d h=%d",
+          (guint)window, attr.width, attr.height, width, height);
+
   pixmap = XCreatePixmap(display, window, width, height, attr.depth);
 
   dst_picture = XRenderCreatePicture(display, pixmap, format, 0, 0);
   XRenderComposite(display, has_alpha ? PictOpOver : PictOpSrc, src_picture,
                    None, dst_picture, 0, 0, 0, 0, 0, 0, width, height);
 
+  XRenderFreePicture(display, src_picture);
+  XRenderFreePicture(display, dst_picture);
+
+  if (visualp != NULL) {
+    *visualp = attr.visual;
+  }
   if (widthp != NULL) {
     *widthp = width;
   }
@@ -338,52 +380,92 @@ static Pixmap get_pixmap_for_window(Display *display, Window window,
   return pixmap;
 }
 
-#endif /* HAVE_COMPOSITE */
+static gboolean read_thumbnail_idle(ThumbnailRequest *request) {
+  GsmInhibitDialog *dialog;
+  GdkDisplay *gdkdisplay;
+  GdkPixbuf *pixbuf;
+  GtkTreeIter iter;
 
-static GdkPixbuf *get_pixbuf_for_window(GdkDisplay *gdkdisplay, guint xid,
-                                        int thumb_width, int thumb_height) {
-  GdkPixbuf *pixbuf = NULL;
-#ifdef HAVE_XRENDER
-  Display *display;
-  Window xwindow;
-  Pixmap xpixmap;
-  int width;
-  int height;
+  request->idle_id = 0;
+  dialog = request->dialog;
+  gdkdisplay = gtk_widget_get_display(GTK_WIDGET(dialog));
 
-  display = GDK_DISPLAY_XDISPLAY(gdkdisplay);
-  xwindow = (Window)xid;
-  xpixmap = get_pixmap_for_window(display, xwindow, &width, &height);
-  if (xpixmap == None) {
-    g_debug("GsmInhibitDialog: Unable to get window snapshot for %u", xid);
-    return NULL;
+  gdk_x11_display_error_trap_push(gdkdisplay);
+  pixbuf = pixbuf_get_from_pixmap(GDK_DISPLAY_XDISPLAY(gdkdisplay),
+                                  request->xpixmap, request->visual,
+                                  request->width, request->height);
+  gdk_x11_display_error_trap_pop_ignored(gdkdisplay);
+
+  if (pixbuf == NULL) {
+    g_debug("GsmInhibitDialog: unable to read pixbuf from %u",
+            (guint)request->xwindow);
   } else {
-    g_debug("GsmInhibitDialog: Got xpixmap %u", (guint)xpixmap);
+    /* the inhibitor may have gone away in the meantime */
+    if (find_inhibitor(dialog, request->inhibitor_id, &iter)) {
+      gtk_list_store_set(dialog->list_store, &iter, INHIBIT_IMAGE_COLUMN,
+                         pixbuf, -1);
+    }
+    g_object_unref(pixbuf);
   }
 
-  pixbuf = pixbuf_get_from_pixmap(display, xpixmap, width, height);
+  thumbnail_request_done(request);
 
-  if (xpixmap != None) {
-    gdk_x11_display_error_trap_push(gdkdisplay);
-    XFreePixmap(display, xpixmap);
-    gdk_display_sync(gdkdisplay);
-    gdk_x11_display_error_trap_pop_ignored(gdkdisplay);
-  }
+  return FALSE;
+}
 
-  if (pixbuf != NULL) {
-    GdkPixbuf *scaled;
-    g_debug("GsmInhibitDialog: scaling pixbuf to w=%d h=%d", width, height);
-    scaled = scale_pixbuf(pixbuf, thumb_width, thumb_height, TRUE);
-    g_object_unref(pixbuf);
-    pixbuf = scaled;
+static gboolean capture_thumbnail_idle(ThumbnailRequest *request) {
+  GdkDisplay *gdkdisplay;
+  Display *display;
+
+  request->idle_id = 0;
+  gdkdisplay = gtk_widget_get_display(GTK_WIDGET(request->dialog));
+  display = GDK_DISPLAY_XDISPLAY(gdkdisplay);
+
+  gdk_x11_display_error_trap_push(gdkdisplay);
+  request->xpixmap = get_pixmap_for_window(
+      display, request->xwindow, DEFAULT_SNAPSHOT_SIZE, DEFAULT_SNAPSHOT_SIZE,
+      &request->visual, &request->width, &request->height);
+  XFlush(display);
+  gdk_x11_display_error_trap_pop_ignored(gdkdisplay);
+
+  if (request->xpixmap == None) {
+    g_debug("GsmInhibitDialog: Unable to get window snapshot for %u",
+            (guint)request->xwindow);
+    thumbnail_request_done(request);
+    return FALSE;
   }
+
+  g_debug("GsmInhibitDialog: Got xpixmap %u", (guint)request->xpixmap);
+
+  /* let the server render while we get on with other events */
+  request->idle_id = g_idle_add_full(
+      G_PRIORITY_LOW, (GSourceFunc)read_thumbnail_idle, request, NULL);
+
+  return FALSE;
+}
+#endif /* HAVE_XRENDER */
+
+static void queue_thumbnail_for_window(GsmInhibitDialog *dialog,
+                                       GsmInhibitor *inhibitor, guint xid) {
+#ifdef HAVE_XRENDER
+  ThumbnailRequest *request;
+
+  request = g_new0(ThumbnailRequest, 1);
+  request->dialog = dialog;
+  request->inhibitor_id = g_strdup(gsm_inhibitor_peek_id(inhibitor));
+  request->xwindow = (Window)xid;
+  request->xpixmap = None;
+  request->idle_id = g_idle_add_full(
+      G_PRIORITY_LOW, (GSourceFunc)capture_thumbnail_idle, request, NULL);
+
+  dialog->thumbnail_requests =
+      g_slist_prepend(dialog->thumbnail_requests, request);
 #else
   g_debug("GsmInhibitDialog: no support for getting window snapshot");
 #endif
-  return pixbuf;
 }
 
 static void add_inhibitor(GsmInhibitDialog *dialog, GsmInhibitor *inhibitor) {
-  GdkDisplay *gdkdisplay;
   const char *name;
   const char *app_id;
   char *desktop_filename;
@@ -393,8 +475,6 @@ static void add_inhibitor(GsmInhibitDialog *dialog, GsmInhibitor *inhibitor) {
   guint xid;
   char *freeme;
 
-  gdkdisplay = gtk_widget_get_display(GTK_WIDGET(dialog));
-
   /* FIXME: get info from xid */
 
   desktop_file = NULL;
@@ -412,16 +492,6 @@ static void add_inhibitor(GsmInhibitDialog *dialog, GsmInhibitor *inhibitor) {
     desktop_filename = g_strdup(app_id);
   }
 
-  xid = gsm_inhibitor_peek_toplevel_xid(inhibitor);
-  g_debug("GsmInhibitDialog: inhibitor has XID %u", xid);
-  if (xid > 0 && dialog->have_xrender) {
-    pixbuf = get_pixbuf_for_window(gdkdisplay, xid, DEFAULT_SNAPSHOT_SIZE,
-                                   DEFAULT_SNAPSHOT_SIZE);
-    if (pixbuf == NULL) {
-      g_debug("GsmInhibitDialog: unable to read pixbuf from %u", xid);
-    }
-  }
-
   if (desktop_filename != NULL) {
     char **search_dirs = gsm_util_get_desktop_dirs();
     if (g_path_is_absolute(desktop_filename)) {
@@ -477,12 +547,10 @@ static void add_inhibitor(GsmInhibitDialog *dialog, GsmInhibitor *inhibitor) {
       }
     } else {
       name = egg_desktop_file_get_name(desktop_file);
-      if (pixbuf == NULL) {
-        const char *icon_name = egg_desktop_file_get_icon(desktop_file);
-        pixbuf = _load_icon(gtk_icon_theme_get_default(), icon_name,
-                            DEFAULT_ICON_SIZE, DEFAULT_ICON_SIZE,
-                            DEFAULT_ICON_SIZE, NULL);
-      }
+      pixbuf = _load_icon(gtk_icon_theme_get_default(),
+                          egg_desktop_file_get_icon(desktop_file),
+                          DEFAULT_ICON_SIZE, DEFAULT_ICON_SIZE,
+                          DEFAULT_ICON_SIZE, NULL);
     }
   }
 
@@ -520,6 +588,13 @@ static void add_inhibitor(GsmInhibitDialog *dialog, GsmInhibitor *inhibitor) {
       gsm_inhibitor_peek_reason(inhibitor), INHIBIT_ID_COLUMN,
       gsm_inhibitor_peek_id(inhibitor), -1);
 
+  /* the icon stays as a placeholder until the window snapshot arrives */
+  xid = gsm_inhibitor_peek_toplevel_xid(inhibitor);
+  g_debug("GsmInhibitDialog: inhibitor has XID %u", xid);
+  if (xid > 0 && dialog->have_xrender) {
+    queue_thumbnail_for_window(dialog, inhibitor, xid);
+  }
+
   g_free(desktop_filename);
   g_free(freeme);
   if (pixbuf != NULL) {
@@ -834,9 +909,6 @@ static GObject *gsm_inhibit_dialog_constructor(
   gdk_x11_display_error_trap_pop_ignored(gdkdisplay);
 #endif /* HAVE_XRENDER */
 
-  /* FIXME: turn this on when it is ready */
-  dialog->have_xrender = FALSE;
-
   setup_dialog(dialog);
 
   gtk_widget_show_all(GTK_WIDGET(dialog));
@@ -854,6 +926,12 @@ static void gsm_inhibit_dialog_dispose(GObject *object) {
 
   g_debug("GsmInhibitDialog: dispose called");
 
+#ifdef HAVE_XRENDER
+  g_slist_free_full(dialog->thumbnail_requests,
+                    (GDestroyNotify)thumbnail_request_free);
+  dialog->thumbnail_requests = NULL;
+#endif /* HAVE_XRENDER */
+
   if (dialog->list_store != NULL) {
     g_object_unref(dialog->list_store);
     dialog->list_store = NULL;
@@ -0,0 +1,123 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*-
+ * gsm-inhibitor-cookies.c
+ * Copyright (C) 2012-2021 MATE Developers
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include "gsm-inhibitor-cookies.h"
+
+#include <glib.h>
+
+/* The cookies handed out by Inhibit(), and the live inhibitors by cookie,
+ * so that neither making a new cookie nor Uninhibit() has to go through
+ * all the inhibitors. */
+
+struct _GsmInhibitorCookies {
+  GHashTable *inhibitors; /* cookie -> inhibitor */
+  /* Cookies are made by permuting this serial with these keys */
+  guint32 serial;
+  guint32 keys[4];
+};
+
+GsmInhibitorCookies *gsm_inhibitor_cookies_new(void) {
+  GsmInhibitorCookies *cookies;
+  guint i;
+
+  cookies = g_new0(GsmInhibitorCookies, 1);
+  cookies->inhibitors = g_hash_table_new(NULL, NULL);
+  cookies->serial = g_random_int();
+  for (i = 0; i < G_N_ELEMENTS(cookies->keys); i++) {
+    cookies->keys[i] = g_random_int();
+  }
+
+  return cookies;
+}
+
+void gsm_inhibitor_cookies_free(GsmInhibitorCookies *cookies) {
+  if (cookies == NULL) {
+    return;
+  }
+
+  g_hash_table_destroy(cookies->inhibitors);
+  g_free(cookies);
+}
+
+static guint16 cookie_round(guint16 half, guint32 key) {
+  guint32 x;
+
+  x = (half ^ key) * 0x45d9f3bu;
+  x ^= x >> 16;
+
+  return (guint16)x;
+}
+
+/* A Feistel network keyed at startup: a bijection on 32 bits, so that
+ * cookies made from different serials never collide, while they still
+ * cannot be told from random ones without the keys */
+static guint32 permute_serial(GsmInhibitorCookies *cookies) {
+  guint16 left;
+  guint16 right;
+  guint i;
+
+  left = cookies->serial >> 16;
+  right = cookies->serial & 0xffff;
+  cookies->serial++;
+
+  for (i = 0; i < G_N_ELEMENTS(cookies->keys); i++) {
+    guint16 tmp;
+
+    tmp = right;
+    right = left ^ cookie_round(right, cookies->keys[i]);
+    left = tmp;
+  }
+
+  return ((guint32)left << 16) | right;
+}
+
+guint32 gsm_inhibitor_cookies_generate(GsmInhibitorCookies *cookies) {
+  guint32 cookie;
+
+  /* Values outside of 1..G_MAXINT32 - 1 are skipped, about one draw in
+   * two.  The lookup only matters once the serial has wrapped. */
+  do {
+    cookie = permute_serial(cookies);
+  } while (cookie == 0 || cookie >= G_MAXINT32 ||
+           g_hash_table_contains(cookies->inhibitors,
+                                 GUINT_TO_POINTER(cookie)));
+
+  return cookie;
+}
+
+void gsm_inhibitor_cookies_add(GsmInhibitorCookies *cookies, guint32 cookie,
+                               gpointer inhibitor) {
+  g_hash_table_insert(cookies->inhibitors, GUINT_TO_POINTER(cookie),
+                      inhibitor);
+}
+
+void gsm_inhibitor_cookies_remove(GsmInhibitorCookies *cookies,
+                                  guint32 cookie) {
+  g_hash_table_remove(cookies->inhibitors, GUINT_TO_POINTER(cookie));
+}
+
+gpointer gsm_inhibitor_cookies_lookup(GsmInhibitorCookies *cookies,
+                                      guint32 cookie) {
+  return g_hash_table_lookup(cookies->inhibitors, GUINT_TO_POINTER(cookie));
+}
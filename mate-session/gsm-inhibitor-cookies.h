@@ -0,0 +1,44 @@
+/* gsm-inhibitor-cookies.h
+ * Copyright (C) 2012-2021 MATE Developers
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+#ifndef __GSM_INHIBITOR_COOKIES_H__
+#define __GSM_INHIBITOR_COOKIES_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+typedef struct _GsmInhibitorCookies GsmInhibitorCookies;
+
+GsmInhibitorCookies *gsm_inhibitor_cookies_new(void);
+void gsm_inhibitor_cookies_free(GsmInhibitorCookies *cookies);
+
+/* Returns a cookie in 1..G_MAXINT32 - 1 that no live inhibitor has */
+guint32 gsm_inhibitor_cookies_generate(GsmInhibitorCookies *cookies);
+
+void gsm_inhibitor_cookies_add(GsmInhibitorCookies *cookies, guint32 cookie,
+                               gpointer inhibitor);
+void gsm_inhibitor_cookies_remove(GsmInhibitorCookies *cookies,
+                                  guint32 cookie);
+gpointer gsm_inhibitor_cookies_lookup(GsmInhibitorCookies *cookies,
+                                      guint32 cookie);
+
+G_END_DECLS
+
+#endif /* __GSM_INHIBITOR_COOKIES_H__ */
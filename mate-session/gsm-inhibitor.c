@@ -39,10 +39,10 @@ static guint32 inhibitor_serial = 1;
 
 struct _GsmInhibitor {
   GObject parent;
-  char *id;
-  char *bus_name;
-  char *app_id;
-  char *client_id;
+  const char *id;
+  const char *bus_name;
+  const char *app_id;
+  const char *client_id;
   char *reason;
   guint flags;
   guint toplevel_xid;
@@ -128,14 +128,16 @@ static GObject *gsm_inhibitor_constructor(
     GObjectConstructParam *construct_properties) {
   GsmInhibitor *inhibitor;
   gboolean res;
+  char id[64];
 
   inhibitor = GSM_INHIBITOR(
       G_OBJECT_CLASS(gsm_inhibitor_parent_class)
           ->constructor(type, n_construct_properties, construct_properties));
 
-  g_free(inhibitor->id);
-  inhibitor->id = g_strdup_printf("/org/gnome/SessionManager/Inhibitor%u",
-                                  get_next_inhibitor_serial());
+  gsm_util_release_id(inhibitor->id);
+  g_snprintf(id, sizeof(id), "/org/gnome/SessionManager/Inhibitor%u",
+             get_next_inhibitor_serial());
+  inhibitor->id = gsm_util_intern_id(id);
   res = register_inhibitor(inhibitor);
   if (!res) {
     g_warning("Unable to register inhibitor with session bus");
@@ -150,12 +152,12 @@ static void gsm_inhibitor_set_bus_name(GsmInhibitor *inhibitor,
                                        const char *bus_name) {
   g_return_if_fail(GSM_IS_INHIBITOR(inhibitor));
 
-  g_free(inhibitor->bus_name);
+  gsm_util_release_id(inhibitor->bus_name);
 
   if (bus_name != NULL) {
-    inhibitor->bus_name = g_strdup(bus_name);
+    inhibitor->bus_name = gsm_util_intern_id(bus_name);
   } else {
-    inhibitor->bus_name = g_strdup("");
+    inhibitor->bus_name = gsm_util_intern_id("");
   }
   g_object_notify(G_OBJECT(inhibitor), "bus-name");
 }
@@ -164,9 +166,9 @@ static void gsm_inhibitor_set_app_id(GsmInhibitor *inhibitor,
                                      const char *app_id) {
   g_return_if_fail(GSM_IS_INHIBITOR(inhibitor));
 
-  g_free(inhibitor->app_id);
+  gsm_util_release_id(inhibitor->app_id);
 
-  inhibitor->app_id = g_strdup(app_id);
+  inhibitor->app_id = gsm_util_intern_id(app_id);
   g_object_notify(G_OBJECT(inhibitor), "app-id");
 }
 
@@ -174,14 +176,14 @@ static void gsm_inhibitor_set_client_id(GsmInhibitor *inhibitor,
                                         const char *client_id) {
   g_return_if_fail(GSM_IS_INHIBITOR(inhibitor));
 
-  g_free(inhibitor->client_id);
+  gsm_util_release_id(inhibitor->client_id);
 
   g_debug("GsmInhibitor: setting client-id = %s", client_id);
 
   if (client_id != NULL) {
-    inhibitor->client_id = g_strdup(client_id);
+    inhibitor->client_id = gsm_util_intern_id(client_id);
   } else {
-    inhibitor->client_id = g_strdup("");
+    inhibitor->client_id = gsm_util_intern_id("");
   }
   g_object_notify(G_OBJECT(inhibitor), "client-id");
 }
@@ -408,10 +410,10 @@ static void gsm_inhibitor_get_property(GObject *object, guint prop_id,
 static void gsm_inhibitor_finalize(GObject *object) {
   GsmInhibitor *inhibitor = (GsmInhibitor *)object;
 
-  g_free(inhibitor->id);
-  g_free(inhibitor->bus_name);
-  g_free(inhibitor->app_id);
-  g_free(inhibitor->client_id);
+  gsm_util_release_id(inhibitor->id);
+  gsm_util_release_id(inhibitor->bus_name);
+  gsm_util_release_id(inhibitor->app_id);
+  gsm_util_release_id(inhibitor->client_id);
   g_free(inhibitor->reason);
 
   G_OBJECT_CLASS(gsm_inhibitor_parent_class)->finalize(object);
@@ -41,6 +41,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/resource.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <unistd.h>
@@ -49,17 +50,27 @@
 #include "gsm-consolekit.h"
 #include "gsm-dbus-client.h"
 #include "gsm-inhibit-dialog.h"
+#include "gsm-inhibitor-cookies.h"
 #include "gsm-inhibitor.h"
 #include "gsm-logout-dialog.h"
 #include "gsm-manager-glue.h"
+/* only for the names of the methods the other objects export */
+#include "gsm-app-glue.h"
+#include "gsm-client-glue.h"
+#include "gsm-inhibitor-glue.h"
+#include "gsm-presence-glue.h"
+#include "gsm-metrics.h"
 #include "gsm-presence.h"
+#include "gsm-registration-stats.h"
 #include "gsm-store.h"
 #include "gsm-util.h"
 #include "gsm-xsmp-client.h"
+#include "mdm-log.h"
 #include "mdm.h"
 #ifdef HAVE_SYSTEMD
 #include "gsm-systemd.h"
 #endif
+#include "gsm-session-plan.h"
 #include "gsm-session-save.h"
 
 #define GSM_MANAGER_GET_PRIVATE(o) \
@@ -91,6 +102,21 @@
 #define KEY_IDLE_DELAY "idle-delay"
 #define KEY_AUTOSAVE "auto-save-session"
 
+#define METRIC_CLIENTS "mate_session_clients"
+#define METRIC_INHIBITORS "mate_session_inhibitors"
+#define METRIC_APPS "mate_session_apps"
+#define METRIC_PHASE_DURATION "mate_session_phase_duration_seconds"
+#define METRIC_AUTOSTART_FAILURES "mate_session_autostart_failures_total"
+#define METRIC_APP_RESTARTS "mate_session_app_restarts_total"
+#define METRIC_DBUS_CALLS "mate_session_dbus_calls_total"
+#define METRIC_TIME_TO_RUNNING "mate_session_time_to_running_seconds"
+#define METRIC_CPU "mate_session_cpu_seconds_total"
+#define METRIC_PEAK_RSS "mate_session_peak_resident_bytes"
+
+/* Changes kept for GetChanges() in each of the client and inhibitor
+ * stores */
+#define CHANGE_LOG_SIZE 256
+
 #ifdef __GNUC__
 #define UNUSED_VARIABLE __attribute__((unused))
 #else
@@ -113,24 +139,48 @@ typedef struct {
   GsmStore *clients;
   GsmStore *inhibitors;
   GsmStore *apps;
+  /* Apps are never removed from the store before dispose, so these
+   * indexes do not hold references */
+  GHashTable *apps_by_app_id;   /* app id -> GsmApp */
+  GHashTable *apps_by_provides; /* GQuark -> first GsmApp providing it */
   GsmPresence *presence;
 
   /* Current status */
   GsmManagerPhase phase;
+  gint64 start_time;
+  gint64 phase_start_time;
   guint phase_timeout_id;
   GSList *pending_apps;
+  GsmRegistrationStats *registration_stats;
   GsmManagerLogoutMode logout_mode;
-  GSList *query_clients;
+  /* Clients we're waiting an end session response from, used as a set */
+  GHashTable *query_clients;
   guint query_timeout_id;
   /* This is used for GSM_MANAGER_PHASE_END_SESSION only at the moment,
-   * since it uses a sublist of all running client that replied in a
+   * since it uses a subset of all running client that replied in a
    * specific way */
-  GSList *next_query_clients;
+  GHashTable *next_query_clients;
   /* This is the action that will be done just before we exit */
   GsmManagerLogoutType logout_type;
 
   GtkWidget *inhibit_dialog;
 
+  /* Announces the client and inhibitor changes of a main loop
+   * iteration at once */
+  guint objects_changed_id;
+
+  /* The inhibitors in the store, by inhibitor id, referenced so that
+   * their flags and cookie are still known when they are removed */
+  GHashTable *inhibitors_by_id;
+  GsmInhibitorCookies *inhibitor_cookies;
+  /* Number of inhibitors having each flag bit set, and the mask of the
+   * bits with a non-zero count */
+  guint inhibitor_counts[32];
+  guint inhibited_actions;
+  /* Inhibited actions last announced to the bus and to the presence */
+  guint announced_actions;
+  guint announce_actions_id;
+
   /* List of clients which were disconnected due to disabled condition
    * and shouldn't be automatically restarted */
   GSList *condition_clients;
@@ -145,7 +195,14 @@ typedef struct {
   gboolean dbus_disconnected : 1;
 } GsmManagerPrivate;
 
-enum { PROP_0, PROP_CLIENT_STORE, PROP_RENDERER, PROP_FAILSAFE };
+enum {
+  PROP_0,
+  PROP_CLIENT_STORE,
+  PROP_RENDERER,
+  PROP_FAILSAFE,
+  PROP_INHIBITED_ACTIONS,
+  PROP_METRICS
+};
 
 enum {
   PHASE_CHANGED,
@@ -155,6 +212,7 @@ enum {
   INHIBITOR_REMOVED,
   SESSION_RUNNING,
   SESSION_OVER,
+  OBJECTS_CHANGED,
   LAST_SIGNAL
 };
 
@@ -240,15 +298,6 @@ static void debug_inhibitors(GsmManager *manager) {
   gsm_store_foreach(priv->inhibitors, (GsmStoreFunc)_debug_inhibitor, manager);
 }
 
-static gboolean _find_by_cookie(const char *id, GsmInhibitor *inhibitor,
-                                guint *cookie_ap) {
-  guint cookie_b;
-
-  cookie_b = gsm_inhibitor_peek_cookie(inhibitor);
-
-  return (*cookie_ap == cookie_b);
-}
-
 static gboolean _find_by_startup_id(const char *id, GsmClient *client,
                                     const char *startup_id_a) {
   const char *startup_id_b;
@@ -485,14 +534,22 @@ static void end_phase(GsmManager *manager) {
 
   g_debug("GsmManager: ending phase %s\n", phase_num_to_name(priv->phase));
 
+  if (priv->phase_start_time != 0) {
+    char *labels;
+
+    labels = g_strdup_printf("phase=\"%s\"", phase_num_to_name(priv->phase));
+    gsm_metrics_observe(
+        METRIC_PHASE_DURATION, labels,
+        (double)(g_get_monotonic_time() - priv->phase_start_time) /
+            G_USEC_PER_SEC);
+    g_free(labels);
+  }
+
   g_slist_free(priv->pending_apps);
   priv->pending_apps = NULL;
 
-  g_slist_free(priv->query_clients);
-  priv->query_clients = NULL;
-
-  g_slist_free(priv->next_query_clients);
-  priv->next_query_clients = NULL;
+  g_hash_table_remove_all(priv->query_clients);
+  g_hash_table_remove_all(priv->next_query_clients);
 
   if (priv->phase_timeout_id > 0) {
     g_source_remove(priv->phase_timeout_id);
@@ -533,12 +590,39 @@ static void end_phase(GsmManager *manager) {
   }
 }
 
+static void app_exited_stats(GsmApp *app, GsmManager *manager);
+
+static void app_registered_stats(GsmApp *app, GsmManager *manager) {
+  GsmManagerPrivate *priv;
+
+  priv = gsm_manager_get_instance_private(manager);
+  g_signal_handlers_disconnect_by_func(app, app_registered_stats, manager);
+  g_signal_handlers_disconnect_by_func(app, app_exited_stats, manager);
+
+  gsm_registration_stats_app_registered(priv->registration_stats,
+                                        gsm_app_peek_app_id(app));
+}
+
+static void app_exited_stats(GsmApp *app, GsmManager *manager) {
+  GsmManagerPrivate *priv;
+
+  priv = gsm_manager_get_instance_private(manager);
+  g_signal_handlers_disconnect_by_func(app, app_registered_stats, manager);
+  g_signal_handlers_disconnect_by_func(app, app_exited_stats, manager);
+
+  gsm_registration_stats_app_exited(priv->registration_stats,
+                                    gsm_app_peek_app_id(app));
+}
+
+static void app_died(GsmApp *app, GsmManager *manager);
+
 static void app_registered(GsmApp *app, GsmManager *manager) {
   GsmManagerPrivate *priv;
 
   priv = gsm_manager_get_instance_private(manager);
   priv->pending_apps = g_slist_remove(priv->pending_apps, app);
   g_signal_handlers_disconnect_by_func(app, app_registered, manager);
+  g_signal_handlers_disconnect_by_func(app, app_died, manager);
 
   if (priv->pending_apps == NULL) {
     if (priv->phase_timeout_id > 0) {
@@ -550,6 +634,15 @@ static void app_registered(GsmApp *app, GsmManager *manager) {
   }
 }
 
+/* The app went away before registering, or could not be started at all:
+ * there is nothing left to wait for. */
+static void app_died(GsmApp *app, GsmManager *manager) {
+  g_warning("Application '%s' died before registering",
+            gsm_app_peek_app_id(app));
+  gsm_metrics_inc(METRIC_AUTOSTART_FAILURES, "reason=\"died\"");
+  app_registered(app, manager);
+}
+
 static gboolean on_phase_timeout(GsmManager *manager) {
   GSList *a;
   GsmManagerPrivate *priv;
@@ -567,7 +660,11 @@ static gboolean on_phase_timeout(GsmManager *manager) {
       for (a = priv->pending_apps; a; a = a->next) {
         g_warning("Application '%s' failed to register before timeout",
                   gsm_app_peek_app_id(a->data));
+        gsm_registration_stats_app_timed_out(priv->registration_stats,
+                                             gsm_app_peek_app_id(a->data));
+        gsm_metrics_inc(METRIC_AUTOSTART_FAILURES, "reason=\"timeout\"");
         g_signal_handlers_disconnect_by_func(a->data, app_registered, manager);
+        g_signal_handlers_disconnect_by_func(a->data, app_died, manager);
         /* FIXME: what if the app was filling in a required slot? */
       }
       break;
@@ -596,6 +693,7 @@ static gboolean _autostart_delay_timeout(GsmApp *app) {
       !gsm_app_peek_is_conditionally_disabled(app)) {
     res = gsm_app_start(app, &error);
     if (!res) {
+      gsm_metrics_inc(METRIC_AUTOSTART_FAILURES, "reason=\"launch\"");
       if (error != NULL) {
         g_warning("Could not launch application '%s': %s",
                   gsm_app_peek_app_id(app), error->message);
@@ -643,6 +741,7 @@ static gboolean _start_app(const char *id, GsmApp *app, GsmManager *manager) {
   error = NULL;
   res = gsm_app_start(app, &error);
   if (!res) {
+    gsm_metrics_inc(METRIC_AUTOSTART_FAILURES, "reason=\"launch\"");
     if (error != NULL) {
       g_warning("Could not launch application '%s': %s",
                 gsm_app_peek_app_id(app), error->message);
@@ -653,7 +752,28 @@ static gboolean _start_app(const char *id, GsmApp *app, GsmManager *manager) {
   }
 
   if (priv->phase < GSM_MANAGER_PHASE_APPLICATION) {
+    /* Keep recording how long the app takes to register even if we
+     * stop waiting for it, so that the history stays accurate */
+    gsm_registration_stats_app_started(priv->registration_stats,
+                                       gsm_app_peek_app_id(app));
+    g_signal_handlers_disconnect_by_func(app, app_registered_stats, manager);
+    g_signal_handlers_disconnect_by_func(app, app_exited_stats, manager);
+    g_signal_connect(app, "exited", G_CALLBACK(app_exited_stats), manager);
+    g_signal_connect(app, "died", G_CALLBACK(app_exited_stats), manager);
+    g_signal_connect(app, "registered", G_CALLBACK(app_registered_stats),
+                     manager);
+
+    if (gsm_registration_stats_never_registers(priv->registration_stats,
+                                               gsm_app_peek_app_id(app))) {
+      g_debug(
+          "GsmManager: %s never registered in previous sessions, not "
+          "waiting for it",
+          id);
+      goto out;
+    }
+
     g_signal_connect(app, "exited", G_CALLBACK(app_registered), manager);
+    g_signal_connect(app, "died", G_CALLBACK(app_died), manager);
     g_signal_connect(app, "registered", G_CALLBACK(app_registered), manager);
     priv->pending_apps = g_slist_prepend(priv->pending_apps, app);
   }
@@ -661,6 +781,27 @@ out:
   return FALSE;
 }
 
+static guint get_phase_timeout(GsmManager *manager) {
+  GsmManagerPrivate *priv;
+  GSList *a;
+  guint timeout;
+
+  priv = gsm_manager_get_instance_private(manager);
+
+  /* wait as long as the slowest pending app is expected to need */
+  timeout = 0;
+  for (a = priv->pending_apps; a != NULL; a = a->next) {
+    guint app_timeout;
+
+    app_timeout = gsm_registration_stats_get_timeout(
+        priv->registration_stats, gsm_app_peek_app_id(a->data),
+        GSM_MANAGER_PHASE_TIMEOUT * 1000);
+    timeout = MAX(timeout, app_timeout);
+  }
+
+  return timeout;
+}
+
 static void do_phase_startup(GsmManager *manager) {
   GsmManagerPrivate *priv;
 
@@ -669,8 +810,13 @@ static void do_phase_startup(GsmManager *manager) {
 
   if (priv->pending_apps != NULL) {
     if (priv->phase < GSM_MANAGER_PHASE_APPLICATION) {
-      priv->phase_timeout_id = g_timeout_add_seconds(
-          GSM_MANAGER_PHASE_TIMEOUT, (GSourceFunc)on_phase_timeout, manager);
+      guint timeout;
+
+      timeout = get_phase_timeout(manager);
+      g_debug("GsmManager: waiting up to %u ms for phase %s", timeout,
+              phase_num_to_name(priv->phase));
+      priv->phase_timeout_id =
+          g_timeout_add(timeout, (GSourceFunc)on_phase_timeout, manager);
     }
   } else {
     end_phase(manager);
@@ -699,7 +845,7 @@ static gboolean _client_end_session(GsmClient *client,
   } else {
     g_debug("GsmManager: adding client to end-session clients: %s",
             gsm_client_peek_id(client));
-    priv->query_clients = g_slist_prepend(priv->query_clients, client);
+    g_hash_table_add(priv->query_clients, client);
   }
 
   return FALSE;
@@ -760,12 +906,16 @@ static void do_phase_end_session_part_2(GsmManager *manager) {
   /* keep the timeout that was started at the beginning of the
    * GSM_MANAGER_PHASE_END_SESSION phase */
 
-  if (g_slist_length(priv->next_query_clients) > 0) {
-    g_slist_foreach(priv->next_query_clients, (GFunc)_client_end_session,
-                    &data);
+  if (g_hash_table_size(priv->next_query_clients) > 0) {
+    GHashTableIter iter;
+    gpointer client;
 
-    g_slist_free(priv->next_query_clients);
-    priv->next_query_clients = NULL;
+    g_hash_table_iter_init(&iter, priv->next_query_clients);
+    while (g_hash_table_iter_next(&iter, &client, NULL)) {
+      _client_end_session(client, &data);
+    }
+
+    g_hash_table_remove_all(priv->next_query_clients);
   } else {
     end_phase(manager);
   }
@@ -856,60 +1006,26 @@ static gboolean _client_query_end_session(const char *id, GsmClient *client,
   } else {
     g_debug("GsmManager: adding client to query clients: %s",
             gsm_client_peek_id(client));
-    priv->query_clients = g_slist_prepend(priv->query_clients, client);
+    g_hash_table_add(priv->query_clients, client);
   }
 
   return FALSE;
 }
 
-static gboolean inhibitor_has_flag(gpointer key, GsmInhibitor *inhibitor,
-                                   gpointer data) {
-  guint flag;
-  guint flags;
-
-  flag = GPOINTER_TO_UINT(data);
-
-  flags = gsm_inhibitor_peek_flags(inhibitor);
-
-  return (flags & flag);
-}
-
 static gboolean gsm_manager_is_logout_inhibited(GsmManager *manager) {
-  GsmInhibitor *inhibitor;
   GsmManagerPrivate *priv;
 
   priv = gsm_manager_get_instance_private(manager);
 
-  if (priv->inhibitors == NULL) {
-    return FALSE;
-  }
-
-  inhibitor = (GsmInhibitor *)gsm_store_find(
-      priv->inhibitors, (GsmStoreFunc)inhibitor_has_flag,
-      GUINT_TO_POINTER(GSM_INHIBITOR_FLAG_LOGOUT));
-  if (inhibitor == NULL) {
-    return FALSE;
-  }
-  return TRUE;
+  return (priv->inhibited_actions & GSM_INHIBITOR_FLAG_LOGOUT) != 0;
 }
 
 static gboolean gsm_manager_is_idle_inhibited(GsmManager *manager) {
-  GsmInhibitor *inhibitor;
   GsmManagerPrivate *priv;
 
   priv = gsm_manager_get_instance_private(manager);
 
-  if (priv->inhibitors == NULL) {
-    return FALSE;
-  }
-
-  inhibitor = (GsmInhibitor *)gsm_store_find(
-      priv->inhibitors, (GsmStoreFunc)inhibitor_has_flag,
-      GUINT_TO_POINTER(GSM_INHIBITOR_FLAG_IDLE));
-  if (inhibitor == NULL) {
-    return FALSE;
-  }
-  return TRUE;
+  return (priv->inhibited_actions & GSM_INHIBITOR_FLAG_IDLE) != 0;
 }
 
 static gboolean _client_cancel_end_session(const char *id, GsmClient *client,
@@ -1257,30 +1373,17 @@ static void query_end_session_complete(GsmManager *manager) {
   gtk_widget_show(priv->inhibit_dialog);
 }
 
-static guint32 generate_cookie(void) {
-  guint32 cookie;
-
-  cookie = (guint32)g_random_int_range(1, G_MAXINT32);
-
-  return cookie;
-}
-
 static guint32 _generate_unique_cookie(GsmManager *manager) {
-  guint32 cookie;
   GsmManagerPrivate *priv;
 
   priv = gsm_manager_get_instance_private(manager);
 
-  do {
-    cookie = generate_cookie();
-  } while (gsm_store_find(priv->inhibitors, (GsmStoreFunc)_find_by_cookie,
-                          &cookie) != NULL);
-
-  return cookie;
+  return gsm_inhibitor_cookies_generate(priv->inhibitor_cookies);
 }
 
 static gboolean _on_query_end_session_timeout(GsmManager *manager) {
-  GSList *l;
+  GHashTableIter iter;
+  gpointer client;
   GsmManagerPrivate *priv;
 
   priv = gsm_manager_get_instance_private(manager);
@@ -1289,14 +1392,15 @@ static gboolean _on_query_end_session_timeout(GsmManager *manager) {
 
   g_debug("GsmManager: query end session timed out");
 
-  for (l = priv->query_clients; l != NULL; l = l->next) {
+  g_hash_table_iter_init(&iter, priv->query_clients);
+  while (g_hash_table_iter_next(&iter, &client, NULL)) {
     guint cookie;
     GsmInhibitor *inhibitor;
     const char *bus_name;
     char *app_id;
 
     g_warning("Client '%s' failed to reply before timeout",
-              gsm_client_peek_id(l->data));
+              gsm_client_peek_id(client));
 
     /* Don't add "not responding" inhibitors if logout is forced
      */
@@ -1305,22 +1409,22 @@ static gboolean _on_query_end_session_timeout(GsmManager *manager) {
     }
 
     /* Add JIT inhibit for unresponsive client */
-    if (GSM_IS_DBUS_CLIENT(l->data)) {
-      bus_name = gsm_dbus_client_get_bus_name(l->data);
+    if (GSM_IS_DBUS_CLIENT(client)) {
+      bus_name = gsm_dbus_client_get_bus_name(client);
     } else {
       bus_name = NULL;
     }
 
-    app_id = g_strdup(gsm_client_peek_app_id(l->data));
+    app_id = g_strdup(gsm_client_peek_app_id(client));
     if (IS_STRING_EMPTY(app_id)) {
       /* XSMP clients don't give us an app id unless we start them */
       g_free(app_id);
-      app_id = gsm_client_get_app_name(l->data);
+      app_id = gsm_client_get_app_name(client);
     }
 
     cookie = _generate_unique_cookie(manager);
     inhibitor = gsm_inhibitor_new_for_client(
-        gsm_client_peek_id(l->data), app_id, GSM_INHIBITOR_FLAG_LOGOUT,
+        gsm_client_peek_id(client), app_id, GSM_INHIBITOR_FLAG_LOGOUT,
         _("Not responding"), bus_name, cookie);
     g_free(app_id);
     gsm_store_add(priv->inhibitors, gsm_inhibitor_peek_id(inhibitor),
@@ -1328,8 +1432,7 @@ static gboolean _on_query_end_session_timeout(GsmManager *manager) {
     g_object_unref(inhibitor);
   }
 
-  g_slist_free(priv->query_clients);
-  priv->query_clients = NULL;
+  g_hash_table_remove_all(priv->query_clients);
 
   query_end_session_complete(manager);
 
@@ -1384,13 +1487,14 @@ static void start_phase(GsmManager *manager) {
 
   g_debug("GsmManager: starting phase %s\n", phase_num_to_name(priv->phase));
 
+  priv->phase_start_time = g_get_monotonic_time();
+  mdm_log_set_context(MDM_LOG_CONTEXT_PHASE, phase_num_to_name(priv->phase));
+
   /* reset state */
   g_slist_free(priv->pending_apps);
   priv->pending_apps = NULL;
-  g_slist_free(priv->query_clients);
-  priv->query_clients = NULL;
-  g_slist_free(priv->next_query_clients);
-  priv->next_query_clients = NULL;
+  g_hash_table_remove_all(priv->query_clients);
+  g_hash_table_remove_all(priv->next_query_clients);
 
   if (priv->query_timeout_id > 0) {
     g_source_remove(priv->query_timeout_id);
@@ -1411,6 +1515,10 @@ static void start_phase(GsmManager *manager) {
       do_phase_startup(manager);
       break;
     case GSM_MANAGER_PHASE_RUNNING:
+      gsm_metrics_set(
+          METRIC_TIME_TO_RUNNING, NULL,
+          (double)(priv->phase_start_time - priv->start_time) / G_USEC_PER_SEC);
+      gsm_registration_stats_save(priv->registration_stats);
       g_signal_emit(manager, signals[SESSION_RUNNING], 0);
       update_idle(manager);
       break;
@@ -1483,21 +1591,12 @@ void _gsm_manager_set_renderer(GsmManager *manager, const char *renderer) {
   priv->renderer = g_strdup(renderer);
 }
 
-static gboolean _app_has_app_id(const char *id, GsmApp *app,
-                                const char *app_id_a) {
-  const char *app_id_b;
-
-  app_id_b = gsm_app_peek_app_id(app);
-  return (app_id_b != NULL && strcmp(app_id_a, app_id_b) == 0);
-}
-
 static GsmApp *find_app_for_app_id(GsmManager *manager, const char *app_id) {
   GsmApp *app;
   GsmManagerPrivate *priv;
 
   priv = gsm_manager_get_instance_private(manager);
-  app = (GsmApp *)gsm_store_find(priv->apps, (GsmStoreFunc)_app_has_app_id,
-                                 (char *)app_id);
+  app = g_hash_table_lookup(priv->apps_by_app_id, app_id);
   return app;
 }
 
@@ -1580,11 +1679,13 @@ static void _disconnect_client(GsmManager *manager, GsmClient *client) {
   GsmClientRestartStyle client_restart_hint;
   GsmManagerPrivate *priv;
 
-  g_debug("GsmManager: disconnect client: %s", gsm_client_peek_id(client));
-
   /* take a ref so it doesn't get finalized */
   g_object_ref(client);
 
+  mdm_log_set_context(MDM_LOG_CONTEXT_CLIENT_ID, gsm_client_peek_id(client));
+  mdm_log_set_context(MDM_LOG_CONTEXT_APP_ID, gsm_client_peek_app_id(client));
+  g_debug("GsmManager: disconnect client: %s", gsm_client_peek_id(client));
+
   gsm_client_set_status(client, GSM_CLIENT_FINISHED);
 
   is_condition_client = FALSE;
@@ -1663,6 +1764,7 @@ static void _disconnect_client(GsmManager *manager, GsmClient *client) {
   }
 
   g_debug("GsmManager: restarting app");
+  gsm_metrics_inc(METRIC_APP_RESTARTS, NULL);
 
   error = NULL;
   res = gsm_app_restart(app, &error);
@@ -1672,6 +1774,8 @@ static void _disconnect_client(GsmManager *manager, GsmClient *client) {
   }
 
 out:
+  mdm_log_set_context(MDM_LOG_CONTEXT_CLIENT_ID, NULL);
+  mdm_log_set_context(MDM_LOG_CONTEXT_APP_ID, NULL);
   g_object_unref(client);
 }
 
@@ -1792,6 +1896,70 @@ static void bus_name_owner_changed(DBusGProxy *bus_proxy,
   }
 }
 
+/* Calls are only counted by name for the methods we export, so that
+ * peers cannot add series to the metrics by making names up. Holds the
+ * labels of each of them. */
+static GHashTable *counted_dbus_methods = NULL;
+
+static void add_counted_dbus_method(const char *interface,
+                                    const char *method) {
+  g_hash_table_add(counted_dbus_methods,
+                   g_strdup_printf("interface=\"%s\",method=\"%s\"",
+                                   interface, method));
+}
+
+static void add_counted_dbus_methods(const DBusGObjectInfo *info) {
+  int i;
+
+  for (i = 0; i < info->n_method_infos; i++) {
+    const char *interface;
+
+    /* the data of each method starts with its interface and name */
+    interface = info->data + info->method_infos[i].data_offset;
+    add_counted_dbus_method(interface, interface + strlen(interface) + 1);
+  }
+}
+
+static void init_counted_dbus_methods(void) {
+  counted_dbus_methods =
+      g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+
+  add_counted_dbus_methods(&dbus_glib_gsm_manager_object_info);
+  add_counted_dbus_methods(&dbus_glib_gsm_app_object_info);
+  add_counted_dbus_methods(&dbus_glib_gsm_client_object_info);
+  add_counted_dbus_methods(&dbus_glib_gsm_inhibitor_object_info);
+  add_counted_dbus_methods(&dbus_glib_gsm_presence_object_info);
+
+  /* handled by GsmDBusClient's own filter, not through dbus-glib */
+  add_counted_dbus_method("org.gnome.SessionManager.ClientPrivate",
+                          "EndSessionResponse");
+}
+
+static void count_dbus_call(DBusMessage *message) {
+  const char *interface;
+  const char *member;
+  char *labels;
+
+  interface = dbus_message_get_interface(message);
+  member = dbus_message_get_member(message);
+
+  if (interface == NULL || member == NULL) {
+    gsm_metrics_inc(METRIC_DBUS_CALLS,
+                    "interface=\"other\",method=\"other\"");
+    return;
+  }
+
+  labels =
+      g_strdup_printf("interface=\"%s\",method=\"%s\"", interface, member);
+  if (g_hash_table_contains(counted_dbus_methods, labels)) {
+    gsm_metrics_inc(METRIC_DBUS_CALLS, labels);
+  } else {
+    gsm_metrics_inc(METRIC_DBUS_CALLS,
+                    "interface=\"other\",method=\"other\"");
+  }
+  g_free(labels);
+}
+
 static DBusHandlerResult gsm_manager_bus_filter(DBusConnection *connection,
                                                 DBusMessage *message,
                                                 void *user_data) {
@@ -1801,6 +1969,11 @@ static DBusHandlerResult gsm_manager_bus_filter(DBusConnection *connection,
   manager = GSM_MANAGER(user_data);
   priv = gsm_manager_get_instance_private(manager);
 
+  if (dbus_message_get_type(message) == DBUS_MESSAGE_TYPE_METHOD_CALL &&
+      g_str_has_prefix(dbus_message_get_path(message), GSM_MANAGER_DBUS_PATH)) {
+    count_dbus_call(message);
+  }
+
   if (dbus_message_is_signal(message, DBUS_INTERFACE_LOCAL, "Disconnected") &&
       strcmp(dbus_message_get_path(message), DBUS_PATH_LOCAL) == 0) {
     g_debug("GsmManager: dbus disconnected; disconnecting dbus clients...");
@@ -2028,7 +2201,7 @@ static void _handle_client_end_session_response(
     return;
   }
 
-  priv->query_clients = g_slist_remove(priv->query_clients, client);
+  g_hash_table_remove(priv->query_clients, client);
 
   if (!is_ok && priv->logout_mode != GSM_MANAGER_LOGOUT_MODE_FORCE) {
     guint cookie;
@@ -2067,7 +2240,7 @@ static void _handle_client_end_session_response(
   }
 
   if (priv->phase == GSM_MANAGER_PHASE_QUERY_END_SESSION) {
-    if (priv->query_clients == NULL) {
+    if (g_hash_table_size(priv->query_clients) == 0) {
       query_end_session_complete(manager);
     }
   } else if (priv->phase == GSM_MANAGER_PHASE_END_SESSION) {
@@ -2077,18 +2250,17 @@ static void _handle_client_end_session_response(
        * can only happen because of a buggy client that loops
        * wanting to be last again and again. The phase
        * timeout will take care of this issue. */
-      priv->next_query_clients =
-          g_slist_prepend(priv->next_query_clients, client);
+      g_hash_table_add(priv->next_query_clients, client);
     }
 
     /* we can continue to the next step if all clients have replied
      * and if there's no inhibitor */
-    if (priv->query_clients != NULL ||
+    if (g_hash_table_size(priv->query_clients) > 0 ||
         gsm_manager_is_logout_inhibited(manager)) {
       return;
     }
 
-    if (priv->next_query_clients != NULL) {
+    if (g_hash_table_size(priv->next_query_clients) > 0) {
       do_phase_end_session_part_2(manager);
     } else {
       end_phase(manager);
@@ -2124,6 +2296,37 @@ static void on_xsmp_client_logout_request(GsmXSMPClient *client,
   }
 }
 
+static guint64 get_sequence(GsmManager *manager) {
+  GsmManagerPrivate *priv;
+
+  priv = gsm_manager_get_instance_private(manager);
+
+  return MAX(gsm_store_get_sequence(priv->clients),
+             gsm_store_get_sequence(priv->inhibitors));
+}
+
+static gboolean emit_objects_changed_idle(GsmManager *manager) {
+  GsmManagerPrivate *priv;
+
+  priv = gsm_manager_get_instance_private(manager);
+  priv->objects_changed_id = 0;
+
+  g_signal_emit(manager, signals[OBJECTS_CHANGED], 0, get_sequence(manager));
+
+  return G_SOURCE_REMOVE;
+}
+
+static void queue_objects_changed(GsmManager *manager) {
+  GsmManagerPrivate *priv;
+
+  priv = gsm_manager_get_instance_private(manager);
+
+  if (priv->objects_changed_id == 0) {
+    priv->objects_changed_id =
+        g_idle_add((GSourceFunc)emit_objects_changed_idle, manager);
+  }
+}
+
 static void on_store_client_added(GsmStore *store, const char *id,
                                   GsmManager *manager) {
   GsmClient *client;
@@ -2144,6 +2347,7 @@ static void on_store_client_added(GsmStore *store, const char *id,
                    G_CALLBACK(on_client_end_session_response), manager);
 
   g_signal_emit(manager, signals[CLIENT_ADDED], 0, id);
+  queue_objects_changed(manager);
   /* FIXME: disconnect signal handler */
 }
 
@@ -2152,6 +2356,7 @@ static void on_store_client_removed(GsmStore *store, const char *id,
   g_debug("GsmManager: Client removed: %s", id);
 
   g_signal_emit(manager, signals[CLIENT_REMOVED], 0, id);
+  queue_objects_changed(manager);
 }
 
 static void gsm_manager_set_client_store(GsmManager *manager, GsmStore *store) {
@@ -2178,6 +2383,7 @@ static void gsm_manager_set_client_store(GsmManager *manager, GsmStore *store) {
   priv->clients = store;
 
   if (priv->clients != NULL) {
+    gsm_store_set_change_log_size(priv->clients, CHANGE_LOG_SIZE);
     g_signal_connect(priv->clients, "added", G_CALLBACK(on_store_client_added),
                      manager);
     g_signal_connect(priv->clients, "removed",
@@ -2222,17 +2428,18 @@ static void gsm_manager_get_property(GObject *object, guint prop_id,
     case PROP_RENDERER:
       g_value_set_string(value, priv->renderer);
       break;
+    case PROP_INHIBITED_ACTIONS:
+      g_value_set_uint(value, priv->inhibited_actions);
+      break;
+    case PROP_METRICS:
+      g_value_take_boxed(value, gsm_metrics_to_hash_table());
+      break;
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID(object, prop_id, pspec);
       break;
   }
 }
 
-static gboolean _find_app_provides(const char *id, GsmApp *app,
-                                   const char *service) {
-  return gsm_app_provides(app, service);
-}
-
 static GObject *gsm_manager_constructor(
     GType type, guint n_construct_properties,
     GObjectConstructParam *construct_properties) {
@@ -2244,18 +2451,268 @@ static GObject *gsm_manager_constructor(
   return G_OBJECT(manager);
 }
 
+/* dbus-glib exports our properties but never emits PropertiesChanged for
+ * them, so build the signal by hand */
+static void emit_inhibited_actions_changed(GsmManager *manager) {
+  GsmManagerPrivate *priv;
+  DBusMessage *message;
+  DBusMessageIter iter;
+  DBusMessageIter changed;
+  DBusMessageIter entry;
+  DBusMessageIter variant;
+  DBusMessageIter invalidated;
+  const char *interface = GSM_MANAGER_DBUS_NAME;
+  const char *property = "InhibitedActions";
+  dbus_uint32_t value;
+
+  priv = gsm_manager_get_instance_private(manager);
+
+  if (priv->connection == NULL || priv->dbus_disconnected) {
+    return;
+  }
+
+  value = priv->inhibited_actions;
+
+  message = dbus_message_new_signal(
+      GSM_MANAGER_DBUS_PATH, DBUS_INTERFACE_PROPERTIES, "PropertiesChanged");
+  if (message == NULL) {
+    return;
+  }
+
+  dbus_message_iter_init_append(message, &iter);
+  dbus_message_iter_append_basic(&iter, DBUS_TYPE_STRING, &interface);
+
+  dbus_message_iter_open_container(&iter, DBUS_TYPE_ARRAY, "{sv}", &changed);
+  dbus_message_iter_open_container(&changed, DBUS_TYPE_DICT_ENTRY, NULL,
+                                   &entry);
+  dbus_message_iter_append_basic(&entry, DBUS_TYPE_STRING, &property);
+  dbus_message_iter_open_container(&entry, DBUS_TYPE_VARIANT,
+                                   DBUS_TYPE_UINT32_AS_STRING, &variant);
+  dbus_message_iter_append_basic(&variant, DBUS_TYPE_UINT32, &value);
+  dbus_message_iter_close_container(&entry, &variant);
+  dbus_message_iter_close_container(&changed, &entry);
+  dbus_message_iter_close_container(&iter, &changed);
+
+  dbus_message_iter_open_container(&iter, DBUS_TYPE_ARRAY,
+                                   DBUS_TYPE_STRING_AS_STRING, &invalidated);
+  dbus_message_iter_close_container(&iter, &invalidated);
+
+  dbus_connection_send(dbus_g_connection_get_connection(priv->connection),
+                       message, NULL);
+  dbus_message_unref(message);
+}
+
+static void announce_inhibited_actions(GsmManager *manager) {
+  GsmManagerPrivate *priv;
+
+  priv = gsm_manager_get_instance_private(manager);
+
+  if (priv->inhibited_actions == priv->announced_actions) {
+    return;
+  }
+
+  g_debug("GsmManager: inhibited actions changed to 0x%x",
+          priv->inhibited_actions);
+
+  priv->announced_actions = priv->inhibited_actions;
+  g_object_notify(G_OBJECT(manager), "inhibited-actions");
+  emit_inhibited_actions_changed(manager);
+  update_idle(manager);
+}
+
+static gboolean announce_inhibited_actions_idle(GsmManager *manager) {
+  GsmManagerPrivate *priv;
+
+  priv = gsm_manager_get_instance_private(manager);
+  priv->announce_actions_id = 0;
+
+  announce_inhibited_actions(manager);
+
+  return G_SOURCE_REMOVE;
+}
+
+static void update_inhibitor_counts(GsmManager *manager, guint flags,
+                                    gboolean added) {
+  GsmManagerPrivate *priv;
+  guint old_actions;
+  guint i;
+
+  priv = gsm_manager_get_instance_private(manager);
+
+  old_actions = priv->inhibited_actions;
+
+  for (i = 0; i < G_N_ELEMENTS(priv->inhibitor_counts); i++) {
+    guint bit = 1u << i;
+
+    if (!(flags & bit)) {
+      continue;
+    }
+
+    if (added) {
+      if (priv->inhibitor_counts[i]++ == 0) {
+        priv->inhibited_actions |= bit;
+      }
+    } else {
+      g_assert(priv->inhibitor_counts[i] > 0);
+      if (--priv->inhibitor_counts[i] == 0) {
+        priv->inhibited_actions &= ~bit;
+      }
+    }
+  }
+
+  if (priv->inhibited_actions == old_actions) {
+    return;
+  }
+
+  /* Inhibiting takes effect at once.  Releasing is announced from an
+   * idle, so that an Uninhibit() followed by the same Inhibit() neither
+   * signals twice nor re-arms the idle watch. */
+  if ((priv->inhibited_actions & ~priv->announced_actions) != 0) {
+    announce_inhibited_actions(manager);
+  } else if (priv->announce_actions_id == 0) {
+    priv->announce_actions_id =
+        g_idle_add((GSourceFunc)announce_inhibited_actions_idle, manager);
+  }
+}
+
 static void on_store_inhibitor_added(GsmStore *store, const char *id,
                                      GsmManager *manager) {
+  GsmManagerPrivate *priv;
+  GsmInhibitor *inhibitor;
+  guint flags;
+
   g_debug("GsmManager: Inhibitor added: %s", id);
+
+  priv = gsm_manager_get_instance_private(manager);
+
+  inhibitor = (GsmInhibitor *)gsm_store_lookup(store, id);
+  flags = gsm_inhibitor_peek_flags(inhibitor);
+  g_hash_table_insert(priv->inhibitors_by_id, g_strdup(id),
+                      g_object_ref(inhibitor));
+  gsm_inhibitor_cookies_add(priv->inhibitor_cookies,
+                            gsm_inhibitor_peek_cookie(inhibitor), inhibitor);
+  update_inhibitor_counts(manager, flags, TRUE);
+
   g_signal_emit(manager, signals[INHIBITOR_ADDED], 0, id);
-  update_idle(manager);
+  queue_objects_changed(manager);
 }
 
 static void on_store_inhibitor_removed(GsmStore *store, const char *id,
                                        GsmManager *manager) {
+  GsmManagerPrivate *priv;
+  GsmInhibitor *inhibitor;
+
   g_debug("GsmManager: Inhibitor removed: %s", id);
+
+  priv = gsm_manager_get_instance_private(manager);
+
+  inhibitor = g_hash_table_lookup(priv->inhibitors_by_id, id);
+  if (inhibitor != NULL) {
+    gsm_inhibitor_cookies_remove(priv->inhibitor_cookies,
+                                 gsm_inhibitor_peek_cookie(inhibitor));
+    update_inhibitor_counts(manager, gsm_inhibitor_peek_flags(inhibitor),
+                            FALSE);
+    g_hash_table_remove(priv->inhibitors_by_id, id);
+  }
+
   g_signal_emit(manager, signals[INHIBITOR_REMOVED], 0, id);
-  update_idle(manager);
+  queue_objects_changed(manager);
+}
+
+static gboolean _count_client_type(const char *id, GsmClient *client,
+                                   guint *counts) {
+  counts[GSM_IS_XSMP_CLIENT(client) ? 0 : 1]++;
+  return FALSE;
+}
+
+static gboolean _count_app_state(const char *id, GsmApp *app, guint *counts) {
+  if (gsm_app_peek_is_disabled(app)) {
+    counts[0]++;
+  } else if (gsm_app_peek_is_conditionally_disabled(app)) {
+    counts[1]++;
+  } else if (gsm_app_is_running(app)) {
+    counts[2]++;
+  } else {
+    counts[3]++;
+  }
+  return FALSE;
+}
+
+/* The gauges are read from the stores when the metrics are requested,
+ * rather than kept up to date on every change */
+static void collect_metrics(GsmManager *manager) {
+  static const struct {
+    guint bit;
+    const char *labels;
+  } inhibitor_flags[] = {
+      {0, "flag=\"logout\""},
+      {1, "flag=\"switch-user\""},
+      {2, "flag=\"suspend\""},
+      {3, "flag=\"idle\""},
+  };
+  GsmManagerPrivate *priv;
+  guint client_counts[2] = {0, 0};
+  guint app_counts[4] = {0, 0, 0, 0};
+  struct rusage usage;
+  guint i;
+
+  priv = gsm_manager_get_instance_private(manager);
+
+  if (priv->clients != NULL) {
+    gsm_store_foreach(priv->clients, (GsmStoreFunc)_count_client_type,
+                      client_counts);
+  }
+  gsm_metrics_set(METRIC_CLIENTS, "type=\"xsmp\"", client_counts[0]);
+  gsm_metrics_set(METRIC_CLIENTS, "type=\"dbus\"", client_counts[1]);
+
+  for (i = 0; i < G_N_ELEMENTS(inhibitor_flags); i++) {
+    gsm_metrics_set(METRIC_INHIBITORS, inhibitor_flags[i].labels,
+                    priv->inhibitor_counts[inhibitor_flags[i].bit]);
+  }
+
+  gsm_store_foreach(priv->apps, (GsmStoreFunc)_count_app_state, app_counts);
+  gsm_metrics_set(METRIC_APPS, "state=\"disabled\"", app_counts[0]);
+  gsm_metrics_set(METRIC_APPS, "state=\"conditionally-disabled\"",
+                  app_counts[1]);
+  gsm_metrics_set(METRIC_APPS, "state=\"running\"", app_counts[2]);
+  gsm_metrics_set(METRIC_APPS, "state=\"stopped\"", app_counts[3]);
+
+  if (getrusage(RUSAGE_SELF, &usage) == 0) {
+    gsm_metrics_set_total(
+        METRIC_CPU, "mode=\"user\"",
+        usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6);
+    gsm_metrics_set_total(
+        METRIC_CPU, "mode=\"system\"",
+        usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6);
+    /* kilobytes on Linux */
+    gsm_metrics_set(METRIC_PEAK_RSS, NULL, usage.ru_maxrss * 1024.0);
+  }
+}
+
+static void register_metrics(GsmManager *manager) {
+  gsm_metrics_register(METRIC_CLIENTS, GSM_METRIC_GAUGE,
+                       "Connected session clients, by protocol");
+  gsm_metrics_register(METRIC_INHIBITORS, GSM_METRIC_GAUGE,
+                       "Active inhibitors, by inhibited action");
+  gsm_metrics_register(METRIC_APPS, GSM_METRIC_GAUGE,
+                       "Session applications, by state");
+  gsm_metrics_register(METRIC_PHASE_DURATION, GSM_METRIC_HISTOGRAM,
+                       "Time spent in each session phase");
+  gsm_metrics_register(METRIC_AUTOSTART_FAILURES, GSM_METRIC_COUNTER,
+                       "Applications that failed to start or to register");
+  gsm_metrics_register(METRIC_APP_RESTARTS, GSM_METRIC_COUNTER,
+                       "Applications restarted after exiting");
+  gsm_metrics_register(METRIC_DBUS_CALLS, GSM_METRIC_COUNTER,
+                       "D-Bus method calls received, by method");
+  gsm_metrics_register(METRIC_TIME_TO_RUNNING, GSM_METRIC_GAUGE,
+                       "Time from the start of the session manager to the "
+                       "Running phase");
+  gsm_metrics_register(METRIC_CPU, GSM_METRIC_COUNTER,
+                       "CPU time used by the session manager, by mode");
+  gsm_metrics_register(METRIC_PEAK_RSS, GSM_METRIC_GAUGE,
+                       "Peak resident memory of the session manager");
+
+  gsm_metrics_add_collector((GsmMetricsCollectFunc)collect_metrics, manager);
 }
 
 static void gsm_manager_dispose(GObject *object) {
@@ -2266,6 +2723,16 @@ static void gsm_manager_dispose(GObject *object) {
 
   priv = gsm_manager_get_instance_private(manager);
 
+  if (priv->objects_changed_id != 0) {
+    g_source_remove(priv->objects_changed_id);
+    priv->objects_changed_id = 0;
+  }
+
+  if (priv->announce_actions_id != 0) {
+    g_source_remove(priv->announce_actions_id);
+    priv->announce_actions_id = 0;
+  }
+
   if (priv->clients != NULL) {
     g_signal_handlers_disconnect_by_func(priv->clients, on_store_client_added,
                                          manager);
@@ -2275,6 +2742,9 @@ static void gsm_manager_dispose(GObject *object) {
     priv->clients = NULL;
   }
 
+  g_clear_pointer(&priv->apps_by_app_id, g_hash_table_destroy);
+  g_clear_pointer(&priv->apps_by_provides, g_hash_table_destroy);
+
   if (priv->apps != NULL) {
     g_object_unref(priv->apps);
     priv->apps = NULL;
@@ -2290,6 +2760,11 @@ static void gsm_manager_dispose(GObject *object) {
     priv->inhibitors = NULL;
   }
 
+  g_clear_pointer(&priv->inhibitor_cookies, gsm_inhibitor_cookies_free);
+  g_clear_pointer(&priv->inhibitors_by_id, g_hash_table_destroy);
+  g_clear_pointer(&priv->query_clients, g_hash_table_destroy);
+  g_clear_pointer(&priv->next_query_clients, g_hash_table_destroy);
+
   if (priv->presence != NULL) {
     g_object_unref(priv->presence);
     priv->presence = NULL;
@@ -2305,6 +2780,15 @@ static void gsm_manager_dispose(GObject *object) {
     priv->settings_lockdown = NULL;
   }
 
+  if (priv->registration_stats != NULL) {
+    /* catch the apps that registered after the session was running */
+    gsm_registration_stats_save(priv->registration_stats);
+    gsm_registration_stats_free(priv->registration_stats);
+    priv->registration_stats = NULL;
+  }
+
+  gsm_metrics_remove_collector((GsmMetricsCollectFunc)collect_metrics, manager);
+
   g_free(priv->renderer);
 
   G_OBJECT_CLASS(gsm_manager_parent_class)->dispose(object);
@@ -2349,6 +2833,10 @@ static void gsm_manager_class_init(GsmManagerClass *klass) {
       "inhibitor-removed", G_TYPE_FROM_CLASS(object_class), G_SIGNAL_RUN_LAST,
       G_STRUCT_OFFSET(GsmManagerClass, inhibitor_removed), NULL, NULL,
       g_cclosure_marshal_VOID__BOXED, G_TYPE_NONE, 1, DBUS_TYPE_G_OBJECT_PATH);
+  signals[OBJECTS_CHANGED] = g_signal_new(
+      "objects-changed", G_TYPE_FROM_CLASS(object_class), G_SIGNAL_RUN_LAST,
+      G_STRUCT_OFFSET(GsmManagerClass, objects_changed), NULL, NULL, NULL,
+      G_TYPE_NONE, 1, G_TYPE_UINT64);
 
   g_object_class_install_property(
       object_class, PROP_FAILSAFE,
@@ -2363,8 +2851,21 @@ static void gsm_manager_class_init(GsmManagerClass *klass) {
       object_class, PROP_RENDERER,
       g_param_spec_string("renderer", NULL, NULL, NULL, G_PARAM_READABLE));
 
+  g_object_class_install_property(
+      object_class, PROP_INHIBITED_ACTIONS,
+      g_param_spec_uint("inhibited-actions", NULL, NULL, 0, G_MAXUINT, 0,
+                        G_PARAM_READABLE));
+
+  g_object_class_install_property(
+      object_class, PROP_METRICS,
+      g_param_spec_boxed(
+          "metrics", NULL, NULL,
+          dbus_g_type_get_map("GHashTable", G_TYPE_STRING, G_TYPE_VALUE),
+          G_PARAM_READABLE));
+
   dbus_g_object_type_install_info(GSM_TYPE_MANAGER,
                                   &dbus_glib_gsm_manager_object_info);
+  init_counted_dbus_methods();
   dbus_g_error_domain_register(GSM_MANAGER_ERROR, NULL, GSM_MANAGER_TYPE_ERROR);
 }
 
@@ -2424,16 +2925,28 @@ static void gsm_manager_init(GsmManager *manager) {
 
   priv = gsm_manager_get_instance_private(manager);
 
+  priv->start_time = g_get_monotonic_time();
   priv->settings_session = g_settings_new(SESSION_SCHEMA);
   priv->settings_lockdown = g_settings_new(LOCKDOWN_SCHEMA);
 
+  priv->query_clients = g_hash_table_new(NULL, NULL);
+  priv->next_query_clients = g_hash_table_new(NULL, NULL);
+
+  priv->inhibitors_by_id = g_hash_table_new_full(g_str_hash, g_str_equal,
+                                                 g_free, g_object_unref);
+  priv->inhibitor_cookies = gsm_inhibitor_cookies_new();
   priv->inhibitors = gsm_store_new();
+  gsm_store_set_change_log_size(priv->inhibitors, CHANGE_LOG_SIZE);
   g_signal_connect(priv->inhibitors, "added",
                    G_CALLBACK(on_store_inhibitor_added), manager);
   g_signal_connect(priv->inhibitors, "removed",
                    G_CALLBACK(on_store_inhibitor_removed), manager);
 
   priv->apps = gsm_store_new();
+  priv->apps_by_app_id =
+      g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+  priv->apps_by_provides = g_hash_table_new(NULL, NULL);
+  priv->registration_stats = gsm_registration_stats_load();
 
   priv->presence = gsm_presence_new();
   g_signal_connect(priv->presence, "status-changed",
@@ -2444,6 +2957,8 @@ static void gsm_manager_init(GsmManager *manager) {
                    G_CALLBACK(on_gsettings_key_changed), manager);
 
   load_idle_delay_from_gsettings(manager);
+
+  register_metrics(manager);
 }
 
 static void gsm_manager_finalize(GObject *object) {
@@ -2522,41 +3037,19 @@ gboolean gsm_manager_initialization_error(GsmManager *manager,
 }
 
 static gboolean gsm_manager_is_switch_user_inhibited(GsmManager *manager) {
-  GsmInhibitor *inhibitor;
   GsmManagerPrivate *priv;
 
   priv = gsm_manager_get_instance_private(manager);
 
-  if (priv->inhibitors == NULL) {
-    return FALSE;
-  }
-
-  inhibitor = (GsmInhibitor *)gsm_store_find(
-      priv->inhibitors, (GsmStoreFunc)inhibitor_has_flag,
-      GUINT_TO_POINTER(GSM_INHIBITOR_FLAG_SWITCH_USER));
-  if (inhibitor == NULL) {
-    return FALSE;
-  }
-  return TRUE;
+  return (priv->inhibited_actions & GSM_INHIBITOR_FLAG_SWITCH_USER) != 0;
 }
 
 static gboolean gsm_manager_is_suspend_inhibited(GsmManager *manager) {
-  GsmInhibitor *inhibitor;
   GsmManagerPrivate *priv;
 
   priv = gsm_manager_get_instance_private(manager);
 
-  if (priv->inhibitors == NULL) {
-    return FALSE;
-  }
-
-  inhibitor = (GsmInhibitor *)gsm_store_find(
-      priv->inhibitors, (GsmStoreFunc)inhibitor_has_flag,
-      GUINT_TO_POINTER(GSM_INHIBITOR_FLAG_SUSPEND));
-  if (inhibitor == NULL) {
-    return FALSE;
-  }
-  return TRUE;
+  return (priv->inhibited_actions & GSM_INHIBITOR_FLAG_SUSPEND) != 0;
 }
 
 static void request_reboot_privileges_completed_consolekit(
@@ -3393,8 +3886,7 @@ gboolean gsm_manager_uninhibit(GsmManager *manager, guint cookie,
   g_debug("GsmManager: Uninhibit %u", cookie);
 
   priv = gsm_manager_get_instance_private(manager);
-  inhibitor = (GsmInhibitor *)gsm_store_find(
-      priv->inhibitors, (GsmStoreFunc)_find_by_cookie, &cookie);
+  inhibitor = gsm_inhibitor_cookies_lookup(priv->inhibitor_cookies, cookie);
   if (inhibitor == NULL) {
     GError *new_error;
 
@@ -3422,25 +3914,13 @@ gboolean gsm_manager_uninhibit(GsmManager *manager, guint cookie,
 
 gboolean gsm_manager_is_inhibited(GsmManager *manager, guint flags,
                                   gboolean *is_inhibited, GError *error) {
-  GsmInhibitor *inhibitor;
   GsmManagerPrivate *priv;
 
   g_return_val_if_fail(GSM_IS_MANAGER(manager), FALSE);
 
   priv = gsm_manager_get_instance_private(manager);
-  if (priv->inhibitors == NULL || gsm_store_size(priv->inhibitors) == 0) {
-    *is_inhibited = FALSE;
-    return TRUE;
-  }
 
-  inhibitor = (GsmInhibitor *)gsm_store_find(priv->inhibitors,
-                                             (GsmStoreFunc)inhibitor_has_flag,
-                                             GUINT_TO_POINTER(flags));
-  if (inhibitor == NULL) {
-    *is_inhibited = FALSE;
-  } else {
-    *is_inhibited = TRUE;
-  }
+  *is_inhibited = (priv->inhibited_actions & flags) != 0;
 
   return TRUE;
 }
@@ -3485,6 +3965,270 @@ gboolean gsm_manager_get_inhibitors(GsmManager *manager, GPtrArray **inhibitors,
   return TRUE;
 }
 
+/* GetClientsInfo() and GetInhibitorsInfo() describe each object as an
+ * a{sv} dictionary, so that callers do not need a call per property */
+typedef struct {
+  guint filter;
+  GPtrArray *array;
+} InfoData;
+
+static void info_value_free(GValue *value) {
+  g_value_unset(value);
+  g_free(value);
+}
+
+static void info_set(GHashTable *info, const char *key, GType type,
+                     gconstpointer data) {
+  GValue *value;
+
+  value = g_new0(GValue, 1);
+  g_value_init(value, type);
+  if (type == G_TYPE_UINT) {
+    g_value_set_uint(value, GPOINTER_TO_UINT(data));
+  } else if (type == G_TYPE_STRING) {
+    g_value_set_string(value, data != NULL ? data : "");
+  } else {
+    /* object paths */
+    g_value_set_boxed(value, data);
+  }
+
+  g_hash_table_insert(info, (char *)key, value);
+}
+
+static GHashTable *info_new(void) {
+  return g_hash_table_new_full(g_str_hash, g_str_equal, NULL,
+                               (GDestroyNotify)info_value_free);
+}
+
+static GHashTable *client_info_new(const char *id, GsmClient *client) {
+  GHashTable *info;
+  guint pid;
+
+  pid = 0;
+  gsm_client_get_unix_process_id(client, &pid, NULL);
+
+  info = info_new();
+  info_set(info, "id", DBUS_TYPE_G_OBJECT_PATH, id);
+  info_set(info, "app-id", G_TYPE_STRING, gsm_client_peek_app_id(client));
+  info_set(info, "startup-id", G_TYPE_STRING,
+           gsm_client_peek_startup_id(client));
+  info_set(info, "status", G_TYPE_UINT,
+           GUINT_TO_POINTER(gsm_client_peek_status(client)));
+  info_set(info, "restart-style-hint", G_TYPE_UINT,
+           GUINT_TO_POINTER(gsm_client_peek_restart_style_hint(client)));
+  info_set(info, "unix-process-id", G_TYPE_UINT, GUINT_TO_POINTER(pid));
+
+  return info;
+}
+
+static gboolean listify_client_info(const char *id, GsmClient *client,
+                                    InfoData *data) {
+  guint status;
+
+  status = gsm_client_peek_status(client);
+  if (data->filter != 0 && (data->filter & (1 << status)) == 0) {
+    return FALSE;
+  }
+
+  g_ptr_array_add(data->array, client_info_new(id, client));
+
+  return FALSE;
+}
+
+gboolean gsm_manager_get_clients_info(GsmManager *manager, guint status_mask,
+                                      GPtrArray **clients, GError **error) {
+  GsmManagerPrivate *priv;
+  InfoData data;
+
+  g_return_val_if_fail(GSM_IS_MANAGER(manager), FALSE);
+
+  if (clients == NULL) {
+    return FALSE;
+  }
+
+  priv = gsm_manager_get_instance_private(manager);
+
+  data.filter = status_mask;
+  data.array = g_ptr_array_sized_new(gsm_store_size(priv->clients));
+  gsm_store_foreach(priv->clients, (GsmStoreFunc)listify_client_info, &data);
+  *clients = data.array;
+
+  return TRUE;
+}
+
+static GHashTable *inhibitor_info_new(const char *id,
+                                      GsmInhibitor *inhibitor) {
+  GHashTable *info;
+
+  info = info_new();
+  info_set(info, "id", DBUS_TYPE_G_OBJECT_PATH, id);
+  info_set(info, "app-id", G_TYPE_STRING, gsm_inhibitor_peek_app_id(inhibitor));
+  info_set(info, "client-id", G_TYPE_STRING,
+           gsm_inhibitor_peek_client_id(inhibitor));
+  info_set(info, "reason", G_TYPE_STRING, gsm_inhibitor_peek_reason(inhibitor));
+  info_set(info, "flags", G_TYPE_UINT,
+           GUINT_TO_POINTER(gsm_inhibitor_peek_flags(inhibitor)));
+  info_set(info, "toplevel-xid", G_TYPE_UINT,
+           GUINT_TO_POINTER(gsm_inhibitor_peek_toplevel_xid(inhibitor)));
+
+  return info;
+}
+
+static gboolean listify_inhibitor_info(const char *id, GsmInhibitor *inhibitor,
+                                       InfoData *data) {
+  guint flags;
+
+  flags = gsm_inhibitor_peek_flags(inhibitor);
+  if (data->filter != 0 && (data->filter & flags) == 0) {
+    return FALSE;
+  }
+
+  g_ptr_array_add(data->array, inhibitor_info_new(id, inhibitor));
+
+  return FALSE;
+}
+
+gboolean gsm_manager_get_inhibitors_info(GsmManager *manager, guint flags,
+                                         GPtrArray **inhibitors,
+                                         GError **error) {
+  GsmManagerPrivate *priv;
+  InfoData data;
+
+  g_return_val_if_fail(GSM_IS_MANAGER(manager), FALSE);
+
+  if (inhibitors == NULL) {
+    return FALSE;
+  }
+
+  priv = gsm_manager_get_instance_private(manager);
+
+  data.filter = flags;
+  data.array = g_ptr_array_sized_new(gsm_store_size(priv->inhibitors));
+  gsm_store_foreach(priv->inhibitors, (GsmStoreFunc)listify_inhibitor_info,
+                    &data);
+  *inhibitors = data.array;
+
+  return TRUE;
+}
+
+/* GetChanges() merges the change logs of the client and inhibitor
+ * stores, whose sequence numbers come from the same counter */
+typedef struct {
+  guint64 sequence;
+  const char *id;
+  gboolean added;
+  gboolean is_client;
+} ChangeEntry;
+
+typedef struct {
+  GArray *entries;
+  gboolean is_client;
+} ChangesData;
+
+static void collect_change(guint64 sequence, const char *id, gboolean added,
+                           ChangesData *data) {
+  ChangeEntry entry;
+
+  entry.sequence = sequence;
+  entry.id = id;
+  entry.added = added;
+  entry.is_client = data->is_client;
+  g_array_append_val(data->entries, entry);
+}
+
+static gint compare_change_entries(const ChangeEntry *a, const ChangeEntry *b) {
+  if (a->sequence == b->sequence) {
+    return 0;
+  }
+  return a->sequence < b->sequence ? -1 : 1;
+}
+
+static GHashTable *change_info_new(GsmManager *manager,
+                                   const ChangeEntry *entry) {
+  GsmManagerPrivate *priv;
+  GHashTable *info;
+  GObject *object;
+  GValue *value;
+  const char *change;
+
+  priv = gsm_manager_get_instance_private(manager);
+
+  /* describe the objects that are still there, as GetClientsInfo() and
+   * GetInhibitorsInfo() would */
+  object = NULL;
+  if (entry->added) {
+    object = gsm_store_lookup(
+        entry->is_client ? priv->clients : priv->inhibitors, entry->id);
+  }
+
+  if (object == NULL) {
+    info = info_new();
+    info_set(info, "id", DBUS_TYPE_G_OBJECT_PATH, entry->id);
+  } else if (entry->is_client) {
+    info = client_info_new(entry->id, GSM_CLIENT(object));
+  } else {
+    info = inhibitor_info_new(entry->id, GSM_INHIBITOR(object));
+  }
+
+  if (entry->is_client) {
+    change = entry->added ? "client-added" : "client-removed";
+  } else {
+    change = entry->added ? "inhibitor-added" : "inhibitor-removed";
+  }
+  info_set(info, "change", G_TYPE_STRING, change);
+
+  value = g_new0(GValue, 1);
+  g_value_init(value, G_TYPE_UINT64);
+  g_value_set_uint64(value, entry->sequence);
+  g_hash_table_insert(info, (char *)"sequence", value);
+
+  return info;
+}
+
+gboolean gsm_manager_get_changes(GsmManager *manager, guint64 since,
+                                 guint64 *sequence, gboolean *complete,
+                                 GPtrArray **changes, GError **error) {
+  GsmManagerPrivate *priv;
+  ChangesData data;
+  guint i;
+
+  g_return_val_if_fail(GSM_IS_MANAGER(manager), FALSE);
+
+  if (sequence == NULL || complete == NULL || changes == NULL) {
+    return FALSE;
+  }
+
+  priv = gsm_manager_get_instance_private(manager);
+
+  *sequence = get_sequence(manager);
+  *changes = g_ptr_array_new();
+
+  data.entries = g_array_new(FALSE, FALSE, sizeof(ChangeEntry));
+  data.is_client = TRUE;
+  *complete = gsm_store_foreach_change(
+      priv->clients, since, (GsmStoreChangeFunc)collect_change, &data);
+  data.is_client = FALSE;
+  if (*complete) {
+    *complete = gsm_store_foreach_change(
+        priv->inhibitors, since, (GsmStoreChangeFunc)collect_change, &data);
+  }
+
+  /* callers resync with GetClientsInfo() and GetInhibitorsInfo() */
+  if (*complete) {
+    g_array_sort(data.entries, (GCompareFunc)compare_change_entries);
+    for (i = 0; i < data.entries->len; i++) {
+      g_ptr_array_add(
+          *changes,
+          change_info_new(manager,
+                          &g_array_index(data.entries, ChangeEntry, i)));
+    }
+  }
+
+  g_array_free(data.entries, TRUE);
+
+  return TRUE;
+}
+
 static gboolean _app_has_autostart_condition(const char *id, GsmApp *app,
                                              const char *condition) {
   gboolean has;
@@ -3522,7 +4266,9 @@ gboolean gsm_manager_is_autostart_condition_handled(GsmManager *manager,
 static void append_app(GsmManager *manager, GsmApp *app) {
   const char *id;
   const char *app_id;
+  const GQuark *provides;
   GsmApp *dup;
+  guint i;
   GsmManagerPrivate *priv;
 
   id = gsm_app_peek_id(app);
@@ -3551,6 +4297,17 @@ static void append_app(GsmManager *manager, GsmApp *app) {
   }
 
   gsm_store_add(priv->apps, id, G_OBJECT(app));
+
+  g_hash_table_insert(priv->apps_by_app_id, g_strdup(app_id), app);
+
+  provides = gsm_app_peek_provides(app);
+  for (i = 0; provides != NULL && provides[i] != 0; i++) {
+    if (!g_hash_table_contains(priv->apps_by_provides,
+                               GUINT_TO_POINTER(provides[i]))) {
+      g_hash_table_insert(priv->apps_by_provides,
+                          GUINT_TO_POINTER(provides[i]), app);
+    }
+  }
 }
 
 gboolean gsm_manager_add_autostart_app(GsmManager *manager, const char *path,
@@ -3564,10 +4321,13 @@ gboolean gsm_manager_add_autostart_app(GsmManager *manager, const char *path,
   priv = gsm_manager_get_instance_private(manager);
   /* first check to see if service is already provided */
   if (provides != NULL) {
+    GQuark quark;
     GsmApp *dup;
 
-    dup = (GsmApp *)gsm_store_find(priv->apps, (GsmStoreFunc)_find_app_provides,
-                                   (char *)provides);
+    quark = g_quark_try_string(provides);
+    dup = quark != 0 ? g_hash_table_lookup(priv->apps_by_provides,
+                                           GUINT_TO_POINTER(quark))
+                     : NULL;
     if (dup != NULL) {
       g_debug("GsmManager: service '%s' is already provided", provides);
       return FALSE;
@@ -3589,34 +4349,21 @@ gboolean gsm_manager_add_autostart_app(GsmManager *manager, const char *path,
 
 gboolean gsm_manager_add_autostart_apps_from_dir(GsmManager *manager,
                                                  const char *path) {
-  GDir *dir;
-  const char *name;
+  GsmSessionPlan *plan;
+  gboolean res;
 
   g_return_val_if_fail(GSM_IS_MANAGER(manager), FALSE);
   g_return_val_if_fail(path != NULL, FALSE);
 
-  g_debug("GsmManager: *** Adding autostart apps for %s", path);
-
-  dir = g_dir_open(path, 0, NULL);
-  if (dir == NULL) {
-    return FALSE;
-  }
-
-  while ((name = g_dir_read_name(dir))) {
-    char *desktop_file;
-
-    if (!g_str_has_suffix(name, ".desktop")) {
-      continue;
-    }
-
-    desktop_file = g_build_filename(path, name, NULL);
-    gsm_manager_add_autostart_app(manager, desktop_file, NULL);
-    g_free(desktop_file);
-  }
-
-  g_dir_close(dir);
+  /* Scan the directory the way a session plan does, so saved and override
+   * apps are picked up exactly like the ones in the plan. The plan is not
+   * saved, so it needs no fingerprint. */
+  plan = gsm_session_plan_new("");
+  res = gsm_session_plan_add_apps_from_dir(plan, path);
+  gsm_session_plan_replay(plan, manager);
+  gsm_session_plan_free(plan);
 
-  return TRUE;
+  return res;
 }
 
 gboolean gsm_manager_is_session_running(GsmManager *manager, gboolean *running,
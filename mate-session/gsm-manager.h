@@ -46,6 +46,7 @@ struct _GsmManagerClass {
   void (*client_removed)(GsmManager *manager, const char *id);
   void (*inhibitor_added)(GsmManager *manager, const char *id);
   void (*inhibitor_removed)(GsmManager *manager, const char *id);
+  void (*objects_changed)(GsmManager *manager, guint64 sequence);
 };  // GsmManagerClass;
 
 typedef enum {
@@ -140,8 +141,16 @@ gboolean gsm_manager_initialization_error(GsmManager *manager,
 
 gboolean gsm_manager_get_clients(GsmManager *manager, GPtrArray **clients,
                                  GError **error);
+gboolean gsm_manager_get_clients_info(GsmManager *manager, guint status_mask,
+                                      GPtrArray **clients, GError **error);
 gboolean gsm_manager_get_inhibitors(GsmManager *manager, GPtrArray **inhibitors,
                                     GError **error);
+gboolean gsm_manager_get_inhibitors_info(GsmManager *manager, guint flags,
+                                         GPtrArray **inhibitors,
+                                         GError **error);
+gboolean gsm_manager_get_changes(GsmManager *manager, guint64 since,
+                                 guint64 *sequence, gboolean *complete,
+                                 GPtrArray **changes, GError **error);
 gboolean gsm_manager_is_autostart_condition_handled(GsmManager *manager,
                                                     const char *condition,
                                                     gboolean *handled,
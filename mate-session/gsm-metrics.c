@@ -0,0 +1,579 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*-
+ * gsm-metrics.c
+ * Copyright (C) 2012-2021 MATE Developers
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include "gsm-metrics.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <glib-object.h>
+#include <glib-unix.h>
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+/* A small registry of counters, gauges and histograms describing the
+ * session. It can be read as a dictionary (exported on the bus by the
+ * manager) or in the Prometheus text format, which is served on a Unix
+ * socket in the runtime directory so that a node exporter can scrape it.
+ *
+ * Each metric family holds one series per set of labels; labels are
+ * kept preformatted, as they appear between the braces. */
+
+#define METRICS_SOCKET_NAME "metrics"
+
+/* Upper bounds of the histogram buckets, in seconds */
+static const double histogram_bounds[] = {0.005, 0.01, 0.05, 0.1, 0.5, 1,
+                                          2.5,   5,    10,   30,  60};
+#define N_BUCKETS G_N_ELEMENTS(histogram_bounds)
+
+typedef struct {
+  double value; /* the sum, for histograms */
+  guint64 count;
+  guint64 buckets[N_BUCKETS];
+} MetricSeries;
+
+typedef struct {
+  char *name;
+  GsmMetricType type;
+  char *help;
+  GHashTable *series;
+} MetricFamily;
+
+typedef struct {
+  GsmMetricsCollectFunc func;
+  gpointer user_data;
+} MetricCollector;
+
+typedef void (*SampleFunc)(const char *name, double value, gpointer user_data);
+
+static GPtrArray *families = NULL;
+static GHashTable *families_by_name = NULL;
+static GSList *collectors = NULL;
+
+static int server_fd = -1;
+static guint server_id = 0;
+static char *server_path = NULL;
+
+static void metric_family_free(MetricFamily *family) {
+  g_free(family->name);
+  g_free(family->help);
+  g_hash_table_destroy(family->series);
+  g_free(family);
+}
+
+void gsm_metrics_register(const char *name, GsmMetricType type,
+                          const char *help) {
+  MetricFamily *family;
+
+  g_return_if_fail(name != NULL);
+
+  if (families == NULL) {
+    families =
+        g_ptr_array_new_with_free_func((GDestroyNotify)metric_family_free);
+    families_by_name = g_hash_table_new(g_str_hash, g_str_equal);
+  }
+
+  if (g_hash_table_contains(families_by_name, name)) {
+    return;
+  }
+
+  family = g_new0(MetricFamily, 1);
+  family->name = g_strdup(name);
+  family->type = type;
+  family->help = g_strdup(help);
+  family->series =
+      g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+
+  g_ptr_array_add(families, family);
+  g_hash_table_insert(families_by_name, family->name, family);
+}
+
+void gsm_metrics_add_collector(GsmMetricsCollectFunc func,
+                               gpointer user_data) {
+  MetricCollector *collector;
+
+  g_return_if_fail(func != NULL);
+
+  collector = g_new0(MetricCollector, 1);
+  collector->func = func;
+  collector->user_data = user_data;
+
+  collectors = g_slist_append(collectors, collector);
+}
+
+void gsm_metrics_remove_collector(GsmMetricsCollectFunc func,
+                                  gpointer user_data) {
+  GSList *l;
+
+  for (l = collectors; l != NULL; l = l->next) {
+    MetricCollector *collector = l->data;
+
+    if (collector->func == func && collector->user_data == user_data) {
+      collectors = g_slist_delete_link(collectors, l);
+      g_free(collector);
+      return;
+    }
+  }
+}
+
+static MetricSeries *lookup_series(const char *name, const char *labels,
+                                   GsmMetricType type) {
+  MetricFamily *family;
+  MetricSeries *series;
+
+  family = families_by_name != NULL
+               ? g_hash_table_lookup(families_by_name, name)
+               : NULL;
+  if (family == NULL) {
+    g_warning("GsmMetrics: metric %s is not registered", name);
+    return NULL;
+  }
+
+  g_return_val_if_fail(family->type == type, NULL);
+
+  if (labels == NULL) {
+    labels = "";
+  }
+
+  series = g_hash_table_lookup(family->series, labels);
+  if (series == NULL) {
+    series = g_new0(MetricSeries, 1);
+    g_hash_table_insert(family->series, g_strdup(labels), series);
+  }
+
+  return series;
+}
+
+void gsm_metrics_inc(const char *name, const char *labels) {
+  MetricSeries *series;
+
+  series = lookup_series(name, labels, GSM_METRIC_COUNTER);
+  if (series != NULL) {
+    series->value++;
+  }
+}
+
+void gsm_metrics_set_total(const char *name, const char *labels,
+                           double value) {
+  MetricSeries *series;
+
+  series = lookup_series(name, labels, GSM_METRIC_COUNTER);
+  if (series != NULL && value > series->value) {
+    series->value = value;
+  }
+}
+
+void gsm_metrics_set(const char *name, const char *labels, double value) {
+  MetricSeries *series;
+
+  series = lookup_series(name, labels, GSM_METRIC_GAUGE);
+  if (series != NULL) {
+    series->value = value;
+  }
+}
+
+void gsm_metrics_observe(const char *name, const char *labels, double value) {
+  MetricSeries *series;
+  guint i;
+
+  series = lookup_series(name, labels, GSM_METRIC_HISTOGRAM);
+  if (series == NULL) {
+    return;
+  }
+
+  series->value += value;
+  series->count++;
+  for (i = 0; i < N_BUCKETS; i++) {
+    if (value <= histogram_bounds[i]) {
+      series->buckets[i]++;
+    }
+  }
+}
+
+static void run_collectors(void) {
+  GSList *l;
+
+  for (l = collectors; l != NULL; l = l->next) {
+    MetricCollector *collector = l->data;
+
+    collector->func(collector->user_data);
+  }
+}
+
+static char *format_sample_name(const char *name, const char *suffix,
+                                const char *labels, const char *le) {
+  GString *str;
+
+  str = g_string_new(name);
+  g_string_append(str, suffix);
+
+  if (*labels != '\0' || le != NULL) {
+    g_string_append_c(str, '{');
+    g_string_append(str, labels);
+    if (le != NULL) {
+      if (*labels != '\0') {
+        g_string_append_c(str, ',');
+      }
+      g_string_append_printf(str, "le=\"%s\"", le);
+    }
+    g_string_append_c(str, '}');
+  }
+
+  return g_string_free(str, FALSE);
+}
+
+static void emit_sample(const char *name, const char *suffix,
+                        const char *labels, const char *le, double value,
+                        SampleFunc func, gpointer user_data) {
+  char *sample;
+
+  sample = format_sample_name(name, suffix, labels, le);
+  func(sample, value, user_data);
+  g_free(sample);
+}
+
+static void foreach_series_sample(MetricFamily *family, const char *labels,
+                                  MetricSeries *series, SampleFunc func,
+                                  gpointer user_data) {
+  char le[G_ASCII_DTOSTR_BUF_SIZE];
+  guint i;
+
+  if (family->type != GSM_METRIC_HISTOGRAM) {
+    emit_sample(family->name, "", labels, NULL, series->value, func,
+                user_data);
+    return;
+  }
+
+  for (i = 0; i < N_BUCKETS; i++) {
+    g_ascii_dtostr(le, sizeof(le), histogram_bounds[i]);
+    emit_sample(family->name, "_bucket", labels, le, series->buckets[i], func,
+                user_data);
+  }
+  emit_sample(family->name, "_bucket", labels, "+Inf", series->count, func,
+              user_data);
+  emit_sample(family->name, "_sum", labels, NULL, series->value, func,
+              user_data);
+  emit_sample(family->name, "_count", labels, NULL, series->count, func,
+              user_data);
+}
+
+static void foreach_family_sample(MetricFamily *family, SampleFunc func,
+                                  gpointer user_data) {
+  GList *labels;
+  GList *l;
+
+  /* sorted, so that the output is stable from one read to the next */
+  labels = g_hash_table_get_keys(family->series);
+  labels = g_list_sort(labels, (GCompareFunc)strcmp);
+
+  for (l = labels; l != NULL; l = l->next) {
+    foreach_series_sample(family, l->data,
+                          g_hash_table_lookup(family->series, l->data), func,
+                          user_data);
+  }
+
+  g_list_free(labels);
+}
+
+static void value_free(GValue *value) {
+  g_value_unset(value);
+  g_free(value);
+}
+
+static void add_sample_to_hash_table(const char *name, double value,
+                                     GHashTable *table) {
+  GValue *gvalue;
+
+  gvalue = g_new0(GValue, 1);
+  g_value_init(gvalue, G_TYPE_DOUBLE);
+  g_value_set_double(gvalue, value);
+
+  g_hash_table_insert(table, g_strdup(name), gvalue);
+}
+
+/**
+ * gsm_metrics_to_hash_table:
+ *
+ * Return value: a new hash table mapping each sample, named as in the
+ * Prometheus format, to a #GValue holding its value as a double.
+ **/
+GHashTable *gsm_metrics_to_hash_table(void) {
+  GHashTable *table;
+  guint i;
+
+  table = g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
+                                (GDestroyNotify)value_free);
+
+  if (families == NULL) {
+    return table;
+  }
+
+  run_collectors();
+
+  for (i = 0; i < families->len; i++) {
+    foreach_family_sample(g_ptr_array_index(families, i),
+                          (SampleFunc)add_sample_to_hash_table, table);
+  }
+
+  return table;
+}
+
+static void append_sample_text(const char *name, double value, GString *str) {
+  char buf[G_ASCII_DTOSTR_BUF_SIZE];
+
+  g_string_append_printf(str, "%s %s\n", name,
+                         g_ascii_dtostr(buf, sizeof(buf), value));
+}
+
+char *gsm_metrics_to_text(void) {
+  static const char *type_names[] = {"counter", "gauge", "histogram"};
+  GString *str;
+  guint i;
+
+  str = g_string_new(NULL);
+
+  if (families == NULL) {
+    return g_string_free(str, FALSE);
+  }
+
+  run_collectors();
+
+  for (i = 0; i < families->len; i++) {
+    MetricFamily *family = g_ptr_array_index(families, i);
+
+    if (family->help != NULL) {
+      g_string_append_printf(str, "# HELP %s %s\n", family->name,
+                             family->help);
+    }
+    g_string_append_printf(str, "# TYPE %s %s\n", family->name,
+                           type_names[family->type]);
+    foreach_family_sample(family, (SampleFunc)append_sample_text, str);
+  }
+
+  return g_string_free(str, FALSE);
+}
+
+/* Each connection gets a single HTTP response and is closed, which is
+ * enough for curl --unix-socket and for the exporters that proxy a
+ * socket. The request is read up to the end of its headers first, and
+ * then ignored: closing a socket with unread data resets the connection,
+ * and the client could lose the response. */
+#define MAX_REQUEST_SIZE 8192
+#define REQUEST_TIMEOUT_SECONDS 5
+
+typedef struct {
+  int fd;
+  GString *request;
+  guint io_id;
+  guint timeout_id;
+} MetricsConnection;
+
+static GSList *connections = NULL;
+
+static void metrics_connection_close(MetricsConnection *connection) {
+  connections = g_slist_remove(connections, connection);
+
+  if (connection->io_id > 0) {
+    g_source_remove(connection->io_id);
+  }
+  if (connection->timeout_id > 0) {
+    g_source_remove(connection->timeout_id);
+  }
+
+  close(connection->fd);
+  g_string_free(connection->request, TRUE);
+  g_free(connection);
+}
+
+static void send_metrics(int fd) {
+  char *body;
+  char *response;
+
+  body = gsm_metrics_to_text();
+  response = g_strdup_printf(
+      "HTTP/1.0 200 OK\r\n"
+      "Content-Type: text/plain; version=0.0.4\r\n"
+      "Content-Length: %" G_GSIZE_FORMAT "\r\n"
+      "\r\n"
+      "%s",
+      strlen(body), body);
+
+  /* The response is a few kilobytes, well within the socket buffer;
+   * never block the main loop on a client that doesn't read */
+  if (send(fd, response, strlen(response), MSG_DONTWAIT | MSG_NOSIGNAL) < 0) {
+    g_debug("GsmMetrics: unable to send metrics: %s", g_strerror(errno));
+  }
+
+  g_free(response);
+  g_free(body);
+}
+
+static gboolean on_request_timeout(MetricsConnection *connection) {
+  g_debug("GsmMetrics: timed out waiting for a request");
+
+  connection->timeout_id = 0;
+  metrics_connection_close(connection);
+
+  return G_SOURCE_REMOVE;
+}
+
+static gboolean on_request_data(int fd, GIOCondition condition,
+                                MetricsConnection *connection) {
+  char buffer[1024];
+  gssize n;
+
+  n = recv(fd, buffer, sizeof(buffer), 0);
+  if (n < 0) {
+    if (errno == EAGAIN || errno == EINTR) {
+      return G_SOURCE_CONTINUE;
+    }
+    g_debug("GsmMetrics: unable to read request: %s", g_strerror(errno));
+    connection->io_id = 0;
+    metrics_connection_close(connection);
+    return G_SOURCE_REMOVE;
+  }
+
+  g_string_append_len(connection->request, buffer, n);
+
+  /* wait for the blank line ending the headers, or for the end of the
+   * request */
+  if (n > 0 && connection->request->len < MAX_REQUEST_SIZE &&
+      strstr(connection->request->str, "\r\n\r\n") == NULL &&
+      strstr(connection->request->str, "\n\n") == NULL) {
+    return G_SOURCE_CONTINUE;
+  }
+
+  send_metrics(fd);
+  shutdown(fd, SHUT_WR);
+
+  connection->io_id = 0;
+  metrics_connection_close(connection);
+
+  return G_SOURCE_REMOVE;
+}
+
+static gboolean on_metrics_connection(int fd, GIOCondition condition,
+                                      gpointer user_data) {
+  MetricsConnection *connection;
+  int client_fd;
+
+  client_fd = accept(fd, NULL, NULL);
+  if (client_fd < 0) {
+    if (errno != EAGAIN && errno != EINTR) {
+      g_debug("GsmMetrics: accept failed: %s", g_strerror(errno));
+    }
+    return TRUE;
+  }
+
+  fcntl(client_fd, F_SETFD, FD_CLOEXEC);
+  if (!g_unix_set_fd_nonblocking(client_fd, TRUE, NULL)) {
+    close(client_fd);
+    return TRUE;
+  }
+
+  connection = g_new0(MetricsConnection, 1);
+  connection->fd = client_fd;
+  connection->request = g_string_new(NULL);
+  connection->io_id = g_unix_fd_add(client_fd, G_IO_IN | G_IO_HUP,
+                                    (GUnixFDSourceFunc)on_request_data,
+                                    connection);
+  connection->timeout_id =
+      g_timeout_add_seconds(REQUEST_TIMEOUT_SECONDS,
+                            (GSourceFunc)on_request_timeout, connection);
+  connections = g_slist_prepend(connections, connection);
+
+  return TRUE;
+}
+
+gboolean gsm_metrics_start_server(void) {
+  struct sockaddr_un addr;
+  char *dir;
+
+  g_return_val_if_fail(server_fd == -1, FALSE);
+
+  dir = g_build_filename(g_get_user_runtime_dir(), "mate-session", NULL);
+  if (g_mkdir_with_parents(dir, 0700) != 0) {
+    g_warning("Unable to create %s: %s", dir, g_strerror(errno));
+    g_free(dir);
+    return FALSE;
+  }
+
+  server_path = g_build_filename(dir, METRICS_SOCKET_NAME, NULL);
+  g_free(dir);
+
+  if (strlen(server_path) >= sizeof(addr.sun_path)) {
+    g_warning("Metrics socket path %s is too long", server_path);
+    goto error;
+  }
+
+  server_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+  if (server_fd < 0) {
+    g_warning("Unable to create metrics socket: %s", g_strerror(errno));
+    goto error;
+  }
+
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strcpy(addr.sun_path, server_path);
+
+  g_unlink(server_path);
+  if (bind(server_fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+      listen(server_fd, 8) < 0) {
+    g_warning("Unable to listen on metrics socket %s: %s", server_path,
+              g_strerror(errno));
+    goto error;
+  }
+
+  server_id = g_unix_fd_add(server_fd, G_IO_IN, on_metrics_connection, NULL);
+  g_debug("GsmMetrics: serving metrics on %s", server_path);
+
+  return TRUE;
+
+error:
+  gsm_metrics_stop_server();
+  return FALSE;
+}
+
+void gsm_metrics_stop_server(void) {
+  while (connections != NULL) {
+    metrics_connection_close(connections->data);
+  }
+
+  if (server_id > 0) {
+    g_source_remove(server_id);
+    server_id = 0;
+  }
+
+  if (server_fd >= 0) {
+    close(server_fd);
+    server_fd = -1;
+    g_unlink(server_path);
+  }
+
+  g_free(server_path);
+  server_path = NULL;
+}
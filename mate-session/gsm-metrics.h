@@ -0,0 +1,61 @@
+/* gsm-metrics.h
+ * Copyright (C) 2012-2021 MATE Developers
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+#ifndef __GSM_METRICS_H__
+#define __GSM_METRICS_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+typedef enum {
+  GSM_METRIC_COUNTER,
+  GSM_METRIC_GAUGE,
+  GSM_METRIC_HISTOGRAM
+} GsmMetricType;
+
+/* Called before the metrics are read, to update the gauges that are
+ * cheaper to compute on demand than to keep up to date */
+typedef void (*GsmMetricsCollectFunc)(gpointer user_data);
+
+void gsm_metrics_register(const char *name, GsmMetricType type,
+                          const char *help);
+void gsm_metrics_add_collector(GsmMetricsCollectFunc func, gpointer user_data);
+void gsm_metrics_remove_collector(GsmMetricsCollectFunc func,
+                                  gpointer user_data);
+
+/* @labels is either NULL or a list of Prometheus labels, such as
+ * type="xsmp" */
+void gsm_metrics_inc(const char *name, const char *labels);
+/* For counters kept by someone else, such as the kernel: @value is the
+ * running total, which must not decrease */
+void gsm_metrics_set_total(const char *name, const char *labels,
+                           double value);
+void gsm_metrics_set(const char *name, const char *labels, double value);
+void gsm_metrics_observe(const char *name, const char *labels, double value);
+
+GHashTable *gsm_metrics_to_hash_table(void);
+char *gsm_metrics_to_text(void);
+
+gboolean gsm_metrics_start_server(void);
+void gsm_metrics_stop_server(void);
+
+G_END_DECLS
+
+#endif /* __GSM_METRICS_H__ */
@@ -0,0 +1,328 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*-
+ * gsm-registration-stats.c
+ * Copyright (C) 2012-2021 MATE Developers
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include "gsm-registration-stats.h"
+
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Registration latencies of the apps we waited for in the pre-Application
+ * phases, kept across logins so the phase timeout can follow what the apps
+ * actually need instead of always waiting GSM_MANAGER_PHASE_TIMEOUT. */
+
+#define STATS_FILENAME "registration-stats"
+#define KEY_SAMPLES "Samples"
+#define KEY_MISSES "Misses"
+
+/* Number of latencies remembered per app */
+#define MAX_SAMPLES 20
+/* Below this we don't trust the history and use the default timeout */
+#define MIN_SAMPLES 5
+/* Timeout is the 99th percentile of the latencies times this, but never
+ * less than MIN_TIMEOUT: an app that usually registers within 100 ms can
+ * still take a few seconds on a cold disk cache */
+#define TIMEOUT_FACTOR 3
+#define MIN_TIMEOUT 5000 /* milliseconds */
+/* After this many logins in a row without registering, an app is assumed
+ * not to support registration at all and is not waited for anymore */
+#define MAX_MISSES 3
+
+typedef struct {
+  guint samples[MAX_SAMPLES]; /* milliseconds, oldest first */
+  guint n_samples;
+  guint misses;
+  /* set while the app is started and has not registered yet */
+  gint64 start_time;
+} AppStats;
+
+struct _GsmRegistrationStats {
+  char *filename;
+  GHashTable *apps;
+  gboolean dirty;
+};
+
+static AppStats *lookup_app_stats(GsmRegistrationStats *stats,
+                                  const char *app_id, gboolean create) {
+  AppStats *app_stats;
+
+  app_stats = g_hash_table_lookup(stats->apps, app_id);
+  if (app_stats == NULL && create) {
+    app_stats = g_new0(AppStats, 1);
+    g_hash_table_insert(stats->apps, g_strdup(app_id), app_stats);
+  }
+
+  return app_stats;
+}
+
+static void push_sample(AppStats *app_stats, guint latency) {
+  if (app_stats->n_samples == MAX_SAMPLES) {
+    memmove(app_stats->samples, app_stats->samples + 1,
+            (MAX_SAMPLES - 1) * sizeof(guint));
+    app_stats->n_samples--;
+  }
+
+  app_stats->samples[app_stats->n_samples++] = latency;
+}
+
+static guint elapsed_since(gint64 start_time) {
+  gint64 elapsed;
+
+  elapsed = (g_get_monotonic_time() - start_time) / 1000;
+
+  return (guint)CLAMP(elapsed, 0, G_MAXUINT);
+}
+
+GsmRegistrationStats *gsm_registration_stats_load(void) {
+  GsmRegistrationStats *stats;
+  GKeyFile *keyfile;
+  char **groups;
+  int i;
+
+  stats = g_new0(GsmRegistrationStats, 1);
+  stats->filename = g_build_filename(g_get_user_cache_dir(), "mate-session",
+                                     STATS_FILENAME, NULL);
+  stats->apps = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+
+  keyfile = g_key_file_new();
+  if (!g_key_file_load_from_file(keyfile, stats->filename, G_KEY_FILE_NONE,
+                                 NULL)) {
+    g_key_file_free(keyfile);
+    return stats;
+  }
+
+  groups = g_key_file_get_groups(keyfile, NULL);
+  for (i = 0; groups[i] != NULL; i++) {
+    AppStats *app_stats;
+    gint *samples;
+    gsize n_samples;
+    gsize j;
+
+    app_stats = lookup_app_stats(stats, groups[i], TRUE);
+
+    samples = g_key_file_get_integer_list(keyfile, groups[i], KEY_SAMPLES,
+                                          &n_samples, NULL);
+    for (j = 0; samples != NULL && j < n_samples; j++) {
+      if (samples[j] >= 0) {
+        push_sample(app_stats, samples[j]);
+      }
+    }
+    g_free(samples);
+
+    app_stats->misses =
+        MAX(g_key_file_get_integer(keyfile, groups[i], KEY_MISSES, NULL), 0);
+  }
+
+  g_strfreev(groups);
+  g_key_file_free(keyfile);
+
+  return stats;
+}
+
+void gsm_registration_stats_save(GsmRegistrationStats *stats) {
+  GKeyFile *keyfile;
+  GHashTableIter iter;
+  gpointer key, value;
+  char *dirname;
+  char *contents;
+  gsize length;
+  GError *error;
+
+  g_return_if_fail(stats != NULL);
+
+  if (!stats->dirty) {
+    return;
+  }
+
+  keyfile = g_key_file_new();
+
+  g_hash_table_iter_init(&iter, stats->apps);
+  while (g_hash_table_iter_next(&iter, &key, &value)) {
+    AppStats *app_stats = value;
+    gint samples[MAX_SAMPLES];
+    guint i;
+
+    for (i = 0; i < app_stats->n_samples; i++) {
+      samples[i] = (gint)MIN(app_stats->samples[i], G_MAXINT);
+    }
+
+    g_key_file_set_integer_list(keyfile, key, KEY_SAMPLES, samples,
+                                app_stats->n_samples);
+    g_key_file_set_integer(keyfile, key, KEY_MISSES, app_stats->misses);
+  }
+
+  contents = g_key_file_to_data(keyfile, &length, NULL);
+  g_key_file_free(keyfile);
+
+  dirname = g_path_get_dirname(stats->filename);
+  g_mkdir_with_parents(dirname, 0755);
+  g_free(dirname);
+
+  error = NULL;
+  if (!g_file_set_contents(stats->filename, contents, length, &error)) {
+    g_debug("GsmRegistrationStats: unable to save %s: %s", stats->filename,
+            error->message);
+    g_error_free(error);
+  } else {
+    stats->dirty = FALSE;
+  }
+
+  g_free(contents);
+}
+
+void gsm_registration_stats_free(GsmRegistrationStats *stats) {
+  if (stats == NULL) {
+    return;
+  }
+
+  g_hash_table_destroy(stats->apps);
+  g_free(stats->filename);
+  g_free(stats);
+}
+
+void gsm_registration_stats_app_started(GsmRegistrationStats *stats,
+                                        const char *app_id) {
+  AppStats *app_stats;
+
+  g_return_if_fail(stats != NULL);
+  g_return_if_fail(app_id != NULL);
+
+  app_stats = lookup_app_stats(stats, app_id, TRUE);
+  app_stats->start_time = g_get_monotonic_time();
+}
+
+void gsm_registration_stats_app_registered(GsmRegistrationStats *stats,
+                                           const char *app_id) {
+  AppStats *app_stats;
+  guint latency;
+
+  g_return_if_fail(stats != NULL);
+  g_return_if_fail(app_id != NULL);
+
+  app_stats = lookup_app_stats(stats, app_id, FALSE);
+  if (app_stats == NULL || app_stats->start_time == 0) {
+    return;
+  }
+
+  latency = elapsed_since(app_stats->start_time);
+  g_debug("GsmRegistrationStats: %s registered after %u ms", app_id, latency);
+
+  push_sample(app_stats, latency);
+  app_stats->misses = 0;
+  app_stats->start_time = 0;
+  stats->dirty = TRUE;
+}
+
+void gsm_registration_stats_app_exited(GsmRegistrationStats *stats,
+                                       const char *app_id) {
+  AppStats *app_stats;
+
+  g_return_if_fail(stats != NULL);
+  g_return_if_fail(app_id != NULL);
+
+  /* Exiting is not registering: nothing is learnt about the latency, and
+   * a miss counted at the phase timeout stays counted */
+  app_stats = lookup_app_stats(stats, app_id, FALSE);
+  if (app_stats != NULL) {
+    app_stats->start_time = 0;
+  }
+}
+
+void gsm_registration_stats_app_timed_out(GsmRegistrationStats *stats,
+                                          const char *app_id) {
+  AppStats *app_stats;
+
+  g_return_if_fail(stats != NULL);
+  g_return_if_fail(app_id != NULL);
+
+  app_stats = lookup_app_stats(stats, app_id, FALSE);
+  if (app_stats == NULL || app_stats->start_time == 0) {
+    return;
+  }
+
+  /* Only the miss is counted here. The start time is kept, so that a late
+   * registration records the real latency as the one sample of this
+   * start, and clears the miss. */
+  app_stats->misses++;
+  stats->dirty = TRUE;
+}
+
+gboolean gsm_registration_stats_never_registers(GsmRegistrationStats *stats,
+                                                const char *app_id) {
+  AppStats *app_stats;
+
+  g_return_val_if_fail(stats != NULL, FALSE);
+  g_return_val_if_fail(app_id != NULL, FALSE);
+
+  app_stats = lookup_app_stats(stats, app_id, FALSE);
+
+  return (app_stats != NULL && app_stats->misses >= MAX_MISSES);
+}
+
+static gint compare_samples(gconstpointer a, gconstpointer b) {
+  guint sample_a = *(const guint *)a;
+  guint sample_b = *(const guint *)b;
+
+  return (sample_a > sample_b) - (sample_a < sample_b);
+}
+
+/**
+ * gsm_registration_stats_get_timeout:
+ * @stats: a #GsmRegistrationStats
+ * @app_id: the app id
+ * @default_timeout: timeout to use without enough history, in milliseconds
+ *
+ * Returns how long to wait for @app_id to register, based on the latencies
+ * seen in previous sessions. The result is never longer than
+ * @default_timeout.
+ *
+ * Return value: a timeout in milliseconds
+ **/
+guint gsm_registration_stats_get_timeout(GsmRegistrationStats *stats,
+                                         const char *app_id,
+                                         guint default_timeout) {
+  AppStats *app_stats;
+  guint sorted[MAX_SAMPLES];
+  guint index;
+  guint64 timeout;
+
+  g_return_val_if_fail(stats != NULL, default_timeout);
+  g_return_val_if_fail(app_id != NULL, default_timeout);
+
+  app_stats = lookup_app_stats(stats, app_id, FALSE);
+  if (app_stats == NULL || app_stats->n_samples < MIN_SAMPLES) {
+    return default_timeout;
+  }
+
+  memcpy(sorted, app_stats->samples, app_stats->n_samples * sizeof(guint));
+  qsort(sorted, app_stats->n_samples, sizeof(guint), compare_samples);
+
+  /* nearest-rank 99th percentile */
+  index = (app_stats->n_samples * 99 + 99) / 100 - 1;
+  timeout = (guint64)sorted[index] * TIMEOUT_FACTOR;
+
+  return (guint)CLAMP(timeout, MIN(MIN_TIMEOUT, default_timeout),
+                      default_timeout);
+}
@@ -0,0 +1,50 @@
+/* gsm-registration-stats.h
+ * Copyright (C) 2012-2021 MATE Developers
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+#ifndef __GSM_REGISTRATION_STATS_H__
+#define __GSM_REGISTRATION_STATS_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+typedef struct _GsmRegistrationStats GsmRegistrationStats;
+
+GsmRegistrationStats *gsm_registration_stats_load(void);
+void gsm_registration_stats_save(GsmRegistrationStats *stats);
+void gsm_registration_stats_free(GsmRegistrationStats *stats);
+
+void gsm_registration_stats_app_started(GsmRegistrationStats *stats,
+                                        const char *app_id);
+void gsm_registration_stats_app_registered(GsmRegistrationStats *stats,
+                                           const char *app_id);
+void gsm_registration_stats_app_timed_out(GsmRegistrationStats *stats,
+                                          const char *app_id);
+void gsm_registration_stats_app_exited(GsmRegistrationStats *stats,
+                                       const char *app_id);
+
+gboolean gsm_registration_stats_never_registers(GsmRegistrationStats *stats,
+                                                const char *app_id);
+guint gsm_registration_stats_get_timeout(GsmRegistrationStats *stats,
+                                         const char *app_id,
+                                         guint default_timeout);
+
+G_END_DECLS
+
+#endif /* __GSM_REGISTRATION_STATS_H__ */
@@ -0,0 +1,291 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*-
+ * gsm-session-plan.c
+ * Copyright (C) 2012-2021 MATE Developers
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include "gsm-session-plan.h"
+
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <string.h>
+
+#include "gsm-util.h"
+
+/* A session plan is the ordered list of .desktop files (and the required
+ * component each one provides) that resolving the autostart directories
+ * and the session settings produced. Replaying it feeds exactly the same
+ * calls to gsm_manager_add_autostart_app(), without the directory scans
+ * and desktop file lookups. The fingerprint identifies the inputs the plan
+ * was resolved from; a plan is only loaded if it still matches. */
+
+#define PLAN_FILENAME "session-plan"
+#define PLAN_GROUP "Session Plan"
+#define KEY_FINGERPRINT "Fingerprint"
+#define KEY_LENGTH "Length"
+#define APP_GROUP_PREFIX "App "
+#define KEY_PATH "Path"
+#define KEY_PROVIDES "Provides"
+
+typedef struct {
+  char *path;
+  char *provides;
+} PlanEntry;
+
+struct _GsmSessionPlan {
+  char *fingerprint;
+  GPtrArray *entries;
+};
+
+static void plan_entry_free(PlanEntry *entry) {
+  g_free(entry->path);
+  g_free(entry->provides);
+  g_free(entry);
+}
+
+static char *get_plan_filename(void) {
+  return g_build_filename(g_get_user_cache_dir(), "mate-session",
+                          PLAN_FILENAME, NULL);
+}
+
+GsmSessionPlan *gsm_session_plan_new(const char *fingerprint) {
+  GsmSessionPlan *plan;
+
+  g_return_val_if_fail(fingerprint != NULL, NULL);
+
+  plan = g_new0(GsmSessionPlan, 1);
+  plan->fingerprint = g_strdup(fingerprint);
+  plan->entries = g_ptr_array_new_with_free_func((GDestroyNotify)plan_entry_free);
+
+  return plan;
+}
+
+void gsm_session_plan_free(GsmSessionPlan *plan) {
+  if (plan == NULL) {
+    return;
+  }
+
+  g_ptr_array_free(plan->entries, TRUE);
+  g_free(plan->fingerprint);
+  g_free(plan);
+}
+
+const char *gsm_session_plan_peek_fingerprint(GsmSessionPlan *plan) {
+  g_return_val_if_fail(plan != NULL, NULL);
+
+  return plan->fingerprint;
+}
+
+void gsm_session_plan_add_app(GsmSessionPlan *plan, const char *path,
+                              const char *provides) {
+  PlanEntry *entry;
+
+  g_return_if_fail(plan != NULL);
+  g_return_if_fail(path != NULL);
+
+  entry = g_new0(PlanEntry, 1);
+  entry->path = g_strdup(path);
+  entry->provides = g_strdup(provides);
+
+  g_ptr_array_add(plan->entries, entry);
+}
+
+gboolean gsm_session_plan_add_apps_from_dir(GsmSessionPlan *plan,
+                                            const char *path) {
+  GDir *dir;
+  const char *name;
+
+  g_return_val_if_fail(plan != NULL, FALSE);
+  g_return_val_if_fail(path != NULL, FALSE);
+
+  g_debug("GsmSessionPlan: *** Adding autostart apps for %s", path);
+
+  dir = g_dir_open(path, 0, NULL);
+  if (dir == NULL) {
+    return FALSE;
+  }
+
+  while ((name = g_dir_read_name(dir))) {
+    char *desktop_file;
+
+    if (!g_str_has_suffix(name, ".desktop")) {
+      continue;
+    }
+
+    desktop_file = g_build_filename(path, name, NULL);
+    gsm_session_plan_add_app(plan, desktop_file, NULL);
+    g_free(desktop_file);
+  }
+
+  g_dir_close(dir);
+
+  return TRUE;
+}
+
+/**
+ * gsm_session_plan_load:
+ * @fingerprint: fingerprint of the current session inputs
+ *
+ * Loads the plan saved by a previous session.
+ *
+ * Return value: the saved plan, or %NULL if there is none or if it was
+ * resolved from inputs other than @fingerprint.
+ **/
+GsmSessionPlan *gsm_session_plan_load(const char *fingerprint) {
+  GsmSessionPlan *plan;
+  GKeyFile *keyfile;
+  char *filename;
+  char *saved_fingerprint;
+  int length;
+  int i;
+
+  g_return_val_if_fail(fingerprint != NULL, NULL);
+
+  plan = NULL;
+  saved_fingerprint = NULL;
+
+  filename = get_plan_filename();
+  keyfile = g_key_file_new();
+  if (!g_key_file_load_from_file(keyfile, filename, G_KEY_FILE_NONE, NULL)) {
+    goto out;
+  }
+
+  saved_fingerprint =
+      g_key_file_get_string(keyfile, PLAN_GROUP, KEY_FINGERPRINT, NULL);
+  if (g_strcmp0(saved_fingerprint, fingerprint) != 0) {
+    g_debug("GsmSessionPlan: saved plan is out of date");
+    goto out;
+  }
+
+  length = g_key_file_get_integer(keyfile, PLAN_GROUP, KEY_LENGTH, NULL);
+
+  plan = gsm_session_plan_new(fingerprint);
+  for (i = 0; i < length; i++) {
+    char *group;
+    char *path;
+    char *provides;
+
+    group = g_strdup_printf(APP_GROUP_PREFIX "%d", i);
+    path = g_key_file_get_string(keyfile, group, KEY_PATH, NULL);
+    provides = g_key_file_get_string(keyfile, group, KEY_PROVIDES, NULL);
+    g_free(group);
+
+    if (path == NULL) {
+      g_warning("GsmSessionPlan: saved plan is corrupted");
+      g_free(provides);
+      gsm_session_plan_free(plan);
+      plan = NULL;
+      goto out;
+    }
+
+    gsm_session_plan_add_app(plan, path,
+                             IS_STRING_EMPTY(provides) ? NULL : provides);
+    g_free(path);
+    g_free(provides);
+  }
+
+out:
+  g_free(saved_fingerprint);
+  g_key_file_free(keyfile);
+  g_free(filename);
+
+  return plan;
+}
+
+gboolean gsm_session_plan_save(GsmSessionPlan *plan, GError **error) {
+  GKeyFile *keyfile;
+  char *filename;
+  char *dirname;
+  char *contents;
+  gsize length;
+  gboolean ret;
+  guint i;
+
+  g_return_val_if_fail(plan != NULL, FALSE);
+
+  keyfile = g_key_file_new();
+  g_key_file_set_string(keyfile, PLAN_GROUP, KEY_FINGERPRINT,
+                        plan->fingerprint);
+  g_key_file_set_integer(keyfile, PLAN_GROUP, KEY_LENGTH, plan->entries->len);
+
+  for (i = 0; i < plan->entries->len; i++) {
+    PlanEntry *entry = g_ptr_array_index(plan->entries, i);
+    char *group;
+
+    group = g_strdup_printf(APP_GROUP_PREFIX "%u", i);
+    g_key_file_set_string(keyfile, group, KEY_PATH, entry->path);
+    if (entry->provides != NULL) {
+      g_key_file_set_string(keyfile, group, KEY_PROVIDES, entry->provides);
+    }
+    g_free(group);
+  }
+
+  contents = g_key_file_to_data(keyfile, &length, NULL);
+  g_key_file_free(keyfile);
+
+  filename = get_plan_filename();
+  dirname = g_path_get_dirname(filename);
+  g_mkdir_with_parents(dirname, 0755);
+  g_free(dirname);
+
+  ret = g_file_set_contents(filename, contents, length, error);
+
+  g_free(filename);
+  g_free(contents);
+
+  return ret;
+}
+
+gboolean gsm_session_plan_equal(GsmSessionPlan *a, GsmSessionPlan *b) {
+  guint i;
+
+  g_return_val_if_fail(a != NULL, FALSE);
+  g_return_val_if_fail(b != NULL, FALSE);
+
+  if (a->entries->len != b->entries->len) {
+    return FALSE;
+  }
+
+  for (i = 0; i < a->entries->len; i++) {
+    PlanEntry *entry_a = g_ptr_array_index(a->entries, i);
+    PlanEntry *entry_b = g_ptr_array_index(b->entries, i);
+
+    if (strcmp(entry_a->path, entry_b->path) != 0 ||
+        g_strcmp0(entry_a->provides, entry_b->provides) != 0) {
+      return FALSE;
+    }
+  }
+
+  return TRUE;
+}
+
+void gsm_session_plan_replay(GsmSessionPlan *plan, GsmManager *manager) {
+  guint i;
+
+  g_return_if_fail(plan != NULL);
+  g_return_if_fail(GSM_IS_MANAGER(manager));
+
+  for (i = 0; i < plan->entries->len; i++) {
+    PlanEntry *entry = g_ptr_array_index(plan->entries, i);
+
+    gsm_manager_add_autostart_app(manager, entry->path, entry->provides);
+  }
+}
@@ -0,0 +1,48 @@
+/* gsm-session-plan.h
+ * Copyright (C) 2012-2021 MATE Developers
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+#ifndef __GSM_SESSION_PLAN_H__
+#define __GSM_SESSION_PLAN_H__
+
+#include <glib.h>
+
+#include "gsm-manager.h"
+
+G_BEGIN_DECLS
+
+typedef struct _GsmSessionPlan GsmSessionPlan;
+
+GsmSessionPlan *gsm_session_plan_new(const char *fingerprint);
+GsmSessionPlan *gsm_session_plan_load(const char *fingerprint);
+gboolean gsm_session_plan_save(GsmSessionPlan *plan, GError **error);
+void gsm_session_plan_free(GsmSessionPlan *plan);
+
+const char *gsm_session_plan_peek_fingerprint(GsmSessionPlan *plan);
+
+void gsm_session_plan_add_app(GsmSessionPlan *plan, const char *path,
+                              const char *provides);
+gboolean gsm_session_plan_add_apps_from_dir(GsmSessionPlan *plan,
+                                            const char *path);
+
+gboolean gsm_session_plan_equal(GsmSessionPlan *a, GsmSessionPlan *b);
+void gsm_session_plan_replay(GsmSessionPlan *plan, GsmManager *manager);
+
+G_END_DECLS
+
+#endif /* __GSM_SESSION_PLAN_H__ */
@@ -27,11 +27,30 @@
 
 #include <glib.h>
 #include <glib/gstdio.h>
+#include <string.h>
 
 #include "gsm-autostart-app.h"
 #include "gsm-client.h"
 #include "gsm-util.h"
 
+/* Discard commands of the clients dropped from the saved session run
+ * after the new session is committed, at most MAX_DISCARD_JOBS at a time,
+ * so that ending the session doesn't wait on a burst of forks. */
+#define MAX_DISCARD_JOBS 4
+
+typedef struct {
+  char *client_id;
+  char *command;
+  char **argv;
+  GPid pid;
+} DiscardJob;
+
+static GQueue discard_queue = G_QUEUE_INIT;
+/* commands queued or running, so that each one runs once */
+static GHashTable *pending_discards = NULL;
+static guint n_running_discards = 0;
+static guint discard_idle_id = 0;
+
 static gboolean gsm_session_clear_saved_session(const char *directory,
                                                 GHashTable *discard_hash);
 
@@ -98,7 +117,6 @@ out:
   /* in case of any error, stop saving session */
   if (local_error) {
     g_propagate_error(data->error, local_error);
-    g_error_free(local_error);
 
     return TRUE;
   }
@@ -106,6 +124,176 @@ out:
   return FALSE;
 }
 
+static char *load_discard_command(const char *filename) {
+  GKeyFile *key_file;
+  char *discard_exec;
+
+  key_file = g_key_file_new();
+  if (!g_key_file_load_from_file(key_file, filename, G_KEY_FILE_NONE, NULL)) {
+    g_key_file_free(key_file);
+    return NULL;
+  }
+
+  discard_exec = g_key_file_get_string(key_file, G_KEY_FILE_DESKTOP_GROUP,
+                                       GSM_AUTOSTART_APP_DISCARD_KEY, NULL);
+  g_key_file_free(key_file);
+
+  return discard_exec;
+}
+
+static GHashTable *collect_discard_commands(const char *directory) {
+  GHashTable *discard_hash;
+  GDir *dir;
+  const char *filename;
+
+  discard_hash = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+
+  dir = g_dir_open(directory, 0, NULL);
+  if (dir == NULL) {
+    return discard_hash;
+  }
+
+  while ((filename = g_dir_read_name(dir))) {
+    char *path;
+    char *discard_exec;
+
+    path = g_build_filename(directory, filename, NULL);
+    discard_exec = load_discard_command(path);
+    if (discard_exec) {
+      g_hash_table_insert(discard_hash, discard_exec, discard_exec);
+    }
+    g_free(path);
+  }
+
+  g_dir_close(dir);
+
+  return discard_hash;
+}
+
+static void discard_job_free(DiscardJob *job) {
+  g_free(job->client_id);
+  g_free(job->command);
+  g_strfreev(job->argv);
+  g_free(job);
+}
+
+static void run_discard_jobs(void);
+
+static void on_discard_job_exited(GPid pid, gint status, DiscardJob *job) {
+  GError *error = NULL;
+
+  if (g_spawn_check_exit_status(status, &error)) {
+    g_debug("GsmSessionSave: discard command of client %s succeeded",
+            job->client_id);
+  } else {
+    g_debug("GsmSessionSave: discard command of client %s failed: %s",
+            job->client_id, error->message);
+    g_error_free(error);
+  }
+
+  g_spawn_close_pid(pid);
+
+  g_hash_table_remove(pending_discards, job->command);
+  discard_job_free(job);
+
+  n_running_discards--;
+  run_discard_jobs();
+}
+
+static gboolean spawn_discard_job(DiscardJob *job, GSpawnFlags flags) {
+  GError *error = NULL;
+
+  if (!g_spawn_async(NULL, job->argv, NULL, G_SPAWN_SEARCH_PATH | flags, NULL,
+                     NULL, &job->pid, &error)) {
+    g_warning("GsmSessionSave: unable to run discard command of client %s: %s",
+              job->client_id, error->message);
+    g_error_free(error);
+    return FALSE;
+  }
+
+  g_debug("GsmSessionSave: running discard command of client %s",
+          job->client_id);
+
+  return TRUE;
+}
+
+static void run_discard_jobs(void) {
+  while (n_running_discards < MAX_DISCARD_JOBS &&
+         !g_queue_is_empty(&discard_queue)) {
+    DiscardJob *job = g_queue_pop_head(&discard_queue);
+
+    if (!spawn_discard_job(job, G_SPAWN_DO_NOT_REAP_CHILD)) {
+      g_hash_table_remove(pending_discards, job->command);
+      discard_job_free(job);
+      continue;
+    }
+
+    n_running_discards++;
+    g_child_watch_add(job->pid, (GChildWatchFunc)on_discard_job_exited, job);
+  }
+}
+
+static gboolean on_discard_idle(gpointer data) {
+  discard_idle_id = 0;
+  run_discard_jobs();
+
+  return FALSE;
+}
+
+static gboolean queue_discard_command(const char *client_id,
+                                      const char *discard_exec) {
+  DiscardJob *job;
+  char **argv;
+
+  if (pending_discards == NULL) {
+    pending_discards = g_hash_table_new(g_str_hash, g_str_equal);
+  }
+
+  if (g_hash_table_contains(pending_discards, discard_exec)) {
+    return TRUE;
+  }
+
+  if (!g_shell_parse_argv(discard_exec, NULL, &argv, NULL)) {
+    return FALSE;
+  }
+
+  job = g_new0(DiscardJob, 1);
+  job->client_id = g_strdup(client_id);
+  job->command = g_strdup(discard_exec);
+  job->argv = argv;
+
+  g_hash_table_add(pending_discards, job->command);
+  g_queue_push_tail(&discard_queue, job);
+
+  if (discard_idle_id == 0) {
+    discard_idle_id = g_idle_add(on_discard_idle, NULL);
+  }
+
+  return TRUE;
+}
+
+/**
+ * gsm_session_save_flush_discards:
+ *
+ * Starts the discard commands that are still queued, without limiting
+ * how many run at once. Meant to be called when the session manager is
+ * about to exit, since the queue would otherwise be lost.
+ **/
+void gsm_session_save_flush_discards(void) {
+  DiscardJob *job;
+
+  if (discard_idle_id > 0) {
+    g_source_remove(discard_idle_id);
+    discard_idle_id = 0;
+  }
+
+  while ((job = g_queue_pop_head(&discard_queue)) != NULL) {
+    spawn_discard_job(job, 0);
+    g_hash_table_remove(pending_discards, job->command);
+    discard_job_free(job);
+  }
+}
+
 void gsm_session_save(GsmStore *client_store, GError **error) {
   const char *save_dir;
   char *tmp_dir;
@@ -142,10 +330,13 @@ void gsm_session_save(GsmStore *client_store, GError **error) {
     if (g_file_test(save_dir, G_FILE_TEST_IS_DIR)) g_rmdir(save_dir);
     g_rename(tmp_dir, save_dir);
   } else {
+    GHashTable *saved_discard_hash;
+
     g_warning("GsmSessionSave: error saving session: %s", (*error)->message);
-    /* FIXME: we should create a hash table filled with the discard
-     * commands that are in desktop files from save_dir. */
-    gsm_session_clear_saved_session(tmp_dir, NULL);
+    /* the old saved session stays, so don't discard what it still uses */
+    saved_discard_hash = collect_discard_commands(save_dir);
+    gsm_session_clear_saved_session(tmp_dir, saved_discard_hash);
+    g_hash_table_destroy(saved_discard_hash);
     g_rmdir(tmp_dir);
   }
 
@@ -156,36 +347,27 @@ void gsm_session_save(GsmStore *client_store, GError **error) {
 static gboolean gsm_session_clear_one_client(const char *filename,
                                              GHashTable *discard_hash) {
   gboolean result = TRUE;
-  GKeyFile *key_file = NULL;
-  char *discard_exec = NULL;
+  char *discard_exec;
 
   g_debug("GsmSessionSave: removing '%s' from saved session", filename);
 
-  key_file = g_key_file_new();
-  if (g_key_file_load_from_file(key_file, filename, G_KEY_FILE_NONE, NULL)) {
-    char **argv;
-    int argc;
-
-    discard_exec = g_key_file_get_string(key_file, G_KEY_FILE_DESKTOP_GROUP,
-                                         GSM_AUTOSTART_APP_DISCARD_KEY, NULL);
-    if (!discard_exec) goto out;
-
-    if (g_hash_table_lookup(discard_hash, discard_exec)) goto out;
+  discard_exec = load_discard_command(filename);
+  if (discard_exec &&
+      (discard_hash == NULL ||
+       !g_hash_table_contains(discard_hash, discard_exec))) {
+    char *client_id;
 
-    if (!g_shell_parse_argv(discard_exec, &argc, &argv, NULL)) goto out;
+    client_id = g_path_get_basename(filename);
+    if (g_str_has_suffix(client_id, ".desktop")) {
+      client_id[strlen(client_id) - strlen(".desktop")] = '\0';
+    }
 
-    result = g_spawn_async(NULL, argv, NULL, G_SPAWN_SEARCH_PATH, NULL, NULL,
-                           NULL, NULL) &&
-             result;
+    result = queue_discard_command(client_id, discard_exec);
 
-    g_strfreev(argv);
-  } else {
-    result = FALSE;
+    g_free(client_id);
   }
 
-out:
-  if (key_file) g_key_file_free(key_file);
-  if (discard_exec) g_free(discard_exec);
+  g_free(discard_exec);
 
   result = (g_unlink(filename) == 0) && result;
 
@@ -34,17 +34,39 @@
 #include <string.h>
 #include <unistd.h>
 
+#include "gsm-util.h"
+
+/* Objects are keyed by their interned id, so keys are compared by
+ * pointer and are shared with the objects and the signals */
 typedef struct {
   GHashTable *objects;
   gboolean locked;
+
+  /* Sequence number of the last change, and a log of the latest
+   * changes, oldest first.  Changes up to log_floor have been dropped
+   * from the log. */
+  guint64 sequence;
+  GQueue change_log;
+  guint change_log_size;
+  guint64 log_floor;
 } GsmStorePrivate;
 
+typedef struct {
+  guint64 sequence;
+  const char *id; /* interned */
+  gboolean added;
+} GsmStoreChange;
+
 enum { ADDED, REMOVED, LAST_SIGNAL };
 
 enum { PROP_0, PROP_LOCKED };
 
 static guint signals[LAST_SIGNAL] = {0};
 
+/* Shared by all stores, so that the changes of different stores can be
+ * put in order */
+static guint64 last_sequence = 0;
+
 static void gsm_store_finalize(GObject *object);
 
 G_DEFINE_TYPE_WITH_PRIVATE(GsmStore, gsm_store, G_TYPE_OBJECT)
@@ -64,31 +86,132 @@ guint gsm_store_size(GsmStore *store) {
   return g_hash_table_size(priv->objects);
 }
 
+static void change_free(GsmStoreChange *change) {
+  gsm_util_release_id(change->id);
+  g_free(change);
+}
+
+static void drop_oldest_changes(GsmStorePrivate *priv, guint keep) {
+  while (priv->change_log.length > keep) {
+    GsmStoreChange *change;
+
+    change = g_queue_pop_head(&priv->change_log);
+    priv->log_floor = change->sequence;
+    change_free(change);
+  }
+}
+
+static void record_change(GsmStore *store, const char *id, gboolean added) {
+  GsmStorePrivate *priv;
+  GsmStoreChange *change;
+
+  priv = gsm_store_get_instance_private(store);
+
+  priv->sequence = ++last_sequence;
+
+  if (priv->change_log_size == 0) {
+    priv->log_floor = priv->sequence;
+    return;
+  }
+
+  change = g_new(GsmStoreChange, 1);
+  change->sequence = priv->sequence;
+  change->id = gsm_util_intern_id(id);
+  change->added = added;
+  g_queue_push_tail(&priv->change_log, change);
+
+  drop_oldest_changes(priv, priv->change_log_size);
+}
+
+guint64 gsm_store_get_sequence(GsmStore *store) {
+  GsmStorePrivate *priv;
+
+  g_return_val_if_fail(GSM_IS_STORE(store), 0);
+  priv = gsm_store_get_instance_private(store);
+
+  return priv->sequence;
+}
+
+/* Keep the last @size changes, so that gsm_store_foreach_change() can
+ * replay them; the default of 0 keeps none */
+void gsm_store_set_change_log_size(GsmStore *store, guint size) {
+  GsmStorePrivate *priv;
+
+  g_return_if_fail(GSM_IS_STORE(store));
+  priv = gsm_store_get_instance_private(store);
+
+  priv->change_log_size = size;
+  drop_oldest_changes(priv, size);
+}
+
+/* Calls @func for each change after @since, oldest first.  Returns
+ * FALSE, without calling @func, if some of these changes are no longer
+ * in the log. */
+gboolean gsm_store_foreach_change(GsmStore *store, guint64 since,
+                                  GsmStoreChangeFunc func,
+                                  gpointer user_data) {
+  GsmStorePrivate *priv;
+  GList *l;
+
+  g_return_val_if_fail(GSM_IS_STORE(store), FALSE);
+  g_return_val_if_fail(func != NULL, FALSE);
+  priv = gsm_store_get_instance_private(store);
+
+  if (since < priv->log_floor) {
+    return FALSE;
+  }
+
+  /* the newest changes are the ones usually asked for */
+  for (l = priv->change_log.tail; l != NULL; l = l->prev) {
+    GsmStoreChange *change = l->data;
+
+    if (change->sequence <= since) {
+      break;
+    }
+  }
+
+  for (l = l != NULL ? l->next : priv->change_log.head; l != NULL;
+       l = l->next) {
+    GsmStoreChange *change = l->data;
+
+    func(change->sequence, change->id, change->added, user_data);
+  }
+
+  return TRUE;
+}
+
 gboolean gsm_store_remove(GsmStore *store, const char *id) {
   GObject *found;
   gboolean removed;
-  char *id_copy;
+  const char *key;
   GsmStorePrivate *priv;
 
   g_return_val_if_fail(store != NULL, FALSE);
 
   priv = gsm_store_get_instance_private(store);
-  found = g_hash_table_lookup(priv->objects, id);
+  key = gsm_util_peek_interned_id(id);
+  if (key == NULL) {
+    return FALSE;
+  }
+
+  found = g_hash_table_lookup(priv->objects, key);
   if (found == NULL) {
     return FALSE;
   }
 
-  id_copy = g_strdup(id);
+  /* keep the id alive for the signal */
+  key = gsm_util_intern_id(key);
 
   g_object_ref(found);
 
-  removed = g_hash_table_remove(priv->objects, id_copy);
+  removed = g_hash_table_remove(priv->objects, key);
   g_assert(removed);
 
-  g_signal_emit(store, signals[REMOVED], 0, id_copy);
+  record_change(store, key, FALSE);
+  g_signal_emit(store, signals[REMOVED], 0, key);
 
   g_object_unref(found);
-  g_free(id_copy);
+  gsm_util_release_id(key);
 
   return TRUE;
 }
@@ -123,6 +246,11 @@ GObject *gsm_store_lookup(GsmStore *store, const char *id) {
   g_return_val_if_fail(id != NULL, NULL);
   priv = gsm_store_get_instance_private(store);
 
+  id = gsm_util_peek_interned_id(id);
+  if (id == NULL) {
+    return NULL;
+  }
+
   object = g_hash_table_lookup(priv->objects, id);
 
   return object;
@@ -141,7 +269,8 @@ static gboolean foreach_remove_wrapper(const char *id, GObject *object,
 
   res = (data->func)(id, object, data->user_data);
   if (res) {
-    data->removed = g_list_prepend(data->removed, g_strdup(id));
+    data->removed =
+        g_list_prepend(data->removed, (char *)gsm_util_intern_id(id));
   }
 
   return res;
@@ -166,11 +295,12 @@ guint gsm_store_foreach_remove(GsmStore *store, GsmStoreFunc func,
                                     (GHRFunc)foreach_remove_wrapper, &data);
 
   while (data.removed != NULL) {
-    char *id;
+    const char *id;
     id = data.removed->data;
     g_debug("GsmStore: emitting removed for %s", id);
+    record_change(store, id, FALSE);
     g_signal_emit(store, signals[REMOVED], 0, id);
-    g_free(data.removed->data);
+    gsm_util_release_id(id);
     data.removed->data = NULL;
     data.removed = g_list_delete_link(data.removed, data.removed);
   }
@@ -206,8 +336,11 @@ gboolean gsm_store_add(GsmStore *store, const char *id, GObject *object) {
 
   g_debug("GsmStore: Adding object id %s to store", id);
 
-  g_hash_table_insert(priv->objects, g_strdup(id), g_object_ref(object));
+  /* if the id is already there, the extra reference is dropped at once */
+  id = gsm_util_intern_id(id);
+  g_hash_table_insert(priv->objects, (char *)id, g_object_ref(object));
 
+  record_change(store, id, TRUE);
   g_signal_emit(store, signals[ADDED], 0, id);
 
   return TRUE;
@@ -287,11 +420,13 @@ static void gsm_store_class_init(GsmStoreClass *klass) {
   signals[ADDED] = g_signal_new(
       "added", G_TYPE_FROM_CLASS(object_class), G_SIGNAL_RUN_LAST,
       G_STRUCT_OFFSET(GsmStoreClass, added), NULL, NULL,
-      g_cclosure_marshal_VOID__STRING, G_TYPE_NONE, 1, G_TYPE_STRING);
+      g_cclosure_marshal_VOID__STRING, G_TYPE_NONE, 1,
+      G_TYPE_STRING | G_SIGNAL_TYPE_STATIC_SCOPE);
   signals[REMOVED] = g_signal_new(
       "removed", G_TYPE_FROM_CLASS(object_class), G_SIGNAL_RUN_LAST,
       G_STRUCT_OFFSET(GsmStoreClass, removed), NULL, NULL,
-      g_cclosure_marshal_VOID__STRING, G_TYPE_NONE, 1, G_TYPE_STRING);
+      g_cclosure_marshal_VOID__STRING, G_TYPE_NONE, 1,
+      G_TYPE_STRING | G_SIGNAL_TYPE_STATIC_SCOPE);
   g_object_class_install_property(
       object_class, PROP_LOCKED,
       g_param_spec_boolean("locked", NULL, NULL, FALSE,
@@ -307,8 +442,9 @@ static void gsm_store_init(GsmStore *store) {
   GsmStorePrivate *priv;
   priv = gsm_store_get_instance_private(store);
 
-  priv->objects = g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
-                                        (GDestroyNotify)_destroy_object);
+  priv->objects = g_hash_table_new_full(
+      g_direct_hash, g_direct_equal, (GDestroyNotify)gsm_util_release_id,
+      (GDestroyNotify)_destroy_object);
 }
 
 static void gsm_store_finalize(GObject *object) {
@@ -324,6 +460,7 @@ static void gsm_store_finalize(GObject *object) {
   g_return_if_fail(priv != NULL);
 
   g_hash_table_destroy(priv->objects);
+  g_queue_clear_full(&priv->change_log, (GDestroyNotify)change_free);
 
   G_OBJECT_CLASS(gsm_store_parent_class)->finalize(object);
 }
@@ -43,6 +43,8 @@ typedef enum { GSM_STORE_ERROR_GENERAL } GsmStoreError;
 
 typedef gboolean (*GsmStoreFunc)(const char *id, GObject *object,
                                  gpointer user_data);
+typedef void (*GsmStoreChangeFunc)(guint64 sequence, const char *id,
+                                   gboolean added, gpointer user_data);
 
 GQuark gsm_store_error_quark(void);
 
@@ -63,6 +65,11 @@ GObject *gsm_store_find(GsmStore *store, GsmStoreFunc predicate,
                         gpointer user_data);
 GObject *gsm_store_lookup(GsmStore *store, const char *id);
 
+guint64 gsm_store_get_sequence(GsmStore *store);
+void gsm_store_set_change_log_size(GsmStore *store, guint size);
+gboolean gsm_store_foreach_change(GsmStore *store, guint64 since,
+                                  GsmStoreChangeFunc func, gpointer user_data);
+
 G_END_DECLS
 
 #endif /* __GSM_STORE_H */
@@ -61,7 +61,7 @@ gchar **gsm_get_screen_locker_command(void) {
   return screen_locker_argv;
 }
 
-static char **gsm_util_get_app_dirs() {
+char **gsm_util_get_app_dirs() {
   GPtrArray *dirs;
   const char *const *system_data_dirs;
   int i;
@@ -405,74 +405,221 @@ char *gsm_util_generate_startup_id(void) {
                          (unsigned long)pid, sequence);
 }
 
-static gboolean gsm_util_update_activation_environment(const char *variable,
-                                                       const char *value,
-                                                       GError **error) {
-  GDBusConnection *connection;
-  gboolean environment_updated;
-  GVariantBuilder builder;
+/* Environment changes are sent to the bus (and to systemd) in batches.
+ * Between gsm_util_environment_begin() and gsm_util_environment_commit(),
+ * gsm_util_setenv() and the export functions only queue the variables, and
+ * the commit sends all of them in a single message to each. The messages
+ * are sent asynchronously on the shared session bus connection, which
+ * keeps them ordered before any activation request we send afterwards. */
+static guint environment_depth = 0;
+static GHashTable *pending_activation_environment = NULL;
+#ifdef HAVE_SYSTEMD
+static GHashTable *pending_user_environment = NULL;
+#endif
+
+static GRegex *name_regex = NULL;
+static GRegex *value_regex = NULL;
+#ifdef HAVE_SYSTEMD
+static GRegex *entry_regex = NULL;
+#endif
+
+static GRegex *get_regex(GRegex **regex, const char *pattern,
+                         GError **error) {
+  if (*regex == NULL) {
+    *regex = g_regex_new(pattern, G_REGEX_OPTIMIZE, 0, error);
+  }
+
+  return *regex;
+}
+
+static void queue_variable(GHashTable **pending, const char *variable,
+                           const char *value) {
+  if (*pending == NULL) {
+    *pending = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+  }
+
+  g_hash_table_insert(*pending, g_strdup(variable), g_strdup(value));
+}
+
+static void on_activation_environment_updated(GObject *source,
+                                              GAsyncResult *result,
+                                              gpointer data) {
   GVariant *reply;
-  GError *bus_error = NULL;
+  GError *error = NULL;
 
-  environment_updated = FALSE;
-  connection = g_bus_get_sync(G_BUS_TYPE_SESSION, NULL, error);
+  reply = g_dbus_connection_call_finish(G_DBUS_CONNECTION(source), result,
+                                        &error);
 
-  if (connection == NULL) {
-    return FALSE;
+  /* If this fails it isn't fatal, it means some things like session
+   * management and keyring won't work in activated clients.
+   */
+  if (reply == NULL) {
+    g_warning(
+        "Could not make bus activated clients aware of the session "
+        "environment: %s",
+        error->message);
+    g_error_free(error);
+    return;
   }
 
+  g_variant_unref(reply);
+}
+
+static void flush_activation_environment(GDBusConnection *connection) {
+  GVariantBuilder builder;
+  GHashTableIter iter;
+  gpointer variable, value;
+
   g_variant_builder_init(&builder, G_VARIANT_TYPE("a{ss}"));
-  g_variant_builder_add(&builder, "{ss}", variable, value);
 
-  reply = g_dbus_connection_call_sync(
+  g_hash_table_iter_init(&iter, pending_activation_environment);
+  while (g_hash_table_iter_next(&iter, &variable, &value)) {
+    g_variant_builder_add(&builder, "{ss}", variable, value);
+  }
+
+  g_debug("GsmUtil: updating activation environment with %u variables",
+          g_hash_table_size(pending_activation_environment));
+
+  g_dbus_connection_call(
       connection, "org.freedesktop.DBus", "/org/freedesktop/DBus",
       "org.freedesktop.DBus", "UpdateActivationEnvironment",
       g_variant_new("(@a{ss})", g_variant_builder_end(&builder)), NULL,
-      G_DBUS_CALL_FLAGS_NONE, -1, NULL, &bus_error);
+      G_DBUS_CALL_FLAGS_NONE, -1, NULL, on_activation_environment_updated,
+      NULL);
+}
 
-  if (bus_error != NULL) {
-    g_propagate_error(error, bus_error);
-  } else {
-    environment_updated = TRUE;
-    g_variant_unref(reply);
+#ifdef HAVE_SYSTEMD
+static void on_user_environment_updated(GObject *source, GAsyncResult *result,
+                                        gpointer data) {
+  GVariant *reply;
+  GError *error = NULL;
+
+  reply = g_dbus_connection_call_finish(G_DBUS_CONNECTION(source), result,
+                                        &error);
+
+  /* If this fails, the system user session won't get the updated environment
+   */
+  if (reply == NULL) {
+    g_debug("Could not make systemd aware of the session environment: %s",
+            error->message);
+    g_error_free(error);
+    return;
+  }
+
+  g_variant_unref(reply);
+}
+
+static void flush_user_environment(GDBusConnection *connection) {
+  GVariantBuilder builder;
+  GHashTableIter iter;
+  gpointer variable, value;
+
+  g_variant_builder_init(&builder, G_VARIANT_TYPE("as"));
+
+  g_hash_table_iter_init(&iter, pending_user_environment);
+  while (g_hash_table_iter_next(&iter, &variable, &value)) {
+    char *entry;
+
+    entry = g_strdup_printf("%s=%s", (char *)variable, (char *)value);
+    g_variant_builder_add(&builder, "s", entry);
+    g_free(entry);
   }
 
-  g_clear_object(&connection);
+  g_debug("GsmUtil: updating systemd environment with %u variables",
+          g_hash_table_size(pending_user_environment));
 
-  return environment_updated;
+  g_dbus_connection_call(
+      connection, "org.freedesktop.systemd1", "/org/freedesktop/systemd1",
+      "org.freedesktop.systemd1.Manager", "SetEnvironment",
+      g_variant_new("(@as)", g_variant_builder_end(&builder)), NULL,
+      G_DBUS_CALL_FLAGS_NONE, -1, NULL, on_user_environment_updated, NULL);
 }
+#endif
 
-gboolean gsm_util_export_activation_environment(GError **error) {
+/**
+ * gsm_util_environment_begin:
+ *
+ * Starts batching environment changes: until the matching
+ * gsm_util_environment_commit(), variables set with gsm_util_setenv() or
+ * exported with the export functions are only sent to the bus on commit.
+ * Calls can be nested.
+ **/
+void gsm_util_environment_begin(void) { environment_depth++; }
+
+/**
+ * gsm_util_environment_commit:
+ *
+ * Ends a batch started with gsm_util_environment_begin(). When the
+ * outermost batch ends, the queued variables are sent in one
+ * UpdateActivationEnvironment call, and one systemd SetEnvironment call.
+ * The calls are asynchronous; failures are only logged.
+ **/
+void gsm_util_environment_commit(void) {
   GDBusConnection *connection;
-  gboolean environment_updated = FALSE;
-  char **entry_names;
-  int i = 0;
-  GVariantBuilder builder;
-  GRegex *name_regex, *value_regex;
-  GVariant *reply;
-  GError *bus_error = NULL;
+  GError *error = NULL;
 
-  connection = g_bus_get_sync(G_BUS_TYPE_SESSION, NULL, error);
+  g_return_if_fail(environment_depth > 0);
+
+  if (--environment_depth > 0) {
+    return;
+  }
+
+  if (pending_activation_environment == NULL
+#ifdef HAVE_SYSTEMD
+      && pending_user_environment == NULL
+#endif
+  ) {
+    return;
+  }
+
+  connection = g_bus_get_sync(G_BUS_TYPE_SESSION, NULL, &error);
 
   if (connection == NULL) {
-    return FALSE;
+    g_warning("Could not export the session environment: %s", error->message);
+    g_error_free(error);
+  } else {
+    if (pending_activation_environment != NULL) {
+      flush_activation_environment(connection);
+    }
+#ifdef HAVE_SYSTEMD
+    if (pending_user_environment != NULL) {
+      flush_user_environment(connection);
+    }
+#endif
+    g_object_unref(connection);
   }
 
-  name_regex =
-      g_regex_new("^[a-zA-Z_][a-zA-Z0-9_]*$", G_REGEX_OPTIMIZE, 0, error);
+  g_clear_pointer(&pending_activation_environment, g_hash_table_destroy);
+#ifdef HAVE_SYSTEMD
+  g_clear_pointer(&pending_user_environment, g_hash_table_destroy);
+#endif
+}
+
+/**
+ * gsm_util_export_activation_environment:
+ * @error: a #GError
+ *
+ * Exports the whole environment of the session manager to bus activated
+ * clients. The update itself is asynchronous, see
+ * gsm_util_environment_commit().
+ *
+ * Return value: %FALSE if the environment could not be filtered
+ **/
+gboolean gsm_util_export_activation_environment(GError **error) {
+  char **entry_names;
+  int i = 0;
 
-  if (name_regex == NULL) {
+  if (get_regex(&name_regex, "^[a-zA-Z_][a-zA-Z0-9_]*$", error) == NULL) {
     return FALSE;
   }
 
-  value_regex =
-      g_regex_new("^([[:blank:]]|[^[:cntrl:]])*$", G_REGEX_OPTIMIZE, 0, error);
-
-  if (value_regex == NULL) {
+  if (get_regex(&value_regex, "^([[:blank:]]|[^[:cntrl:]])*$", error) ==
+      NULL) {
     return FALSE;
   }
 
-  g_variant_builder_init(&builder, G_VARIANT_TYPE("a{ss}"));
+  gsm_util_environment_begin();
+
   for (entry_names = g_listenv(); entry_names[i] != NULL; i++) {
     const char *entry_name = entry_names[i];
     const char *entry_value = g_getenv(entry_name);
@@ -485,153 +632,71 @@ gboolean gsm_util_export_activation_environment(GError **error) {
 
     if (!g_regex_match(value_regex, entry_value, 0, NULL)) continue;
 
-    g_variant_builder_add(&builder, "{ss}", entry_name, entry_value);
+    queue_variable(&pending_activation_environment, entry_name, entry_value);
   }
-  g_regex_unref(name_regex);
-  g_regex_unref(value_regex);
 
   g_strfreev(entry_names);
 
-  reply = g_dbus_connection_call_sync(
-      connection, "org.freedesktop.DBus", "/org/freedesktop/DBus",
-      "org.freedesktop.DBus", "UpdateActivationEnvironment",
-      g_variant_new("(@a{ss})", g_variant_builder_end(&builder)), NULL,
-      G_DBUS_CALL_FLAGS_NONE, -1, NULL, &bus_error);
-
-  if (bus_error != NULL) {
-    g_propagate_error(error, bus_error);
-  } else {
-    environment_updated = TRUE;
-    g_variant_unref(reply);
-  }
-
-  g_clear_object(&connection);
+  gsm_util_environment_commit();
 
-  return environment_updated;
+  return TRUE;
 }
 
 #ifdef HAVE_SYSTEMD
+/**
+ * gsm_util_export_user_environment:
+ * @error: a #GError
+ *
+ * Exports the whole environment of the session manager to the systemd
+ * user instance. The update itself is asynchronous, see
+ * gsm_util_environment_commit().
+ *
+ * Return value: %FALSE if the environment could not be filtered
+ **/
 gboolean gsm_util_export_user_environment(GError **error) {
-  GDBusConnection *connection;
-  gboolean environment_updated = FALSE;
   char **entries;
   int i = 0;
-  GVariantBuilder builder;
-  GRegex *regex;
-  GVariant *reply;
-  GError *bus_error = NULL;
 
-  connection = g_bus_get_sync(G_BUS_TYPE_SESSION, NULL, error);
-
-  if (connection == NULL) {
+  if (get_regex(&entry_regex,
+                "^[a-zA-Z_][a-zA-Z0-9_]*=([[:blank:]]|[^[:cntrl:]])*$",
+                error) == NULL) {
     return FALSE;
   }
 
-  regex = g_regex_new("^[a-zA-Z_][a-zA-Z0-9_]*=([[:blank:]]|[^[:cntrl:]])*$",
-                      G_REGEX_OPTIMIZE, 0, error);
-
-  if (regex == NULL) {
-    return FALSE;
-  }
+  gsm_util_environment_begin();
 
-  g_variant_builder_init(&builder, G_VARIANT_TYPE("as"));
   for (entries = g_get_environ(); entries[i] != NULL; i++) {
-    const char *entry = entries[i];
+    char *entry = entries[i];
+    char *separator;
 
     if (!g_utf8_validate(entry, -1, NULL)) continue;
 
-    if (!g_regex_match(regex, entry, 0, NULL)) continue;
+    if (!g_regex_match(entry_regex, entry, 0, NULL)) continue;
 
-    g_variant_builder_add(&builder, "s", entry);
+    separator = strchr(entry, '=');
+    *separator = '\0';
+    queue_variable(&pending_user_environment, entry, separator + 1);
   }
-  g_regex_unref(regex);
 
   g_strfreev(entries);
 
-  reply = g_dbus_connection_call_sync(
-      connection, "org.freedesktop.systemd1", "/org/freedesktop/systemd1",
-      "org.freedesktop.systemd1.Manager", "SetEnvironment",
-      g_variant_new("(@as)", g_variant_builder_end(&builder)), NULL,
-      G_DBUS_CALL_FLAGS_NONE, -1, NULL, &bus_error);
-
-  if (bus_error != NULL) {
-    g_propagate_error(error, bus_error);
-  } else {
-    environment_updated = TRUE;
-    g_variant_unref(reply);
-  }
-
-  g_clear_object(&connection);
-
-  return environment_updated;
-}
-
-static gboolean gsm_util_update_user_environment(const char *variable,
-                                                 const char *value,
-                                                 GError **error) {
-  GDBusConnection *connection;
-  gboolean environment_updated;
-  char *entry;
-  GVariantBuilder builder;
-  GVariant *reply;
-  GError *bus_error = NULL;
-
-  environment_updated = FALSE;
-  connection = g_bus_get_sync(G_BUS_TYPE_SESSION, NULL, error);
-
-  if (connection == NULL) {
-    return FALSE;
-  }
-
-  g_variant_builder_init(&builder, G_VARIANT_TYPE("as"));
-  entry = g_strdup_printf("%s=%s", variable, value);
-  g_variant_builder_add(&builder, "s", entry);
-  g_free(entry);
-
-  reply = g_dbus_connection_call_sync(
-      connection, "org.freedesktop.systemd1", "/org/freedesktop/systemd1",
-      "org.freedesktop.systemd1.Manager", "SetEnvironment",
-      g_variant_new("(@as)", g_variant_builder_end(&builder)), NULL,
-      G_DBUS_CALL_FLAGS_NONE, -1, NULL, &bus_error);
-
-  if (bus_error != NULL) {
-    g_propagate_error(error, bus_error);
-  } else {
-    environment_updated = TRUE;
-    g_variant_unref(reply);
-  }
-
-  g_clear_object(&connection);
+  gsm_util_environment_commit();
 
-  return environment_updated;
+  return TRUE;
 }
 #endif
 
 void gsm_util_setenv(const char *variable, const char *value) {
-  GError *error = NULL;
-
   g_setenv(variable, value, TRUE);
 
-  /* If this fails it isn't fatal, it means some things like session
-   * management and keyring won't work in activated clients.
-   */
-  if (!gsm_util_update_activation_environment(variable, value, &error)) {
-    g_warning(
-        "Could not make bus activated clients aware of %s=%s environment "
-        "variable: %s",
-        variable, value, error->message);
-    g_clear_error(&error);
-  }
+  gsm_util_environment_begin();
 
+  queue_variable(&pending_activation_environment, variable, value);
 #ifdef HAVE_SYSTEMD
-  /* If this fails, the system user session won't get the updated environment
-   */
-  if (!gsm_util_update_user_environment(variable, value, &error)) {
-    g_debug("Could not make systemd aware of %s=%s environment variable: %s",
-            variable, value, error->message);
-    g_clear_error(&error);
-  }
+  queue_variable(&pending_user_environment, variable, value);
 #endif
+
+  gsm_util_environment_commit();
 }
 
 GtkWidget *gsm_util_dialog_add_button(GtkDialog *dialog,
@@ -654,3 +719,72 @@ GtkWidget *gsm_util_dialog_add_button(GtkDialog *dialog,
 
   return button;
 }
+
+/* Ids of apps, clients and inhibitors, and the startup ids, app ids and
+ * bus names attached to them, are shared by the objects, the stores and
+ * their signals instead of being copied at each step, so that two
+ * interned ids are equal exactly when their pointers are. Object paths
+ * are never reused, so interned ids are reference counted rather than
+ * kept for the whole session. The count and the string share a single
+ * allocation. */
+typedef struct {
+  guint ref_count;
+  char id[1];
+} InternedId;
+
+static GHashTable *interned_ids = NULL; /* id -> InternedId */
+
+const char *gsm_util_intern_id(const char *id) {
+  InternedId *interned;
+  gsize len;
+
+  if (id == NULL) {
+    return NULL;
+  }
+
+  if (interned_ids == NULL) {
+    interned_ids = g_hash_table_new_full(g_str_hash, g_str_equal, NULL, g_free);
+  }
+
+  interned = g_hash_table_lookup(interned_ids, id);
+  if (interned == NULL) {
+    len = strlen(id);
+    interned = g_malloc(G_STRUCT_OFFSET(InternedId, id) + len + 1);
+    interned->ref_count = 0;
+    memcpy(interned->id, id, len + 1);
+    g_hash_table_insert(interned_ids, interned->id, interned);
+  }
+
+  interned->ref_count++;
+
+  return interned->id;
+}
+
+const char *gsm_util_peek_interned_id(const char *id) {
+  InternedId *interned;
+
+  if (id == NULL || interned_ids == NULL) {
+    return NULL;
+  }
+
+  interned = g_hash_table_lookup(interned_ids, id);
+
+  return interned != NULL ? interned->id : NULL;
+}
+
+void gsm_util_release_id(const char *id) {
+  InternedId *interned;
+
+  if (id == NULL) {
+    return;
+  }
+
+  g_return_if_fail(interned_ids != NULL);
+
+  interned = g_hash_table_lookup(interned_ids, id);
+  g_return_if_fail(interned != NULL && interned->id == id);
+
+  if (--interned->ref_count == 0) {
+    g_hash_table_remove(interned_ids, id);
+  }
+}
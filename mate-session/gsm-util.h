@@ -37,6 +37,8 @@ gchar *gsm_util_get_empty_tmp_session_dir(void);
 
 const char *gsm_util_get_saved_session_dir(void);
 
+gchar **gsm_util_get_app_dirs(void);
+
 gchar **gsm_util_get_autostart_dirs(void);
 
 gchar **gsm_util_get_desktop_dirs(void);
@@ -47,6 +49,9 @@ void gsm_util_init_error(gboolean fatal, const char *format, ...);
 
 char *gsm_util_generate_startup_id(void);
 
+void gsm_util_environment_begin(void);
+void gsm_util_environment_commit(void);
+
 gboolean gsm_util_export_activation_environment(GError **error);
 
 #ifdef HAVE_SYSTEMD
@@ -55,6 +60,14 @@ gboolean gsm_util_export_user_environment(GError **error);
 
 void gsm_util_setenv(const char *variable, const char *value);
 
+/* Returns a reference to the shared copy of @id; it must be given back
+ * with gsm_util_release_id() */
+const char *gsm_util_intern_id(const char *id);
+/* Returns the shared copy of @id, without taking a reference, or NULL if
+ * it is not interned */
+const char *gsm_util_peek_interned_id(const char *id);
+void gsm_util_release_id(const char *id);
+
 GtkWidget *gsm_util_dialog_add_button(GtkDialog *dialog,
                                       const gchar *button_text,
                                       const gchar *icon_name, gint response_id);
@@ -38,10 +38,38 @@
 #include "gsm-autostart-app.h"
 #include "gsm-manager.h"
 #include "gsm-marshal.h"
+#include "gsm-metrics.h"
 #include "gsm-util.h"
+#include "mdm-log.h"
 
 #define GsmDesktopFile "_GSM_DesktopFile"
 
+#define METRIC_XSMP_MESSAGES "mate_session_xsmp_messages_total"
+
+/* Requests we send and time until the client answers them */
+typedef enum {
+  XSMP_EXCHANGE_SAVE_YOURSELF = 0,
+  XSMP_EXCHANGE_PHASE2,
+  XSMP_EXCHANGE_INTERACT,
+  XSMP_EXCHANGE_DIE,
+  XSMP_N_EXCHANGES
+} XsmpExchange;
+
+static const char *exchange_names[XSMP_N_EXCHANGES] = {
+    "SaveYourself", "SaveYourselfPhase2", "Interact", "Die"};
+
+/* Number of protocol messages kept per client */
+#define XSMP_TRACE_LENGTH 32
+/* Bucket 0 holds replies under 1 ms, bucket n those under 2^n ms, and the
+ * last one everything slower */
+#define XSMP_LATENCY_BUCKETS 16
+
+typedef struct {
+  gint64 time;
+  const char *message;
+  gint64 latency; /* -1 if not a reply to a traced request */
+} XsmpTraceEvent;
+
 typedef struct {
   GsmClient parent;
   SmsConn conn;
@@ -50,12 +78,19 @@ typedef struct {
   guint watch_id;
 
   char *description;
-  GPtrArray *props;
+  /* SmProps as received from libSM, owned, keyed by a copy of the name */
+  GHashTable *props;
 
   /* SaveYourself state */
   int current_save_yourself;
   int next_save_yourself;
   guint next_save_yourself_allow_interact : 1;
+
+  /* Protocol trace, monotonic times in microseconds */
+  gint64 exchange_started[XSMP_N_EXCHANGES]; /* 0 if none pending */
+  guint latency_histogram[XSMP_N_EXCHANGES][XSMP_LATENCY_BUCKETS];
+  XsmpTraceEvent trace[XSMP_TRACE_LENGTH];
+  guint n_trace_events;
 } GsmXSMPClientPrivate;
 
 enum { PROP_0, PROP_ICE_CONNECTION };
@@ -64,8 +99,143 @@ enum { REGISTER_REQUEST, LOGOUT_REQUEST, LAST_SIGNAL };
 
 static guint signals[LAST_SIGNAL] = {0};
 
+/* Desktop file found for each SmProgram (NULL if none), shared by all the
+ * clients and dropped whenever one of the searched directories changes */
+static GHashTable *desktop_file_cache = NULL;
+static GList *desktop_file_monitors = NULL;
+
 G_DEFINE_TYPE_WITH_PRIVATE(GsmXSMPClient, gsm_xsmp_client, GSM_TYPE_CLIENT)
 
+static void trace_event(GsmXSMPClient *client, const char *message,
+                        gint64 now, gint64 latency) {
+  GsmXSMPClientPrivate *priv;
+  XsmpTraceEvent *event;
+
+  priv = gsm_xsmp_client_get_instance_private(client);
+
+  event = &priv->trace[priv->n_trace_events % XSMP_TRACE_LENGTH];
+  event->time = now;
+  event->message = message;
+  event->latency = latency;
+  priv->n_trace_events++;
+}
+
+static void trace_message(GsmXSMPClient *client, const char *message) {
+  trace_event(client, message, g_get_monotonic_time(), -1);
+}
+
+static void trace_request(GsmXSMPClient *client, XsmpExchange exchange) {
+  GsmXSMPClientPrivate *priv;
+  gint64 now;
+
+  priv = gsm_xsmp_client_get_instance_private(client);
+
+  now = g_get_monotonic_time();
+  priv->exchange_started[exchange] = now;
+  trace_event(client, exchange_names[exchange], now, -1);
+}
+
+static guint latency_bucket(gint64 latency) {
+  gint64 ms;
+  guint bucket;
+
+  ms = latency / 1000;
+  for (bucket = 0; ms > 0 && bucket < XSMP_LATENCY_BUCKETS - 1; bucket++) {
+    ms >>= 1;
+  }
+
+  return bucket;
+}
+
+/* Records @message, and if it answers a pending @exchange, how long the
+ * client took */
+static void trace_reply(GsmXSMPClient *client, XsmpExchange exchange,
+                        const char *message) {
+  GsmXSMPClientPrivate *priv;
+  gint64 now;
+  gint64 latency;
+
+  priv = gsm_xsmp_client_get_instance_private(client);
+
+  now = g_get_monotonic_time();
+  latency = -1;
+
+  if (priv->exchange_started[exchange] != 0) {
+    latency = now - priv->exchange_started[exchange];
+    priv->exchange_started[exchange] = 0;
+    priv->latency_histogram[exchange][latency_bucket(latency)]++;
+
+    g_debug("GsmXSMPClient: '%s' answered %s in %" G_GINT64_FORMAT " ms",
+            priv->description, exchange_names[exchange], latency / 1000);
+  }
+
+  trace_event(client, message, now, latency);
+}
+
+static void append_latency_histogram(GString *str, const guint *histogram) {
+  guint bucket;
+
+  for (bucket = 0; bucket < XSMP_LATENCY_BUCKETS; bucket++) {
+    if (histogram[bucket] == 0) {
+      continue;
+    }
+
+    if (bucket == 0) {
+      g_string_append(str, " <1ms");
+    } else if (bucket == XSMP_LATENCY_BUCKETS - 1) {
+      g_string_append_printf(str, " >=%ums", 1u << (bucket - 1));
+    } else {
+      g_string_append_printf(str, " <%ums", 1u << bucket);
+    }
+    g_string_append_printf(str, ":%u", histogram[bucket]);
+  }
+}
+
+static char *xsmp_get_protocol_trace(GsmClient *client) {
+  GsmXSMPClientPrivate *priv;
+  GString *str;
+  gint64 now;
+  guint first;
+  guint i;
+
+  priv = gsm_xsmp_client_get_instance_private(GSM_XSMP_CLIENT(client));
+
+  now = g_get_monotonic_time();
+  str = g_string_new(NULL);
+
+  g_string_append_printf(str, "XSMP client '%s'\n", priv->description);
+
+  for (i = 0; i < XSMP_N_EXCHANGES; i++) {
+    g_string_append_printf(str, "  %s:", exchange_names[i]);
+    append_latency_histogram(str, priv->latency_histogram[i]);
+    if (priv->exchange_started[i] != 0) {
+      g_string_append_printf(
+          str, " (pending for %" G_GINT64_FORMAT " ms)",
+          (now - priv->exchange_started[i]) / 1000);
+    }
+    g_string_append_c(str, '\n');
+  }
+
+  first = priv->n_trace_events > XSMP_TRACE_LENGTH
+              ? priv->n_trace_events - XSMP_TRACE_LENGTH
+              : 0;
+  for (i = first; i < priv->n_trace_events; i++) {
+    XsmpTraceEvent *event = &priv->trace[i % XSMP_TRACE_LENGTH];
+
+    g_string_append_printf(str, "  -%" G_GINT64_FORMAT ".%03d s %s",
+                           (now - event->time) / G_USEC_PER_SEC,
+                           (int)((now - event->time) % G_USEC_PER_SEC / 1000),
+                           event->message);
+    if (event->latency >= 0) {
+      g_string_append_printf(str, " (after %" G_GINT64_FORMAT " ms)",
+                             event->latency / 1000);
+    }
+    g_string_append_c(str, '\n');
+  }
+
+  return g_string_free(str, FALSE);
+}
+
 static gboolean client_iochannel_watch(GIOChannel *channel,
                                        GIOCondition condition,
                                        GsmXSMPClient *client) {
@@ -75,14 +245,22 @@ static gboolean client_iochannel_watch(GIOChannel *channel,
   g_object_ref(client);
   priv = gsm_xsmp_client_get_instance_private(client);
 
+  /* tag whatever gets logged while handling the message */
+  mdm_log_set_context(MDM_LOG_CONTEXT_CLIENT_ID,
+                      gsm_client_peek_id(GSM_CLIENT(client)));
+  mdm_log_set_context(MDM_LOG_CONTEXT_APP_ID,
+                      gsm_client_peek_app_id(GSM_CLIENT(client)));
+
   switch (IceProcessMessages(priv->ice_connection, NULL, NULL)) {
     case IceProcessMessagesSuccess:
+      gsm_metrics_inc(METRIC_XSMP_MESSAGES, NULL);
       keep_going = TRUE;
       break;
 
     case IceProcessMessagesIOError:
       g_debug("GsmXSMPClient: IceProcessMessagesIOError on '%s'",
               priv->description);
+      trace_reply(client, XSMP_EXCHANGE_DIE, "IOError");
       gsm_client_set_status(GSM_CLIENT(client), GSM_CLIENT_FAILED);
       /* Emitting "disconnected" will eventually cause
        * IceCloseConnection() to be called.
@@ -94,6 +272,7 @@ static gboolean client_iochannel_watch(GIOChannel *channel,
     case IceProcessMessagesConnectionClosed:
       g_debug("GsmXSMPClient: IceProcessMessagesConnectionClosed on '%s'",
               priv->description);
+      trace_reply(client, XSMP_EXCHANGE_DIE, "ConnectionClosed");
       priv->ice_connection = NULL;
       keep_going = FALSE;
       break;
@@ -101,28 +280,20 @@ static gboolean client_iochannel_watch(GIOChannel *channel,
     default:
       g_assert_not_reached();
   }
+
+  mdm_log_set_context(MDM_LOG_CONTEXT_CLIENT_ID, NULL);
+  mdm_log_set_context(MDM_LOG_CONTEXT_APP_ID, NULL);
   g_object_unref(client);
 
   return keep_going;
 }
 
-static SmProp *find_property(GsmXSMPClient *client, const char *name,
-                             int *index) {
+static SmProp *find_property(GsmXSMPClient *client, const char *name) {
   GsmXSMPClientPrivate *priv;
-  guint i;
 
   priv = gsm_xsmp_client_get_instance_private(client);
-  for (i = 0; i < priv->props->len; i++) {
-    SmProp *prop = priv->props->pdata[i];
-    if (strcmp(prop->name, name) == 0) {
-      if (index)
-        *index = (int)i;
-      return prop;
-    }
-  }
-  if (index)
-    *index = -1;
-  return NULL;
+
+  return g_hash_table_lookup(priv->props, name);
 }
 
 static void set_description(GsmXSMPClient *client) {
@@ -131,7 +302,7 @@ static void set_description(GsmXSMPClient *client) {
   GsmXSMPClientPrivate *priv;
 
   priv = gsm_xsmp_client_get_instance_private(client);
-  prop = find_property(client, SmProgram, NULL);
+  prop = find_property(client, SmProgram);
   id = gsm_client_peek_startup_id(GSM_CLIENT(client));
 
   g_free(priv->description);
@@ -184,26 +355,19 @@ static void gsm_xsmp_client_init(GsmXSMPClient *client) {
 
   priv = gsm_xsmp_client_get_instance_private(client);
 
-  priv->props = g_ptr_array_new();
+  priv->props = g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
+                                      (GDestroyNotify)SmFreeProperty);
   priv->current_save_yourself = -1;
   priv->next_save_yourself = -1;
   priv->next_save_yourself_allow_interact = FALSE;
 }
 
 static void delete_property(GsmXSMPClient *client, const char *name) {
-  int index;
-  SmProp *prop;
   GsmXSMPClientPrivate *priv;
 
   priv = gsm_xsmp_client_get_instance_private(client);
 
-  prop = find_property(client, name, &index);
-  if (!prop) {
-    return;
-  }
-
-  g_ptr_array_remove_index_fast(priv->props, index);
-  SmFreeProperty(prop);
+  g_hash_table_remove(priv->props, name);
 }
 
 static void debug_print_property(SmProp *prop) {
@@ -248,8 +412,9 @@ static void set_properties_callback(SmsConn conn, SmPointer manager_data,
   g_debug("GsmXSMPClient: Set properties from client '%s'", priv->description);
 
   for (i = 0; i < num_props; i++) {
-    delete_property(client, props[i]->name);
-    g_ptr_array_add(priv->props, props[i]);
+    /* replaces (and frees) the previous value of the property; the names
+     * come from the client, so they are copied rather than interned */
+    g_hash_table_insert(priv->props, g_strdup(props[i]->name), props[i]);
 
     debug_print_property(props[i]);
 
@@ -281,12 +446,26 @@ static void delete_properties_callback(SmsConn conn, SmPointer manager_data,
 static void get_properties_callback(SmsConn conn, SmPointer manager_data) {
   GsmXSMPClientPrivate *priv;
   GsmXSMPClient *client = manager_data;
+  GHashTableIter iter;
+  gpointer prop;
+  SmProp **props;
+  int num_props;
 
   priv = gsm_xsmp_client_get_instance_private(client);
 
   g_debug("GsmXSMPClient: Get properties request from '%s'", priv->description);
 
-  SmsReturnProperties(conn, priv->props->len, (SmProp **)priv->props->pdata);
+  props = g_new(SmProp *, g_hash_table_size(priv->props));
+  num_props = 0;
+
+  g_hash_table_iter_init(&iter, priv->props);
+  while (g_hash_table_iter_next(&iter, NULL, &prop)) {
+    props[num_props++] = prop;
+  }
+
+  SmsReturnProperties(conn, num_props, props);
+
+  g_free(props);
 }
 
 static char *prop_to_command(SmProp *prop) {
@@ -333,7 +512,7 @@ static char *prop_to_command(SmProp *prop) {
 static char *xsmp_get_restart_command(GsmClient *client) {
   SmProp *prop;
 
-  prop = find_property(GSM_XSMP_CLIENT(client), SmRestartCommand, NULL);
+  prop = find_property(GSM_XSMP_CLIENT(client), SmRestartCommand);
 
   if (!prop || strcmp(prop->type, SmLISTofARRAY8) != 0) {
     return NULL;
@@ -345,7 +524,7 @@ static char *xsmp_get_restart_command(GsmClient *client) {
 static char *xsmp_get_discard_command(GsmClient *client) {
   SmProp *prop;
 
-  prop = find_property(GSM_XSMP_CLIENT(client), SmDiscardCommand, NULL);
+  prop = find_property(GSM_XSMP_CLIENT(client), SmDiscardCommand);
 
   if (!prop || strcmp(prop->type, SmLISTofARRAY8) != 0) {
     return NULL;
@@ -401,6 +580,8 @@ static void do_save_yourself(GsmXSMPClient *client, int save_type,
         }
         break;
     }
+
+    trace_request(client, XSMP_EXCHANGE_SAVE_YOURSELF);
   }
 }
 
@@ -412,6 +593,7 @@ static void xsmp_save_yourself_phase2(GsmClient *client) {
   g_debug("GsmXSMPClient: xsmp_save_yourself_phase2 ('%s')", priv->description);
 
   SmsSaveYourselfPhase2(priv->conn);
+  trace_request(GSM_XSMP_CLIENT(client), XSMP_EXCHANGE_PHASE2);
 }
 
 static void xsmp_interact(GsmClient *client) {
@@ -422,6 +604,7 @@ static void xsmp_interact(GsmClient *client) {
   g_debug("GsmXSMPClient: xsmp_interact ('%s')", priv->description);
 
   SmsInteract(priv->conn);
+  trace_request(GSM_XSMP_CLIENT(client), XSMP_EXCHANGE_INTERACT);
 }
 
 static gboolean xsmp_cancel_end_session(GsmClient *client, GError **error) {
@@ -438,8 +621,12 @@ static gboolean xsmp_cancel_end_session(GsmClient *client, GError **error) {
   }
 
   SmsShutdownCancelled(priv->conn);
+  trace_message(GSM_XSMP_CLIENT(client), "ShutdownCancelled");
 
   /* reset the state */
+  priv->exchange_started[XSMP_EXCHANGE_SAVE_YOURSELF] = 0;
+  priv->exchange_started[XSMP_EXCHANGE_PHASE2] = 0;
+  priv->exchange_started[XSMP_EXCHANGE_INTERACT] = 0;
   priv->current_save_yourself = -1;
   priv->next_save_yourself = -1;
   priv->next_save_yourself_allow_interact = FALSE;
@@ -447,15 +634,86 @@ static gboolean xsmp_cancel_end_session(GsmClient *client, GError **error) {
   return TRUE;
 }
 
+static void on_desktop_dir_changed(GFileMonitor *monitor, GFile *file,
+                                   GFile *other_file,
+                                   GFileMonitorEvent event_type,
+                                   gpointer data) {
+  switch (event_type) {
+    case G_FILE_MONITOR_EVENT_CHANGES_DONE_HINT:
+    case G_FILE_MONITOR_EVENT_DELETED:
+    case G_FILE_MONITOR_EVENT_CREATED:
+    case G_FILE_MONITOR_EVENT_MOVED:
+      g_debug("GsmXSMPClient: desktop file cache invalidated");
+      g_hash_table_remove_all(desktop_file_cache);
+      break;
+    default:
+      break;
+  }
+}
+
+static void monitor_desktop_dirs(char **dirs) {
+  int i;
+
+  for (i = 0; dirs[i] != NULL; i++) {
+    GFile *file;
+    GFileMonitor *monitor;
+
+    file = g_file_new_for_path(dirs[i]);
+    monitor = g_file_monitor_directory(file, G_FILE_MONITOR_NONE, NULL, NULL);
+    g_object_unref(file);
+
+    if (monitor == NULL) {
+      continue;
+    }
+
+    g_signal_connect(monitor, "changed", G_CALLBACK(on_desktop_dir_changed),
+                     NULL);
+    desktop_file_monitors = g_list_prepend(desktop_file_monitors, monitor);
+  }
+}
+
+static char *find_desktop_file_for_program(const char *program_name) {
+  gpointer cached;
+  char *desktop_file_path;
+  char **dirs;
+
+  if (desktop_file_cache == NULL) {
+    desktop_file_cache =
+        g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+
+    dirs = gsm_util_get_app_dirs();
+    monitor_desktop_dirs(dirs);
+    g_strfreev(dirs);
+
+    dirs = gsm_util_get_autostart_dirs();
+    monitor_desktop_dirs(dirs);
+    g_strfreev(dirs);
+  }
+
+  if (g_hash_table_lookup_extended(desktop_file_cache, program_name, NULL,
+                                   &cached)) {
+    return g_strdup(cached);
+  }
+
+  dirs = gsm_util_get_autostart_dirs();
+  desktop_file_path =
+      gsm_util_find_desktop_file_for_app_name(program_name, dirs);
+  g_strfreev(dirs);
+
+  g_hash_table_insert(desktop_file_cache, g_strdup(program_name),
+                      g_strdup(desktop_file_path));
+
+  return desktop_file_path;
+}
+
 static char *get_desktop_file_path(GsmXSMPClient *client) {
   SmProp *prop;
   char *desktop_file_path = NULL;
-  char **dirs;
   const char *program_name;
 
   /* XSMP clients using eggsmclient defines a special property
    * pointing to their respective desktop entry file */
-  prop = find_property(client, GsmDesktopFile, NULL);
+  prop = find_property(client, GsmDesktopFile);
 
   if (prop) {
     GFile *file = g_file_new_for_uri(prop->vals[0].value);
@@ -466,7 +724,7 @@ static char *get_desktop_file_path(GsmXSMPClient *client) {
 
   /* If we can't get desktop file from GsmDesktopFile then we
    * try to find the desktop file from its program name */
-  prop = find_property(client, SmProgram, NULL);
+  prop = find_property(client, SmProgram);
 
   if (!prop) {
     goto out;
@@ -474,12 +732,7 @@ static char *get_desktop_file_path(GsmXSMPClient *client) {
 
   program_name = prop->vals[0].value;
 
-  dirs = gsm_util_get_autostart_dirs();
-
-  desktop_file_path =
-      gsm_util_find_desktop_file_for_app_name(program_name, dirs);
-
-  g_strfreev(dirs);
+  desktop_file_path = find_desktop_file_for_program(program_name);
 
 out:
   g_debug("GsmXSMPClient: desktop file for client %s is %s",
@@ -495,7 +748,7 @@ static void set_desktop_file_keys_from_client(GsmClient *client,
   const char *name;
   char *comment;
 
-  prop = find_property(GSM_XSMP_CLIENT(client), SmProgram, NULL);
+  prop = find_property(GSM_XSMP_CLIENT(client), SmProgram);
 
   if (prop) {
     name = prop->vals[0].value;
@@ -625,6 +878,7 @@ static gboolean xsmp_stop(GsmClient *client, GError **error) {
   }
 
   SmsDie(priv->conn);
+  trace_request(GSM_XSMP_CLIENT(client), XSMP_EXCHANGE_DIE);
 
   return TRUE;
 }
@@ -697,7 +951,7 @@ static char *xsmp_get_app_name(GsmClient *client) {
   SmProp *prop;
   char *name = NULL;
 
-  prop = find_property(GSM_XSMP_CLIENT(client), SmProgram, NULL);
+  prop = find_property(GSM_XSMP_CLIENT(client), SmProgram);
   if (prop) {
     name = prop_to_command(prop);
   }
@@ -776,8 +1030,7 @@ static void gsm_xsmp_client_finalize(GObject *object) {
   gsm_xsmp_client_disconnect(client);
 
   g_free(priv->description);
-  g_ptr_array_foreach(priv->props, (GFunc)SmFreeProperty, NULL);
-  g_ptr_array_free(priv->props, TRUE);
+  g_hash_table_destroy(priv->props);
 
   G_OBJECT_CLASS(gsm_xsmp_client_parent_class)->finalize(object);
 }
@@ -803,7 +1056,7 @@ static GsmClientRestartStyle xsmp_get_restart_style_hint(GsmClient *client) {
   g_debug("GsmXSMPClient: getting restart style");
   hint = GSM_CLIENT_RESTART_IF_RUNNING;
 
-  prop = find_property(GSM_XSMP_CLIENT(client), SmRestartStyleHint, NULL);
+  prop = find_property(GSM_XSMP_CLIENT(client), SmRestartStyleHint);
 
   if (!prop || strcmp(prop->type, SmCARD8) != 0) {
     return GSM_CLIENT_RESTART_IF_RUNNING;
@@ -858,7 +1111,7 @@ static guint xsmp_get_unix_process_id(GsmClient *client) {
 
   g_debug("GsmXSMPClient: getting pid");
 
-  prop = find_property(GSM_XSMP_CLIENT(client), SmProcessID, NULL);
+  prop = find_property(GSM_XSMP_CLIENT(client), SmProcessID);
 
   if (!prop || strcmp(prop->type, SmARRAY8) != 0) {
     return 0;
@@ -890,6 +1143,10 @@ static void gsm_xsmp_client_class_init(GsmXSMPClientClass *klass) {
   client_class->impl_get_app_name = xsmp_get_app_name;
   client_class->impl_get_restart_style_hint = xsmp_get_restart_style_hint;
   client_class->impl_get_unix_process_id = xsmp_get_unix_process_id;
+  client_class->impl_get_protocol_trace = xsmp_get_protocol_trace;
+
+  gsm_metrics_register(METRIC_XSMP_MESSAGES, GSM_METRIC_COUNTER,
+                       "XSMP messages processed");
 
   signals[REGISTER_REQUEST] = g_signal_new(
       "register-request", G_OBJECT_CLASS_TYPE(object_class), G_SIGNAL_RUN_LAST,
@@ -926,6 +1183,7 @@ static Status register_client_callback(SmsConn conn, SmPointer manager_data,
 
   g_debug("GsmXSMPClient: Client '%s' received RegisterClient(%s)",
           priv->description, previous_id ? previous_id : "NULL");
+  trace_message(client, "RegisterClient");
 
   /* There are three cases:
    * 1. id is NULL - we'll use a new one
@@ -964,6 +1222,7 @@ static Status register_client_callback(SmsConn conn, SmPointer manager_data,
     g_debug("GsmXSMPClient: Sending initial SaveYourself");
     SmsSaveYourself(conn, SmSaveLocal, False, SmInteractStyleNone, False);
     priv->current_save_yourself = SmSaveLocal;
+    trace_request(client, XSMP_EXCHANGE_SAVE_YOURSELF);
   }
 
   gsm_client_set_status(GSM_CLIENT(client), GSM_CLIENT_REGISTERED);
@@ -995,6 +1254,7 @@ static void save_yourself_request_callback(SmsConn conn, SmPointer manager_data,
       : interact_style == SmInteractStyleErrors ? "SmInteractStyleErrors"
                                                 : "SmInteractStyleNone",
       fast ? "Fast" : "!Fast", global ? "Global" : "!Global");
+  trace_message(client, "SaveYourselfRequest");
 
   /* Examining the g_debug above, you can see that there are a total
    * of 72 different combinations of options that this could have been
@@ -1046,6 +1306,7 @@ static void save_yourself_phase2_request_callback(SmsConn conn,
 
   g_debug("GsmXSMPClient: Client '%s' received SaveYourselfPhase2Request",
           priv->description);
+  trace_reply(client, XSMP_EXCHANGE_SAVE_YOURSELF, "SaveYourselfPhase2Request");
 
   priv->current_save_yourself = -1;
 
@@ -1064,6 +1325,7 @@ static void interact_request_callback(SmsConn conn, SmPointer manager_data,
   g_debug("GsmXSMPClient: Client '%s' received InteractRequest(%s)",
           priv->description,
           dialog_type == SmDialogNormal ? "Dialog" : "Errors");
+  trace_reply(client, XSMP_EXCHANGE_SAVE_YOURSELF, "InteractRequest");
 
   gsm_client_end_session_response(GSM_CLIENT(client), FALSE, FALSE, FALSE,
                                   _("This program is blocking logout."));
@@ -1081,6 +1343,7 @@ static void interact_done_callback(SmsConn conn, SmPointer manager_data,
   g_debug(
       "GsmXSMPClient: Client '%s' received InteractDone(cancel_shutdown = %s)",
       priv->description, cancel_shutdown ? "True" : "False");
+  trace_reply(client, XSMP_EXCHANGE_INTERACT, "InteractDone");
 
   gsm_client_end_session_response(GSM_CLIENT(client), TRUE, FALSE,
                                   cancel_shutdown, NULL);
@@ -1095,6 +1358,12 @@ static void save_yourself_done_callback(SmsConn conn, SmPointer manager_data,
 
   g_debug("GsmXSMPClient: Client '%s' received SaveYourselfDone(success = %s)",
           priv->description, success ? "True" : "False");
+  /* after phase 2, SaveYourselfDone is the answer to SaveYourselfPhase2 */
+  trace_reply(client,
+              priv->exchange_started[XSMP_EXCHANGE_PHASE2] != 0
+                  ? XSMP_EXCHANGE_PHASE2
+                  : XSMP_EXCHANGE_SAVE_YOURSELF,
+              "SaveYourselfDone");
 
   if (priv->current_save_yourself != -1) {
     SmsSaveComplete(priv->conn);
@@ -1126,6 +1395,7 @@ static void close_connection_callback(SmsConn conn, SmPointer manager_data,
 
   g_debug("GsmXSMPClient: Client '%s' received CloseConnection",
           priv->description);
+  trace_reply(client, XSMP_EXCHANGE_DIE, "CloseConnection");
   for (i = 0; i < count; i++) {
     g_debug("GsmXSMPClient:  close reason: '%s'", reason_msgs[i]);
   }
@@ -21,6 +21,10 @@
  *
  */
 
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE /* struct ucred */
+#endif
+
 #ifdef HAVE_CONFIG_H
 #include <config.h>
 #endif
@@ -29,13 +33,17 @@
 #include <X11/ICE/ICElib.h>
 #include <X11/ICE/ICEutil.h>
 #include <X11/SM/SMlib.h>
+#include <errno.h>
 #include <fcntl.h>
+#include <gio/gio.h>
 #include <glib-object.h>
 #include <glib.h>
 #include <glib/gi18n.h>
+#include <poll.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/socket.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <unistd.h>
@@ -62,6 +70,13 @@
 #define GSM_ICE_MAGIC_COOKIE_AUTH_NAME "MIT-MAGIC-COOKIE-1"
 #define GSM_ICE_MAGIC_COOKIE_LEN 16
 
+#define GSM_SCHEMA "org.mate.session"
+#define KEY_XSMP_PEER_CREDENTIALS "xsmp-peer-credentials"
+
+/* Upper bound on connections accepted per wakeup of a listener, so that
+ * a flood of clients can't starve the rest of the main loop */
+#define GSM_XSMP_MAX_ACCEPTS 32
+
 struct _GsmXsmpServer {
   GObject parent;
   GsmStore *client_store;
@@ -69,6 +84,10 @@ struct _GsmXsmpServer {
   IceListenObj *xsmp_sockets;
   int num_xsmp_sockets;
   int num_local_xsmp_sockets;
+
+  /* Trust local clients running as our user, as checked with
+   * SO_PEERCRED at accept time, instead of exchanging cookies */
+  gboolean peer_credentials;
 };
 
 enum { PROP_0, PROP_CLIENT_STORE };
@@ -181,24 +200,71 @@ static void auth_ice_connection(IceConn ice_conn) {
   g_io_channel_unref(channel);
 }
 
+static gboolean peer_is_our_user(IceConn ice_conn) {
+#ifdef SO_PEERCRED
+  struct ucred cred;
+  socklen_t len = sizeof(cred);
+
+  if (getsockopt(IceConnectionNumber(ice_conn), SOL_SOCKET, SO_PEERCRED, &cred,
+                 &len) != 0) {
+    g_debug("GsmXsmpServer: unable to get peer credentials: %s",
+            g_strerror(errno));
+    return FALSE;
+  }
+
+  return cred.uid == getuid();
+#else
+  return FALSE;
+#endif
+}
+
+static gboolean listener_has_pending_connection(IceListenObj listener) {
+  struct pollfd pfd;
+
+  pfd.fd = IceGetListenConnectionNumber(listener);
+  pfd.events = POLLIN;
+  pfd.revents = 0;
+
+  return poll(&pfd, 1, 0) > 0 && (pfd.revents & POLLIN);
+}
+
 /* This is called (by glib via xsmp->ice_connection_watch) when a
- * connection is first received on the ICE listening socket.
+ * connection is first received on the ICE listening socket. We accept
+ * every connection already queued on the socket, rather than going back
+ * to the main loop for each of them.
  */
 static gboolean accept_ice_connection(GIOChannel *source,
                                       GIOCondition condition,
                                       GsmIceConnectionData *data) {
   IceConn ice_conn;
   IceAcceptStatus status;
+  int n_accepted;
 
   g_debug("GsmXsmpServer: accept_ice_connection()");
 
-  ice_conn = IceAcceptConnection(data->listener, &status);
-  if (status != IceAcceptSuccess) {
-    g_debug("GsmXsmpServer: IceAcceptConnection returned %d", status);
-    return TRUE;
-  }
+  n_accepted = 0;
+  do {
+    ice_conn = IceAcceptConnection(data->listener, &status);
+    if (status != IceAcceptSuccess) {
+      g_debug("GsmXsmpServer: IceAcceptConnection returned %d", status);
+      break;
+    }
+
+    n_accepted++;
+
+    if (data->server->peer_credentials && !peer_is_our_user(ice_conn)) {
+      g_debug("GsmXsmpServer: rejecting connection from another user");
+      disconnect_ice_connection(ice_conn);
+      continue;
+    }
 
-  auth_ice_connection(ice_conn);
+    auth_ice_connection(ice_conn);
+  } while (n_accepted < GSM_XSMP_MAX_ACCEPTS &&
+           listener_has_pending_connection(data->listener));
+
+  if (n_accepted > 1) {
+    g_debug("GsmXsmpServer: accepted %d connections in one pass", n_accepted);
+  }
 
   return TRUE;
 }
@@ -354,6 +420,24 @@ static void sms_error_handler(SmsConn conn, Bool swap,
    */
 }
 
+/* Host-based authentication, used when the client offers no cookie we
+ * know. With peer credentials on, only local connections are watched and
+ * their owner was already checked in accept_ice_connection(), so they can
+ * be let in without a cookie exchange. */
+static Bool trust_local_host(char *hostname) {
+  if (hostname == NULL) {
+    return False;
+  }
+
+  if (!strncmp(hostname, "local/", sizeof("local/") - 1) ||
+      !strncmp(hostname, "unix/", sizeof("unix/") - 1)) {
+    return True;
+  }
+
+  g_debug("GsmXsmpServer: refusing unauthenticated client on %s", hostname);
+  return False;
+}
+
 static IceAuthFileEntry *auth_entry_new(const char *protocol,
                                         const char *network_id) {
   IceAuthFileEntry *file_entry;
@@ -481,6 +565,54 @@ cleanup:
   return ok;
 }
 
+/* Unless the user chose an authority file, keep ours in the runtime dir:
+ * it is local and private, so locking and rewriting it is cheap, while
+ * ~/.ICEauthority may be on a slow network file system. Clients find it
+ * through ICEAUTHORITY, which IceAuthFileName() honours too. */
+static void maybe_use_runtime_iceauthority(void) {
+  const char *runtime_dir;
+  char *dir;
+  char *filename;
+
+  if (g_getenv("ICEAUTHORITY") != NULL) {
+    return;
+  }
+
+  runtime_dir = g_getenv("XDG_RUNTIME_DIR");
+  if (runtime_dir == NULL || !g_path_is_absolute(runtime_dir)) {
+    return;
+  }
+
+  dir = g_build_filename(runtime_dir, "mate-session", NULL);
+  if (g_mkdir_with_parents(dir, 0700) != 0) {
+    g_debug("GsmXsmpServer: unable to create %s: %s", dir, g_strerror(errno));
+    g_free(dir);
+    return;
+  }
+
+  filename = g_build_filename(dir, "ICEauthority", NULL);
+  gsm_util_setenv("ICEAUTHORITY", filename);
+  g_debug("GsmXsmpServer: ICEAUTHORITY=%s", filename);
+
+  g_free(filename);
+  g_free(dir);
+}
+
+static gboolean use_peer_credentials(void) {
+#ifdef SO_PEERCRED
+  GSettings *settings;
+  gboolean ret;
+
+  settings = g_settings_new(GSM_SCHEMA);
+  ret = g_settings_get_boolean(settings, KEY_XSMP_PEER_CREDENTIALS);
+  g_object_unref(settings);
+
+  return ret;
+#else
+  return FALSE;
+#endif
+}
+
 static void setup_listener(GsmXsmpServer *server) {
   char error[256];
   mode_t saved_umask;
@@ -488,17 +620,20 @@ static void setup_listener(GsmXsmpServer *server) {
   int i;
   int res;
 
+  server->peer_credentials = use_peer_credentials();
+
   /* Set up sane error handlers */
   IceSetErrorHandler(ice_error_handler);
   IceSetIOErrorHandler(ice_io_error_handler);
   SmsSetErrorHandler(sms_error_handler);
 
-  /* Initialize libSM; we pass NULL for hostBasedAuthProc to disable
-   * host-based authentication.
+  /* Initialize libSM; unless peer credentials are checked, we pass NULL
+   * for hostBasedAuthProc to disable host-based authentication.
    */
-  res =
-      SmsInitialize(PACKAGE, VERSION, (SmsNewClientProc)accept_xsmp_connection,
-                    server, NULL, sizeof(error), error);
+  res = SmsInitialize(PACKAGE, VERSION,
+                      (SmsNewClientProc)accept_xsmp_connection, server,
+                      server->peer_credentials ? trust_local_host : NULL,
+                      sizeof(error), error);
   if (!res) {
     gsm_util_init_error(TRUE, "Could not initialize libSM: %s", error);
   }
@@ -579,11 +714,21 @@ static void setup_listener(GsmXsmpServer *server) {
   }
 #endif
 
-  /* Update .ICEauthority with new auth entries for our socket */
-  if (!update_iceauthority(server, TRUE)) {
-    /* FIXME: is this really fatal? Hm... */
-    gsm_util_init_error(TRUE, "Could not update ICEauthority file %s",
-                        IceAuthFileName());
+  if (server->peer_credentials) {
+    /* No cookies to hand out: local clients are let in by host-based
+     * authentication once their credentials have been checked. */
+    g_debug("GsmXsmpServer: authenticating clients by peer credentials");
+    for (i = 0; i < server->num_local_xsmp_sockets; i++) {
+      IceSetHostBasedAuthProc(server->xsmp_sockets[i], trust_local_host);
+    }
+  } else {
+    /* Update .ICEauthority with new auth entries for our socket */
+    maybe_use_runtime_iceauthority();
+    if (!update_iceauthority(server, TRUE)) {
+      /* FIXME: is this really fatal? Hm... */
+      gsm_util_init_error(TRUE, "Could not update ICEauthority file %s",
+                          IceAuthFileName());
+    }
   }
 
   network_id_list = IceComposeNetworkIdList(server->num_local_xsmp_sockets,
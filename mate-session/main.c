@@ -36,6 +36,7 @@
 #include <signal.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
 #include <time.h>
 #include <unistd.h>
 
@@ -45,7 +46,11 @@
 #ifdef HAVE_SYSTEMD
 #include "gsm-systemd.h"
 #endif
+#include "gsm-client.h"
 #include "gsm-manager.h"
+#include "gsm-metrics.h"
+#include "gsm-session-plan.h"
+#include "gsm-session-save.h"
 #include "gsm-store.h"
 #include "gsm-util.h"
 #include "gsm-xsmp-server.h"
@@ -82,6 +87,9 @@ static gboolean show_version = FALSE;
 static gboolean debug = FALSE;
 static gboolean disable_acceleration_check = FALSE;
 
+static GsmSessionPlan* session_plan = NULL;
+static gboolean session_plan_replayed = FALSE;
+
 static gboolean initialize_gsettings(void) {
   GSettings* settings;
   time_t now = time(0);
@@ -186,7 +194,7 @@ static gboolean acquire_name(void) {
 
 /* This doesn't contain the required components, so we need to always
  * call append_required_apps() after a call to append_default_apps(). */
-static void append_default_apps(GsmManager* manager,
+static void append_default_apps(GsmSessionPlan* plan,
                                 const char* default_session_key,
                                 char** autostart_dirs) {
   gint i;
@@ -213,7 +221,7 @@ static void append_default_apps(GsmManager* manager,
                                                        autostart_dirs);
 
     if (app_path != NULL) {
-      gsm_manager_add_autostart_app(manager, app_path, NULL);
+      gsm_session_plan_add_app(plan, app_path, NULL);
       g_free(app_path);
     }
   }
@@ -221,7 +229,7 @@ static void append_default_apps(GsmManager* manager,
   g_strfreev(default_apps);
 }
 
-static void append_required_apps(GsmManager* manager) {
+static void append_required_apps(GsmSessionPlan* plan) {
   gchar** required_components;
   gint i;
   GSettings* settings;
@@ -261,7 +269,7 @@ static void append_required_apps(GsmManager* manager) {
             gsm_util_find_desktop_file_for_app_name(default_provider, NULL);
 
         if (app_path != NULL) {
-          gsm_manager_add_autostart_app(manager, app_path, component);
+          gsm_session_plan_add_app(plan, app_path, component);
         } else {
           g_warning("Unable to find provider '%s' of required component '%s'",
                     default_provider, component);
@@ -282,7 +290,7 @@ static void append_required_apps(GsmManager* manager) {
   g_object_unref(settings_required_components);
 }
 
-static void append_accessibility_apps(GsmManager* manager) {
+static void append_accessibility_apps(GsmSessionPlan* plan) {
   GSettings* mobility_settings;
   GSettings* visual_settings;
 
@@ -298,7 +306,7 @@ static void append_accessibility_apps(GsmManager* manager) {
       char* app_path;
       app_path = gsm_util_find_desktop_file_for_app_name(mobility_exec, NULL);
       if (app_path != NULL) {
-        gsm_manager_add_autostart_app(manager, app_path, NULL);
+        gsm_session_plan_add_app(plan, app_path, NULL);
         g_free(app_path);
       }
       g_free(mobility_exec);
@@ -312,7 +320,7 @@ static void append_accessibility_apps(GsmManager* manager) {
       char* app_path;
       app_path = gsm_util_find_desktop_file_for_app_name(visual_exec, NULL);
       if (app_path != NULL) {
-        gsm_manager_add_autostart_app(manager, app_path, NULL);
+        gsm_session_plan_add_app(plan, app_path, NULL);
         g_free(app_path);
       }
       g_free(visual_exec);
@@ -367,25 +375,203 @@ static void maybe_load_saved_session_apps(GsmManager* manager) {
   g_free(session_type);
 }
 
-static void load_standard_apps(GsmManager* manager,
-                               const char* default_session_key) {
-  char** autostart_dirs = gsm_util_get_autostart_dirs();
+static void append_dir_stamps(GString* inputs, char** dirs) {
+  int i;
+
+  for (i = 0; dirs[i]; i++) {
+    struct stat buf;
+
+    /* The mtime of a directory changes when entries are added, removed
+     * or renamed, which is all that matters for resolving the plan. */
+    if (stat(dirs[i], &buf) == 0) {
+      g_string_append_printf(inputs, "%s %" G_GINT64_FORMAT ".%09ld\n",
+                             dirs[i], (gint64)buf.st_mtim.tv_sec,
+                             (long)buf.st_mtim.tv_nsec);
+    } else {
+      g_string_append_printf(inputs, "%s -\n", dirs[i]);
+    }
+  }
+}
+
+static void append_setting(GString* inputs, GSettings* settings,
+                           const char* key) {
+  GVariant* value;
+  char* printed;
+
+  value = g_settings_get_value(settings, key);
+  printed = g_variant_print(value, FALSE);
+  g_string_append_printf(inputs, "%s=%s\n", key, printed);
+  g_free(printed);
+  g_variant_unref(value);
+}
+
+/* Fingerprint of everything the session plan is resolved from: the
+ * settings read by the append_*_apps() functions and the state of the
+ * directories searched for desktop files. */
+static char* compute_session_plan_fingerprint(const char* default_session_key,
+                                              char** autostart_dirs) {
+  GString* inputs;
+  GSettings* settings;
+  char** app_dirs;
+  char** required_components;
+  char* fingerprint;
+  int i;
+
+  inputs = g_string_new(NULL);
+
+  g_string_append_printf(inputs, "failsafe=%d\n", failsafe);
+
+  settings = g_settings_new(GSM_SCHEMA);
+  append_setting(inputs, settings, default_session_key);
+  append_setting(inputs, settings, GSM_REQUIRED_COMPONENTS_LIST_KEY);
+  required_components =
+      g_settings_get_strv(settings, GSM_REQUIRED_COMPONENTS_LIST_KEY);
+  g_object_unref(settings);
+
+  settings = g_settings_new(GSM_REQUIRED_COMPONENTS_SCHEMA);
+  for (i = 0; required_components[i]; i++) {
+    if (IS_STRING_EMPTY(required_components[i])) {
+      continue;
+    }
+    append_setting(inputs, settings, required_components[i]);
+  }
+  g_object_unref(settings);
+  g_strfreev(required_components);
+
+  settings = g_settings_new(MOBILITY_SCHEMA);
+  append_setting(inputs, settings, MOBILITY_STARTUP_KEY);
+  append_setting(inputs, settings, MOBILITY_KEY);
+  g_object_unref(settings);
+
+  settings = g_settings_new(VISUAL_SCHEMA);
+  append_setting(inputs, settings, VISUAL_STARTUP_KEY);
+  append_setting(inputs, settings, VISUAL_KEY);
+  g_object_unref(settings);
+
+  app_dirs = gsm_util_get_app_dirs();
+  append_dir_stamps(inputs, app_dirs);
+  g_strfreev(app_dirs);
+  append_dir_stamps(inputs, autostart_dirs);
+
+  fingerprint =
+      g_compute_checksum_for_string(G_CHECKSUM_SHA256, inputs->str, inputs->len);
+  g_string_free(inputs, TRUE);
+
+  return fingerprint;
+}
+
+static GsmSessionPlan* resolve_session_plan(const char* fingerprint,
+                                            const char* default_session_key,
+                                            char** autostart_dirs) {
+  GsmSessionPlan* plan;
+
+  plan = gsm_session_plan_new(fingerprint);
 
   if (!failsafe) {
     int i;
 
-    maybe_load_saved_session_apps(manager);
     for (i = 0; autostart_dirs[i]; i++) {
-      gsm_manager_add_autostart_apps_from_dir(manager, autostart_dirs[i]);
+      gsm_session_plan_add_apps_from_dir(plan, autostart_dirs[i]);
     }
   }
 
   /* We do this at the end in case a saved session contains an
    * application that already provides one of the components. */
-  append_default_apps(manager, default_session_key, autostart_dirs);
-  append_required_apps(manager);
-  append_accessibility_apps(manager);
+  append_default_apps(plan, default_session_key, autostart_dirs);
+  append_required_apps(plan);
+  append_accessibility_apps(plan);
 
+  return plan;
+}
+
+static void save_session_plan(GsmSessionPlan* plan) {
+  GError* error;
+
+  error = NULL;
+  if (!gsm_session_plan_save(plan, &error)) {
+    g_debug("main: unable to save the session plan: %s", error->message);
+    g_error_free(error);
+  }
+}
+
+static gboolean validate_session_plan(gpointer data) {
+  const char* default_session_key = data;
+  GsmSessionPlan* resolved;
+  char** autostart_dirs;
+  char* fingerprint;
+
+  g_debug("main: *** Validating the replayed session plan");
+
+  autostart_dirs = gsm_util_get_autostart_dirs();
+  fingerprint =
+      compute_session_plan_fingerprint(default_session_key, autostart_dirs);
+  resolved =
+      resolve_session_plan(fingerprint, default_session_key, autostart_dirs);
+
+  if (!gsm_session_plan_equal(session_plan, resolved)) {
+    g_warning(
+        "The saved session plan did not match the autostart configuration, "
+        "it will be updated for the next login");
+    save_session_plan(resolved);
+  } else if (g_strcmp0(gsm_session_plan_peek_fingerprint(session_plan),
+                       fingerprint) != 0) {
+    save_session_plan(resolved);
+  }
+
+  gsm_session_plan_free(resolved);
+  g_free(fingerprint);
+  g_strfreev(autostart_dirs);
+
+  gsm_session_plan_free(session_plan);
+  session_plan = NULL;
+
+  return FALSE;
+}
+
+static void on_session_running(GsmManager* manager, gpointer data) {
+  g_signal_handlers_disconnect_by_func(manager, on_session_running, data);
+
+  if (session_plan_replayed) {
+    /* Check the plan against the real configuration now that the
+     * session is up, so that the next login gets a correct one. */
+    g_idle_add_full(G_PRIORITY_LOW, validate_session_plan, data, NULL);
+  } else {
+    save_session_plan(session_plan);
+    gsm_session_plan_free(session_plan);
+    session_plan = NULL;
+  }
+}
+
+static void load_standard_apps(GsmManager* manager,
+                               const char* default_session_key) {
+  char** autostart_dirs = gsm_util_get_autostart_dirs();
+  char* fingerprint;
+
+  if (!failsafe) {
+    maybe_load_saved_session_apps(manager);
+  }
+
+  /* Most logins resolve to the same plan as the previous one, so use
+   * the plan saved by that session when its inputs didn't change and
+   * skip the directory scans and desktop file lookups. */
+  fingerprint =
+      compute_session_plan_fingerprint(default_session_key, autostart_dirs);
+  session_plan = gsm_session_plan_load(fingerprint);
+
+  if (session_plan != NULL) {
+    g_debug("main: *** Replaying saved session plan");
+    session_plan_replayed = TRUE;
+  } else {
+    session_plan =
+        resolve_session_plan(fingerprint, default_session_key, autostart_dirs);
+  }
+
+  gsm_session_plan_replay(session_plan, manager);
+
+  g_signal_connect(manager, "session-running", G_CALLBACK(on_session_running),
+                   (gpointer)default_session_key);
+
+  g_free(fingerprint);
   g_strfreev(autostart_dirs);
 }
 
@@ -399,6 +585,19 @@ static void load_override_apps(GsmManager* manager,
   }
 }
 
+static gboolean dump_client_trace(const char* id, GsmClient* client,
+                                  gpointer user_data) {
+  char* trace;
+
+  trace = gsm_client_get_protocol_trace_text(client);
+  if (trace != NULL) {
+    g_message("%s", trace);
+    g_free(trace);
+  }
+
+  return FALSE;
+}
+
 static gboolean signal_cb(int signo, gpointer data) {
   int ret;
   GsmManager* manager;
@@ -431,6 +630,8 @@ static gboolean signal_cb(int signo, gpointer data) {
       g_debug("Got USR1 signal");
       ret = TRUE;
       mdm_log_toggle_debug();
+      gsm_store_foreach((GsmStore*)data, (GsmStoreFunc)dump_client_trace,
+                        NULL);
       break;
     default:
       g_debug("Caught unhandled signal %d", signo);
@@ -605,6 +806,9 @@ int main(int argc, char** argv) {
     exit(EXIT_FAILURE);
   }
 
+  /* Send the environment set up below to the bus in one go */
+  gsm_util_environment_begin();
+
   gsm_util_export_activation_environment(NULL);
 
 #ifdef HAVE_SYSTEMD
@@ -687,19 +891,21 @@ int main(int argc, char** argv) {
    */
   acquire_name();
 
-  /* Starts gnome compat mode */
-  msm_gnome_start();
-
   /* Set to use Gtk3 overlay scroll */
   set_overlay_scroll();
 
+  gsm_util_environment_commit();
+
+  /* Starts gnome compat mode */
+  msm_gnome_start();
+
   manager = gsm_manager_new(client_store, failsafe);
 
   signal_handler = mdm_signal_handler_new();
   mdm_signal_handler_add_fatal(signal_handler);
   mdm_signal_handler_add(signal_handler, SIGFPE, signal_cb, NULL);
   mdm_signal_handler_add(signal_handler, SIGHUP, signal_cb, NULL);
-  mdm_signal_handler_add(signal_handler, SIGUSR1, signal_cb, NULL);
+  mdm_signal_handler_add(signal_handler, SIGUSR1, signal_cb, client_store);
   mdm_signal_handler_add(signal_handler, SIGTERM, signal_cb, manager);
   mdm_signal_handler_add(signal_handler, SIGINT, signal_cb, manager);
   mdm_signal_handler_set_fatal_func(signal_handler, shutdown_cb, manager);
@@ -711,12 +917,16 @@ int main(int argc, char** argv) {
   }
 
   gsm_xsmp_server_start(xsmp_server);
+  gsm_metrics_start_server();
   _gsm_manager_set_renderer(manager, gl_renderer);
   g_free(gl_renderer);
   gsm_manager_start(manager);
 
   gtk_main();
 
+  gsm_metrics_stop_server();
+  gsm_session_save_flush_discards();
+
   if (xsmp_server != NULL) {
     g_object_unref(xsmp_server);
   }
@@ -734,6 +944,8 @@ int main(int argc, char** argv) {
     g_object_unref(debug_settings);
   }
 
+  gsm_session_plan_free(session_plan);
+
   msm_gnome_stop();
   mdm_log_shutdown();
 
@@ -37,10 +37,70 @@
 #include <time.h>
 #include <unistd.h>
 
+#ifdef HAVE_SYSTEMD_JOURNAL
+#define SD_JOURNAL_SUPPRESS_LOCATION
+#include <sys/uio.h>
+#include <systemd/sd-journal.h>
+#endif
+
+/* Messages are queued and written by a thread of their own, so that
+ * logging, debug output included, costs the caller little more than a
+ * copy of the message. Warnings and worse are written synchronously,
+ * after everything queued before them, so that they are not lost when
+ * the process exits right after logging them. */
+#define LOG_QUEUE_SIZE 1024
+#define LOG_WRITE_BATCH 64
+
+/* Each log domain may log this many messages below warnings per
+ * interval; the rest are dropped, and counted */
+#define RATE_LIMIT_BURST 1000
+#define RATE_LIMIT_INTERVAL G_USEC_PER_SEC
+
+#define RATE_LIMITED_LEVELS \
+  (G_LOG_LEVEL_MESSAGE | G_LOG_LEVEL_INFO | G_LOG_LEVEL_DEBUG)
+
+#define SYNC_LEVELS \
+  (G_LOG_LEVEL_ERROR | G_LOG_LEVEL_CRITICAL | G_LOG_LEVEL_WARNING)
+
+typedef struct {
+  int priority;
+  const char *level_prefix;
+  const char *domain;  /* interned */
+  char *message;
+  /* GRefStrings: client ids are never reused, so the context is
+   * released once no entry refers to it */
+  char *context[MDM_LOG_N_CONTEXTS];
+  gboolean is_fatal;
+} LogEntry;
+
+typedef struct {
+  gint64 window_start;
+  guint count;
+  guint suppressed;
+} RateLimit;
+
+static const char *context_fields[MDM_LOG_N_CONTEXTS] = {
+    "MATE_SESSION_PHASE", "MATE_SESSION_CLIENT_ID", "MATE_SESSION_APP_ID"};
+
 static gboolean initialized = FALSE;
 static int syslog_levels =
     (G_LOG_LEVEL_ERROR | G_LOG_LEVEL_CRITICAL | G_LOG_LEVEL_WARNING);
 
+/* log_lock protects the queue, the context and the rate limits.
+ * write_lock is held while writing, and taken before log_lock, so that
+ * entries are written in the order they were queued. */
+static GMutex log_lock;
+static GMutex write_lock;
+static GCond log_cond;
+static LogEntry log_queue[LOG_QUEUE_SIZE];
+static guint queue_head = 0;
+static guint queue_length = 0;
+static guint queue_dropped = 0;
+static GThread *writer_thread = NULL;
+static gboolean writer_quit = FALSE;
+static char *log_context[MDM_LOG_N_CONTEXTS]; /* GRefStrings */
+static GHashTable *rate_limits = NULL;
+
 static void log_level_to_priority_and_prefix(GLogLevelFlags log_level,
                                              int *priorityp,
                                              const char **prefixp) {
@@ -98,16 +158,244 @@ static void log_level_to_priority_and_prefix(GLogLevelFlags log_level,
   }
 }
 
-void mdm_log_default_handler(const gchar *log_domain, GLogLevelFlags log_level,
-                             const gchar *message, gpointer unused_data) {
+static void entry_clear(LogEntry *entry) {
+  int i;
+
+  g_free(entry->message);
+  entry->message = NULL;
+  for (i = 0; i < MDM_LOG_N_CONTEXTS; i++) {
+    g_clear_pointer(&entry->context[i], g_ref_string_release);
+  }
+}
+
+static void entry_acquire_context(LogEntry *entry) {
+  int i;
+
+  for (i = 0; i < MDM_LOG_N_CONTEXTS; i++) {
+    if (log_context[i] != NULL) {
+      entry->context[i] = g_ref_string_acquire(log_context[i]);
+    } else {
+      entry->context[i] = NULL;
+    }
+  }
+}
+
+static char *format_entry(LogEntry *entry) {
   GString *gstring;
-  int priority;
-  const char *level_prefix;
+
+  gstring = g_string_new(NULL);
+
+  if (entry->domain != NULL) {
+    g_string_append(gstring, entry->domain);
+    g_string_append_c(gstring, '-');
+  }
+  g_string_append(gstring, entry->level_prefix);
+
+  g_string_append(gstring, ": ");
+  g_string_append(gstring, entry->message);
+  if (entry->is_fatal) {
+    g_string_append(gstring, "\naborting...\n");
+  } else {
+    g_string_append(gstring, "\n");
+  }
+
+  return g_string_free(gstring, FALSE);
+}
+
+#ifdef HAVE_SYSTEMD_JOURNAL
+static gboolean write_entry_to_journal(LogEntry *entry) {
+  struct iovec iov[5 + MDM_LOG_N_CONTEXTS];
+  char *fields[5 + MDM_LOG_N_CONTEXTS];
+  int n_fields;
+  int res;
+  int i;
+
+  n_fields = 0;
+  fields[n_fields++] = g_strconcat("MESSAGE=", entry->message,
+                                   entry->is_fatal ? "\naborting..." : "",
+                                   NULL);
+  fields[n_fields++] = g_strdup_printf("PRIORITY=%d", entry->priority);
+  fields[n_fields++] = g_strdup_printf("GLIB_LEVEL=%s", entry->level_prefix);
+  fields[n_fields++] =
+      g_strconcat("SYSLOG_IDENTIFIER=", g_get_prgname(), NULL);
+  if (entry->domain != NULL) {
+    fields[n_fields++] = g_strconcat("GLIB_DOMAIN=", entry->domain, NULL);
+  }
+  for (i = 0; i < MDM_LOG_N_CONTEXTS; i++) {
+    if (entry->context[i] != NULL) {
+      fields[n_fields++] =
+          g_strconcat(context_fields[i], "=", entry->context[i], NULL);
+    }
+  }
+
+  for (i = 0; i < n_fields; i++) {
+    iov[i].iov_base = fields[i];
+    iov[i].iov_len = strlen(fields[i]);
+  }
+
+  res = sd_journal_sendv(iov, n_fields);
+
+  for (i = 0; i < n_fields; i++) {
+    g_free(fields[i]);
+  }
+
+  return res >= 0;
+}
+#endif
+
+static void write_entry(LogEntry *entry) {
   char *string;
-  gboolean do_log;
-  gboolean is_fatal;
 
-  is_fatal = (log_level & G_LOG_FLAG_FATAL) != 0;
+  string = format_entry(entry);
+
+#ifdef HAVE_SYSTEMD_JOURNAL
+  if (write_entry_to_journal(entry)) {
+    /* what LOG_PERROR does for syslog */
+    fprintf(stderr, "%s[%d]: %s", g_get_prgname(), (int)getpid(), string);
+    g_free(string);
+    return;
+  }
+#endif
+
+  syslog(entry->priority, "%s", string);
+  g_free(string);
+}
+
+static void write_entries(LogEntry *entries, guint n_entries, guint dropped) {
+  guint i;
+
+  if (dropped > 0) {
+    LogEntry note = {LOG_WARNING, "WARNING", NULL, NULL, {NULL}, FALSE};
+
+    note.message =
+        g_strdup_printf("Log queue overflow, dropped %u messages", dropped);
+    write_entry(&note);
+    g_free(note.message);
+  }
+
+  for (i = 0; i < n_entries; i++) {
+    write_entry(&entries[i]);
+    entry_clear(&entries[i]);
+  }
+}
+
+/* Called with log_lock held */
+static guint take_entries(LogEntry *entries, guint max_entries,
+                          guint *dropped) {
+  guint n;
+
+  for (n = 0; n < max_entries && queue_length > 0; n++) {
+    entries[n] = log_queue[queue_head];
+    queue_head = (queue_head + 1) % LOG_QUEUE_SIZE;
+    queue_length--;
+  }
+
+  *dropped = queue_dropped;
+  queue_dropped = 0;
+
+  return n;
+}
+
+static gpointer log_writer_thread(gpointer data) {
+  LogEntry batch[LOG_WRITE_BATCH];
+  guint n_entries;
+  guint dropped;
+
+  for (;;) {
+    g_mutex_lock(&log_lock);
+    while (queue_length == 0 && queue_dropped == 0 && !writer_quit) {
+      g_cond_wait(&log_cond, &log_lock);
+    }
+    if (queue_length == 0 && queue_dropped == 0) {
+      g_mutex_unlock(&log_lock);
+      break;
+    }
+    g_mutex_unlock(&log_lock);
+
+    g_mutex_lock(&write_lock);
+    g_mutex_lock(&log_lock);
+    n_entries = take_entries(batch, G_N_ELEMENTS(batch), &dropped);
+    g_mutex_unlock(&log_lock);
+
+    write_entries(batch, n_entries, dropped);
+    g_mutex_unlock(&write_lock);
+  }
+
+  return NULL;
+}
+
+/* Writes out everything queued, then @entry, from the calling thread */
+static void write_entry_sync(LogEntry *entry) {
+  LogEntry batch[LOG_WRITE_BATCH];
+  guint n_entries;
+  guint dropped;
+
+  g_mutex_lock(&write_lock);
+  do {
+    g_mutex_lock(&log_lock);
+    n_entries = take_entries(batch, G_N_ELEMENTS(batch), &dropped);
+    g_mutex_unlock(&log_lock);
+
+    write_entries(batch, n_entries, dropped);
+  } while (n_entries > 0);
+
+  write_entry(entry);
+  g_mutex_unlock(&write_lock);
+}
+
+/* Called with log_lock held. Returns FALSE if the message should be
+ * dropped; *suppressed is set to the number of messages dropped in the
+ * previous interval when a new one starts. */
+static gboolean rate_limit_allow(const char *domain, gint64 now,
+                                 guint *suppressed) {
+  RateLimit *limit;
+
+  *suppressed = 0;
+
+  if (rate_limits == NULL) {
+    rate_limits = g_hash_table_new_full(g_str_hash, g_str_equal, NULL, g_free);
+  }
+
+  limit = g_hash_table_lookup(rate_limits, domain != NULL ? domain : "");
+  if (limit == NULL) {
+    limit = g_new0(RateLimit, 1);
+    g_hash_table_insert(rate_limits, (gpointer)(domain != NULL ? domain : ""),
+                        limit);
+  }
+
+  if (now - limit->window_start >= RATE_LIMIT_INTERVAL) {
+    *suppressed = limit->suppressed;
+    limit->window_start = now;
+    limit->count = 0;
+    limit->suppressed = 0;
+  }
+
+  if (limit->count >= RATE_LIMIT_BURST) {
+    limit->suppressed++;
+    return FALSE;
+  }
+
+  limit->count++;
+  return TRUE;
+}
+
+/* Called with log_lock held */
+static gboolean queue_entry(LogEntry *entry) {
+  if (queue_length == LOG_QUEUE_SIZE) {
+    return FALSE;
+  }
+
+  log_queue[(queue_head + queue_length) % LOG_QUEUE_SIZE] = *entry;
+  queue_length++;
+
+  return TRUE;
+}
+
+void mdm_log_default_handler(const gchar *log_domain, GLogLevelFlags log_level,
+                             const gchar *message, gpointer unused_data) {
+  LogEntry entry;
+  gboolean do_log;
+  guint suppressed;
 
   do_log = (log_level & syslog_levels);
   if (!do_log) {
@@ -118,33 +406,50 @@ void mdm_log_default_handler(const gchar *log_domain, GLogLevelFlags log_level,
     mdm_log_init();
   }
 
-  log_level_to_priority_and_prefix(log_level, &priority, &level_prefix);
+  suppressed = 0;
+  log_level_to_priority_and_prefix(log_level, &entry.priority,
+                                   &entry.level_prefix);
+  entry.is_fatal = (log_level & G_LOG_FLAG_FATAL) != 0;
+  entry.domain = log_domain != NULL ? g_intern_string(log_domain) : NULL;
 
-  gstring = g_string_new(NULL);
+  g_mutex_lock(&log_lock);
 
-  if (log_domain != NULL) {
-    g_string_append(gstring, log_domain);
-    g_string_append_c(gstring, '-');
+  if ((log_level & RATE_LIMITED_LEVELS) && !entry.is_fatal &&
+      !rate_limit_allow(entry.domain, g_get_monotonic_time(), &suppressed)) {
+    g_mutex_unlock(&log_lock);
+    return;
   }
-  g_string_append(gstring, level_prefix);
 
-  g_string_append(gstring, ": ");
-  if (message == NULL) {
-    g_string_append(gstring, "(NULL) message");
-  } else {
-    g_string_append(gstring, message);
-  }
-  if (is_fatal) {
-    g_string_append(gstring, "\naborting...\n");
-  } else {
-    g_string_append(gstring, "\n");
+  entry_acquire_context(&entry);
+  entry.message = g_strdup(message != NULL ? message : "(NULL) message");
+
+  if (writer_thread == NULL || entry.is_fatal || (log_level & SYNC_LEVELS)) {
+    g_mutex_unlock(&log_lock);
+    write_entry_sync(&entry);
+    entry_clear(&entry);
+    return;
   }
 
-  string = g_string_free(gstring, FALSE);
+  if (suppressed > 0) {
+    LogEntry note = entry;
 
-  syslog(priority, "%s", string);
+    entry_acquire_context(&note);
+    note.message = g_strdup_printf(
+        "Rate limit reached, suppressed %u messages", suppressed);
+    if (!queue_entry(&note)) {
+      entry_clear(&note);
+      queue_dropped++;
+    }
+  }
 
-  g_free(string);
+  /* debug output may be lost, warnings are never queued */
+  if (!queue_entry(&entry)) {
+    entry_clear(&entry);
+    queue_dropped++;
+  }
+  g_cond_signal(&log_cond);
+
+  g_mutex_unlock(&log_lock);
 }
 
 void mdm_log_toggle_debug(void) {
@@ -167,6 +472,25 @@ void mdm_log_set_debug(gboolean debug) {
   }
 }
 
+/**
+ * mdm_log_set_context:
+ * @context: the context to set
+ * @value: (nullable): its new value, or %NULL to clear it
+ *
+ * Sets context attached to the messages logged from now on. It is only
+ * visible in the journal, as MATE_SESSION_* fields.
+ **/
+void mdm_log_set_context(MdmLogContext context, const char *value) {
+  g_return_if_fail(context < MDM_LOG_N_CONTEXTS);
+
+  g_mutex_lock(&log_lock);
+  g_clear_pointer(&log_context[context], g_ref_string_release);
+  if (value != NULL) {
+    log_context[context] = g_ref_string_new_intern(value);
+  }
+  g_mutex_unlock(&log_lock);
+}
+
 void mdm_log_init(void) {
   const char *prg_name;
   int options;
@@ -183,9 +507,24 @@ void mdm_log_init(void) {
   openlog(prg_name, options, LOG_DAEMON);
 
   initialized = TRUE;
+
+  if (writer_thread == NULL) {
+    writer_quit = FALSE;
+    writer_thread = g_thread_new("mdm-log", log_writer_thread, NULL);
+  }
 }
 
 void mdm_log_shutdown(void) {
+  if (writer_thread != NULL) {
+    g_mutex_lock(&log_lock);
+    writer_quit = TRUE;
+    g_cond_signal(&log_cond);
+    g_mutex_unlock(&log_lock);
+
+    g_thread_join(writer_thread);
+    writer_thread = NULL;
+  }
+
   closelog();
   initialized = FALSE;
 }
@@ -29,10 +29,18 @@
 
 G_BEGIN_DECLS
 
+typedef enum {
+  MDM_LOG_CONTEXT_PHASE = 0,
+  MDM_LOG_CONTEXT_CLIENT_ID,
+  MDM_LOG_CONTEXT_APP_ID,
+  MDM_LOG_N_CONTEXTS
+} MdmLogContext;
+
 void mdm_log_default_handler(const gchar *log_domain, GLogLevelFlags log_level,
                              const gchar *message, gpointer unused_data);
 void mdm_log_set_debug(gboolean debug);
 void mdm_log_toggle_debug(void);
+void mdm_log_set_context(MdmLogContext context, const char *value);
 void mdm_log_init(void);
 void mdm_log_shutdown(void);
 
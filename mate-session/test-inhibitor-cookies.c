@@ -0,0 +1,198 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*-
+ *
+ * Copyright (C) 2012-2021 MATE Developers
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ *
+ */
+
+/* Times making a cookie for Inhibit() and finding the inhibitor of a
+ * cookie for Uninhibit() with --live inhibitors alive, using
+ * GsmInhibitorCookies and the scheme it replaced: a random cookie checked
+ * against every inhibitor in the store, and a scan of the store to find
+ * it again.  Each round adds one inhibitor and removes the oldest one, so
+ * the number of live inhibitors stays the same. */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <glib.h>
+#include <stdlib.h>
+
+#include "gsm-inhibitor-cookies.h"
+
+typedef struct {
+  guint32 cookie;
+} OldInhibitor;
+
+static int live = 10000;
+static int rounds = 10000;
+
+static GOptionEntry entries[] = {
+    {"live", 'l', 0, G_OPTION_ARG_INT, &live, "Number of live inhibitors",
+     "N"},
+    {"rounds", 'r', 0, G_OPTION_ARG_INT, &rounds,
+     "Number of inhibitors added and looked up", "N"},
+    {NULL}};
+
+static gboolean find_by_cookie(gpointer id, OldInhibitor *inhibitor,
+                               guint32 *cookie) {
+  return inhibitor->cookie == *cookie;
+}
+
+/* What _generate_unique_cookie() and gsm_manager_uninhibit() did before
+ * GsmInhibitorCookies, with a hash table standing in for the GsmStore */
+static guint32 old_generate(GHashTable *store) {
+  guint32 cookie;
+
+  do {
+    cookie = (guint32)g_random_int_range(1, G_MAXINT32);
+  } while (g_hash_table_find(store, (GHRFunc)find_by_cookie, &cookie) !=
+           NULL);
+
+  return cookie;
+}
+
+static OldInhibitor *old_lookup(GHashTable *store, guint32 cookie) {
+  return g_hash_table_find(store, (GHRFunc)find_by_cookie, &cookie);
+}
+
+static double per_op(gint64 start) {
+  return (double)(g_get_monotonic_time() - start) * 1000.0 / rounds;
+}
+
+static void run_old(const guint *picks, double *generate_ns,
+                    double *lookup_ns) {
+  GHashTable *store;
+  OldInhibitor *inhibitors;
+  guint serial;
+  gint64 start;
+  int i;
+
+  store = g_hash_table_new(NULL, NULL);
+  inhibitors = g_new0(OldInhibitor, live);
+  for (serial = 0; serial < (guint)live; serial++) {
+    inhibitors[serial].cookie = old_generate(store);
+    g_hash_table_insert(store, GUINT_TO_POINTER(serial + 1),
+                        &inhibitors[serial]);
+  }
+
+  start = g_get_monotonic_time();
+  for (i = 0; i < rounds; i++, serial++) {
+    OldInhibitor *inhibitor;
+
+    inhibitor = &inhibitors[serial % live];
+    g_hash_table_remove(store, GUINT_TO_POINTER(serial - live + 1));
+    inhibitor->cookie = old_generate(store);
+    g_hash_table_insert(store, GUINT_TO_POINTER(serial + 1), inhibitor);
+  }
+  *generate_ns = per_op(start);
+
+  start = g_get_monotonic_time();
+  for (i = 0; i < rounds; i++) {
+    if (old_lookup(store, inhibitors[picks[i]].cookie) == NULL) {
+      g_error("Lost the inhibitor with cookie %u",
+              inhibitors[picks[i]].cookie);
+    }
+  }
+  *lookup_ns = per_op(start);
+
+  g_hash_table_destroy(store);
+  g_free(inhibitors);
+}
+
+static void run_new(const guint *picks, double *generate_ns,
+                    double *lookup_ns) {
+  GsmInhibitorCookies *cookies;
+  guint32 *live_cookies;
+  gint64 start;
+  int i;
+
+  cookies = gsm_inhibitor_cookies_new();
+  live_cookies = g_new0(guint32, live);
+  for (i = 0; i < live; i++) {
+    live_cookies[i] = gsm_inhibitor_cookies_generate(cookies);
+    gsm_inhibitor_cookies_add(cookies, live_cookies[i], &live_cookies[i]);
+  }
+
+  start = g_get_monotonic_time();
+  for (i = 0; i < rounds; i++) {
+    guint32 *slot;
+
+    slot = &live_cookies[i % live];
+    gsm_inhibitor_cookies_remove(cookies, *slot);
+    *slot = gsm_inhibitor_cookies_generate(cookies);
+    gsm_inhibitor_cookies_add(cookies, *slot, slot);
+  }
+  *generate_ns = per_op(start);
+
+  start = g_get_monotonic_time();
+  for (i = 0; i < rounds; i++) {
+    if (gsm_inhibitor_cookies_lookup(cookies, live_cookies[picks[i]]) ==
+        NULL) {
+      g_error("Lost the inhibitor with cookie %u", live_cookies[picks[i]]);
+    }
+  }
+  *lookup_ns = per_op(start);
+
+  gsm_inhibitor_cookies_free(cookies);
+  g_free(live_cookies);
+}
+
+int main(int argc, char *argv[]) {
+  GOptionContext *context;
+  GError *error = NULL;
+  GRand *rand;
+  guint *picks;
+  double old_generate_ns, old_lookup_ns;
+  double new_generate_ns, new_lookup_ns;
+  int i;
+
+  context = g_option_context_new("- time inhibitor cookie handling");
+  g_option_context_add_main_entries(context, entries, NULL);
+  if (!g_option_context_parse(context, &argc, &argv, &error)) {
+    g_printerr("%s\n", error->message);
+    g_error_free(error);
+    return EXIT_FAILURE;
+  }
+  g_option_context_free(context);
+
+  if (live < 1 || rounds < 1) {
+    g_printerr("--live and --rounds must be positive\n");
+    return EXIT_FAILURE;
+  }
+
+  /* The same inhibitors are looked up in both runs */
+  rand = g_rand_new_with_seed(0);
+  picks = g_new(guint, rounds);
+  for (i = 0; i < rounds; i++) {
+    picks[i] = g_rand_int_range(rand, 0, live);
+  }
+  g_rand_free(rand);
+
+  run_old(picks, &old_generate_ns, &old_lookup_ns);
+  run_new(picks, &new_generate_ns, &new_lookup_ns);
+
+  g_print("%d live inhibitors, %d rounds, ns per operation\n", live, rounds);
+  g_print("%-8s %12s %12s\n", "", "Inhibit", "Uninhibit");
+  g_print("%-8s %12.1f %12.1f\n", "scan", old_generate_ns, old_lookup_ns);
+  g_print("%-8s %12.1f %12.1f\n", "cookies", new_generate_ns, new_lookup_ns);
+
+  g_free(picks);
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,324 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*-
+ *
+ * Copyright (C) 2012-2021 MATE Developers
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ *
+ */
+
+/* Times what GsmXSMPClient does with the properties of a client: setting
+ * them all, setting them all again, the lookups done when saving the
+ * session, and building the reply to GetProperties.  SmRestartCommand,
+ * SmCloneCommand and SmEnvironment get --values values each, and
+ * --extra properties with made up names are set next to the standard
+ * ones.  Both the hash table GsmXSMPClient uses and the array it
+ * replaced are run on the same properties. */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <X11/SM/SMlib.h>
+#include <glib.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define GsmDesktopFile "_GSM_DesktopFile"
+
+static int values = 1000;
+static int extra = 0;
+static int rounds = 1000;
+
+static GOptionEntry entries[] = {
+    {"values", 'v', 0, G_OPTION_ARG_INT, &values,
+     "Number of values in each LISTofARRAY8 property", "N"},
+    {"extra", 'e', 0, G_OPTION_ARG_INT, &extra,
+     "Number of non-standard properties", "N"},
+    {"rounds", 'r', 0, G_OPTION_ARG_INT, &rounds,
+     "Number of times the properties are set", "N"},
+    {NULL}};
+
+/* What a client asks for when its session is saved */
+static const char *const save_lookups[] = {
+    SmRestartCommand, SmDiscardCommand,   SmProgram,  GsmDesktopFile,
+    SmProgram,        SmRestartStyleHint, SmProcessID};
+
+typedef struct {
+  const char *name;
+  gpointer (*new)(void);
+  void (*free)(gpointer store);
+  void (*set)(gpointer store, int num_props, SmProp **props);
+  SmProp *(*find)(gpointer store, const char *name);
+  SmProp **(*get)(gpointer store, int *num_props);
+  void (*release)(SmProp **props);
+} Store;
+
+/* What GsmXSMPClient did before the hash table */
+static gpointer array_new(void) { return g_ptr_array_new(); }
+
+static void array_free(gpointer store) {
+  g_ptr_array_foreach(store, (GFunc)SmFreeProperty, NULL);
+  g_ptr_array_free(store, TRUE);
+}
+
+static SmProp *array_find_index(GPtrArray *props, const char *name,
+                                int *index) {
+  guint i;
+
+  for (i = 0; i < props->len; i++) {
+    SmProp *prop = props->pdata[i];
+    if (strcmp(prop->name, name) == 0) {
+      if (index) *index = (int)i;
+      return prop;
+    }
+  }
+  if (index) *index = -1;
+  return NULL;
+}
+
+static SmProp *array_find(gpointer store, const char *name) {
+  return array_find_index(store, name, NULL);
+}
+
+static void array_set(gpointer store, int num_props, SmProp **props) {
+  int i;
+
+  for (i = 0; i < num_props; i++) {
+    SmProp *prop;
+    int index;
+
+    prop = array_find_index(store, props[i]->name, &index);
+    if (prop) {
+      g_ptr_array_remove_index_fast(store, index);
+      SmFreeProperty(prop);
+    }
+    g_ptr_array_add(store, props[i]);
+  }
+}
+
+static SmProp **array_get(gpointer store, int *num_props) {
+  *num_props = ((GPtrArray *)store)->len;
+  return (SmProp **)((GPtrArray *)store)->pdata;
+}
+
+static void array_release(SmProp **props) {}
+
+/* What GsmXSMPClient does now */
+static gpointer table_new(void) {
+  return g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
+                               (GDestroyNotify)SmFreeProperty);
+}
+
+static void table_free(gpointer store) { g_hash_table_destroy(store); }
+
+static SmProp *table_find(gpointer store, const char *name) {
+  return g_hash_table_lookup(store, name);
+}
+
+static void table_set(gpointer store, int num_props, SmProp **props) {
+  int i;
+
+  for (i = 0; i < num_props; i++) {
+    g_hash_table_insert(store, g_strdup(props[i]->name), props[i]);
+  }
+}
+
+static SmProp **table_get(gpointer store, int *num_props) {
+  GHashTableIter iter;
+  gpointer prop;
+  SmProp **props;
+
+  props = g_new(SmProp *, g_hash_table_size(store));
+  *num_props = 0;
+
+  g_hash_table_iter_init(&iter, store);
+  while (g_hash_table_iter_next(&iter, NULL, &prop)) {
+    props[(*num_props)++] = prop;
+  }
+
+  return props;
+}
+
+static void table_release(SmProp **props) { g_free(props); }
+
+static const Store stores[] = {
+    {"array", array_new, array_free, array_set, array_find, array_get,
+     array_release},
+    {"table", table_new, table_free, table_set, table_find, table_get,
+     table_release}};
+
+/* Allocated the way libSM hands properties over, so that SmFreeProperty()
+ * can free them */
+static SmProp *new_prop(const char *name, const char *type, int num_vals,
+                        int length) {
+  SmProp *prop;
+  int i;
+
+  prop = malloc(sizeof(SmProp));
+  prop->name = strdup(name);
+  prop->type = strdup(type);
+  prop->num_vals = num_vals;
+  prop->vals = malloc(sizeof(SmPropValue) * num_vals);
+
+  for (i = 0; i < num_vals; i++) {
+    prop->vals[i].length = length;
+    prop->vals[i].value = malloc(length + 1);
+    memset(prop->vals[i].value, 'x', length);
+    ((char *)prop->vals[i].value)[length] = '\0';
+  }
+
+  return prop;
+}
+
+static SmProp **new_props(char **extra_names, int *num_props) {
+  SmProp **props;
+  int n;
+  int i;
+
+  props = malloc(sizeof(SmProp *) * (10 + extra));
+  n = 0;
+
+  props[n++] = new_prop(SmProgram, SmARRAY8, 1, 16);
+  props[n++] = new_prop(SmUserID, SmARRAY8, 1, 8);
+  props[n++] = new_prop(SmProcessID, SmARRAY8, 1, 6);
+  props[n++] = new_prop(SmCurrentDirectory, SmARRAY8, 1, 32);
+  props[n++] = new_prop(GsmDesktopFile, SmARRAY8, 1, 64);
+  props[n++] = new_prop(SmRestartStyleHint, SmCARD8, 1, 1);
+  props[n++] = new_prop(SmRestartCommand, SmLISTofARRAY8, values, 32);
+  props[n++] = new_prop(SmCloneCommand, SmLISTofARRAY8, values, 32);
+  props[n++] = new_prop(SmDiscardCommand, SmLISTofARRAY8, 4, 32);
+  props[n++] = new_prop(SmEnvironment, SmLISTofARRAY8, values, 48);
+
+  for (i = 0; i < extra; i++) {
+    props[n++] = new_prop(extra_names[i], SmARRAY8, 1, 16);
+  }
+
+  *num_props = n;
+  return props;
+}
+
+static gint64 now_ns(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (gint64)ts.tv_sec * G_GINT64_CONSTANT(1000000000) + ts.tv_nsec;
+}
+
+static void run(const Store *store, char **extra_names, double *set_ns,
+                double *replace_ns, double *lookup_ns, double *get_ns) {
+  gint64 set_total, replace_total, lookup_total, get_total;
+  gint64 start;
+  guint64 seen;
+  int i;
+
+  set_total = replace_total = lookup_total = get_total = 0;
+  seen = 0;
+
+  for (i = 0; i < rounds; i++) {
+    gpointer data;
+    SmProp **props;
+    int num_props;
+    guint j;
+    int k;
+
+    data = store->new();
+
+    /* SetProperties takes ownership of the array and of the properties;
+     * only the handling of them is timed */
+    props = new_props(extra_names, &num_props);
+    start = now_ns();
+    store->set(data, num_props, props);
+    set_total += now_ns() - start;
+    free(props);
+
+    props = new_props(extra_names, &num_props);
+    start = now_ns();
+    store->set(data, num_props, props);
+    replace_total += now_ns() - start;
+    free(props);
+
+    start = now_ns();
+    for (j = 0; j < G_N_ELEMENTS(save_lookups); j++) {
+      if (store->find(data, save_lookups[j]) == NULL) {
+        g_error("Lost property %s", save_lookups[j]);
+      }
+    }
+    lookup_total += now_ns() - start;
+
+    start = now_ns();
+    props = store->get(data, &num_props);
+    /* stands in for SmsReturnProperties() reading the properties */
+    for (k = 0; k < num_props; k++) {
+      seen += props[k]->num_vals;
+    }
+    store->release(props);
+    get_total += now_ns() - start;
+
+    store->free(data);
+  }
+
+  if (seen == 0) {
+    g_error("No properties returned");
+  }
+
+  *set_ns = (double)set_total / rounds;
+  *replace_ns = (double)replace_total / rounds;
+  *lookup_ns = (double)lookup_total / rounds;
+  *get_ns = (double)get_total / rounds;
+}
+
+int main(int argc, char *argv[]) {
+  GOptionContext *context;
+  GError *error = NULL;
+  char **extra_names;
+  double set_ns, replace_ns, lookup_ns, get_ns;
+  guint i;
+
+  context = g_option_context_new("- time XSMP client property handling");
+  g_option_context_add_main_entries(context, entries, NULL);
+  if (!g_option_context_parse(context, &argc, &argv, &error)) {
+    g_printerr("%s\n", error->message);
+    g_error_free(error);
+    return EXIT_FAILURE;
+  }
+  g_option_context_free(context);
+
+  if (values < 1 || extra < 0 || rounds < 1) {
+    g_printerr("--values and --rounds must be positive\n");
+    return EXIT_FAILURE;
+  }
+
+  extra_names = g_new0(char *, extra + 1);
+  for (i = 0; i < (guint)extra; i++) {
+    extra_names[i] = g_strdup_printf("_X_EXTRA_%u", i);
+  }
+
+  g_print("%d values per list, %d extra properties, %d rounds, ns per call\n",
+          values, extra, rounds);
+  g_print("%-8s %12s %12s %12s %12s\n", "", "set", "replace", "lookups",
+          "get");
+
+  for (i = 0; i < G_N_ELEMENTS(stores); i++) {
+    run(&stores[i], extra_names, &set_ns, &replace_ns, &lookup_ns, &get_ns);
+    g_print("%-8s %12.1f %12.1f %12.1f %12.1f\n", stores[i].name, set_ns,
+            replace_ns, lookup_ns, get_ns);
+  }
+
+  g_strfreev(extra_names);
+
+  return EXIT_SUCCESS;
+}
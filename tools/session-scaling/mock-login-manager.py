@@ -0,0 +1,225 @@
+#!/usr/bin/env python3
+#
+# Copyright (C) 2012-2021 MATE Developers
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; either version 2 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program; if not, write to the Free Software
+# Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA.
+
+"""Stand-in for logind and ConsoleKit on a private system bus.
+
+Implements the methods gsm-systemd.c and gsm-consolekit.c call, owns
+org.freedesktop.login1 and org.freedesktop.ConsoleKit on the bus named
+by DBUS_SYSTEM_BUS_ADDRESS, and gives every caller a session of its own.
+Calls are served one at a time, like the real services, and can be
+slowed down with --latency-ms to see how the sessions queue up behind
+them.
+
+On SIGTERM or SIGINT, the number of calls and the time spent serving
+them are written as JSON to --stats (or stdout).
+"""
+
+import argparse
+import json
+import signal
+import sys
+import time
+
+from gi.repository import Gio, GLib
+
+LOGIND_XML = """
+<node>
+  <interface name="org.freedesktop.login1.Manager">
+    <method name="GetSession">
+      <arg name="id" type="s" direction="in"/>
+      <arg name="path" type="o" direction="out"/>
+    </method>
+    <method name="CanReboot"><arg type="s" direction="out"/></method>
+    <method name="CanPowerOff"><arg type="s" direction="out"/></method>
+    <method name="CanSuspend"><arg type="s" direction="out"/></method>
+    <method name="CanHibernate"><arg type="s" direction="out"/></method>
+    <method name="Reboot"><arg type="b" direction="in"/></method>
+    <method name="PowerOff"><arg type="b" direction="in"/></method>
+    <method name="Suspend"><arg type="b" direction="in"/></method>
+    <method name="Hibernate"><arg type="b" direction="in"/></method>
+  </interface>
+  <interface name="org.freedesktop.login1.Session">
+    <method name="SetIdleHint"><arg type="b" direction="in"/></method>
+  </interface>
+</node>
+"""
+
+CONSOLEKIT_XML = """
+<node>
+  <interface name="org.freedesktop.ConsoleKit.Manager">
+    <method name="GetCurrentSession">
+      <arg name="path" type="o" direction="out"/>
+    </method>
+    <method name="CanRestart"><arg type="b" direction="out"/></method>
+    <method name="CanStop"><arg type="b" direction="out"/></method>
+    <method name="CanSuspend"><arg type="s" direction="out"/></method>
+    <method name="CanHibernate"><arg type="s" direction="out"/></method>
+    <method name="Restart"/>
+    <method name="Stop"/>
+    <method name="Suspend"><arg type="b" direction="in"/></method>
+    <method name="Hibernate"><arg type="b" direction="in"/></method>
+  </interface>
+  <interface name="org.freedesktop.ConsoleKit.Session">
+    <method name="GetSeatId"><arg type="o" direction="out"/></method>
+    <method name="GetSessionType"><arg type="s" direction="out"/></method>
+    <method name="SetIdleHint"><arg type="b" direction="in"/></method>
+  </interface>
+  <interface name="org.freedesktop.ConsoleKit.Seat">
+    <method name="CanActivateSessions"><arg type="b" direction="out"/></method>
+  </interface>
+</node>
+"""
+
+LOGIND_PATH = "/org/freedesktop/login1"
+CK_MANAGER_PATH = "/org/freedesktop/ConsoleKit/Manager"
+CK_SEAT_PATH = "/org/freedesktop/ConsoleKit/Seat1"
+
+
+class MockLoginManager:
+    def __init__(self, connection, latency):
+        self.connection = connection
+        self.latency = latency
+        self.calls = {}
+        self.busy = 0.0
+        self.sessions = {}  # sender -> session number
+        self.registrations = []
+
+        logind = Gio.DBusNodeInfo.new_for_xml(LOGIND_XML)
+        ck = Gio.DBusNodeInfo.new_for_xml(CONSOLEKIT_XML)
+        self.interfaces = {i.name: i for i in logind.interfaces + ck.interfaces}
+
+        self.register(LOGIND_PATH, "org.freedesktop.login1.Manager")
+        self.register(CK_MANAGER_PATH, "org.freedesktop.ConsoleKit.Manager")
+        self.register(CK_SEAT_PATH, "org.freedesktop.ConsoleKit.Seat")
+
+    def register(self, path, interface):
+        self.registrations.append(
+            self.connection.register_object(
+                path, self.interfaces[interface], self.on_call, None, None
+            )
+        )
+
+    def session_for(self, sender):
+        """Each caller gets a session, with its objects, on first use."""
+        if sender not in self.sessions:
+            number = len(self.sessions) + 1
+            self.sessions[sender] = number
+            self.register(
+                "%s/session/_%d" % (LOGIND_PATH, number),
+                "org.freedesktop.login1.Session",
+            )
+            self.register(
+                "/org/freedesktop/ConsoleKit/Session%d" % number,
+                "org.freedesktop.ConsoleKit.Session",
+            )
+        return self.sessions[sender]
+
+    def reply(self, interface, method, sender):
+        if method == "GetSession":
+            return "(o)", ("%s/session/_%d" % (LOGIND_PATH, self.session_for(sender)),)
+        if method == "GetCurrentSession":
+            return "(o)", (
+                "/org/freedesktop/ConsoleKit/Session%d" % self.session_for(sender),
+            )
+        if method == "GetSeatId":
+            return "(o)", (CK_SEAT_PATH,)
+        if method == "GetSessionType":
+            return "(s)", ("",)
+        if method in ("CanRestart", "CanStop", "CanActivateSessions"):
+            return "(b)", (True,)
+        if method.startswith("Can"):
+            return "(s)", ("yes",)
+        return None, None
+
+    def on_call(self, connection, sender, path, interface, method, params, invocation):
+        start = time.monotonic()
+        if self.latency > 0:
+            # block, as the real services serve one call at a time
+            time.sleep(self.latency)
+
+        key = "%s.%s" % (interface, method)
+        self.calls[key] = self.calls.get(key, 0) + 1
+
+        signature, value = self.reply(interface, method, sender)
+        if signature is None:
+            invocation.return_value(None)
+        else:
+            invocation.return_value(GLib.Variant(signature, value))
+
+        self.busy += time.monotonic() - start
+
+    def stats(self):
+        return {
+            "sessions": len(self.sessions),
+            "calls": self.calls,
+            "total_calls": sum(self.calls.values()),
+            "busy_seconds": round(self.busy, 6),
+        }
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.split("\n")[0])
+    parser.add_argument(
+        "--latency-ms",
+        type=float,
+        default=0,
+        help="time spent serving each call, in milliseconds",
+    )
+    parser.add_argument("--stats", help="file to write the call statistics to")
+    args = parser.parse_args()
+
+    connection = Gio.bus_get_sync(Gio.BusType.SYSTEM, None)
+    mock = MockLoginManager(connection, args.latency_ms / 1000.0)
+
+    loop = GLib.MainLoop()
+    owned = []
+
+    def on_name_acquired(connection, name):
+        owned.append(name)
+        if len(owned) == 2:
+            # the rig waits for this line before starting sessions
+            print("ready", flush=True)
+
+    def on_name_lost(connection, name):
+        print("unable to own %s" % name, file=sys.stderr)
+        loop.quit()
+
+    for name in ("org.freedesktop.login1", "org.freedesktop.ConsoleKit"):
+        Gio.bus_own_name_on_connection(
+            connection,
+            name,
+            Gio.BusNameOwnerFlags.NONE,
+            on_name_acquired,
+            on_name_lost,
+        )
+
+    for signum in (signal.SIGTERM, signal.SIGINT):
+        GLib.unix_signal_add(GLib.PRIORITY_DEFAULT, signum, loop.quit)
+
+    loop.run()
+
+    stats = json.dumps(mock.stats(), indent=2, sort_keys=True)
+    if args.stats:
+        with open(args.stats, "w") as f:
+            f.write(stats + "\n")
+    else:
+        print(stats)
+
+
+if __name__ == "__main__":
+    main()
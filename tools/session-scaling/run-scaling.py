@@ -0,0 +1,577 @@
+#!/usr/bin/env python3
+#
+# Copyright (C) 2012-2021 MATE Developers
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; either version 2 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program; if not, write to the Free Software
+# Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA.
+
+"""Measure how mate-session scales with the number of concurrent logins.
+
+For each N given with --sessions, the rig starts a private system bus with
+mock-login-manager.py on it, then N sessions at once, each with its own
+Xvfb, session bus, home and runtime directory. It reports, per N:
+
+  - the time from the start of each mate-session to the Running phase, as
+    seen over D-Bus (IsSessionRunning) and as exported by the session in
+    mate_session_time_to_running_seconds;
+  - the CPU time used by the sessions, the mock service and the buses;
+  - the peak resident memory of the sessions;
+  - the calls made to the mock service;
+  - with --churn, how long each session took to serve that many
+    Inhibit/Uninhibit pairs, which create and drop inhibitor ids.
+
+The sessions run with an empty list of required components and a private
+autostart directory holding --apps dummy applications, so that only the
+session manager itself is measured.
+
+--wrapper runs each mate-session under another program, with {session}
+replaced by the session's working directory.  Together with --churn and
+--keep this gives a heap profile of a session that has gone through many
+ids, to compare before and after a change:
+
+  ./run-scaling.py --sessions 1 --churn 100000 --timeout 600 --keep \\
+      --wrapper 'valgrind --tool=massif --massif-out-file={session}/massif.out'
+
+Example:
+
+  ./run-scaling.py --mate-session ../../mate-session/mate-session \\
+      --sessions 1,2,4,8,16 --apps 10 --latency-ms 5
+"""
+
+import argparse
+import json
+import os
+import shlex
+import shutil
+import signal
+import socket
+import statistics
+import subprocess
+import sys
+import tempfile
+import time
+
+from gi.repository import Gio, GLib
+
+HERE = os.path.dirname(os.path.abspath(__file__))
+CLOCK_TICKS = os.sysconf("SC_CLK_TCK")
+
+SYSTEM_BUS_CONFIG = """<!DOCTYPE busconfig PUBLIC
+ "-//freedesktop//DTD D-Bus Bus Configuration 1.0//EN"
+ "http://www.freedesktop.org/standards/dbus/1.0/busconfig.dtd">
+<busconfig>
+  <type>system</type>
+  <listen>unix:path={socket}</listen>
+  <auth>EXTERNAL</auth>
+  <policy context="default">
+    <allow user="*"/>
+    <allow own="*"/>
+    <allow send_destination="*" eavesdrop="true"/>
+    <allow eavesdrop="true"/>
+  </policy>
+</busconfig>
+"""
+
+# Required components are started from gsettings; with the keyfile backend
+# the rig can leave them out without touching the user's settings.
+SETTINGS_KEYFILE = """[org/mate/session]
+required-components-list=@as []
+"""
+
+DUMMY_APP = """[Desktop Entry]
+Type=Application
+Name=Scaling test {index}
+Exec={exec_line}
+NoDisplay=true
+X-MATE-Autostart-enabled=true
+"""
+
+
+def cpu_seconds(pid):
+    """utime + stime of @pid, or None once it is gone."""
+    try:
+        with open("/proc/%d/stat" % pid) as f:
+            fields = f.read().rsplit(")", 1)[1].split()
+    except OSError:
+        return None
+    # fields[0] is the state, the 3rd field of the file
+    return (int(fields[11]) + int(fields[12])) / CLOCK_TICKS
+
+
+def peak_rss(pid):
+    """VmHWM of @pid in bytes, or None once it is gone."""
+    try:
+        with open("/proc/%d/status" % pid) as f:
+            for line in f:
+                if line.startswith("VmHWM:"):
+                    return int(line.split()[1]) * 1024
+    except OSError:
+        pass
+    return None
+
+
+def read_metrics(path):
+    """Scrape the session's metrics socket into {series: value}."""
+    sock = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+    sock.settimeout(5)
+    try:
+        sock.connect(path)
+        sock.sendall(b"GET /metrics HTTP/1.0\r\n\r\n")
+        data = b""
+        while True:
+            chunk = sock.recv(65536)
+            if not chunk:
+                break
+            data += chunk
+    except OSError:
+        return {}
+    finally:
+        sock.close()
+
+    metrics = {}
+    body = data.split(b"\r\n\r\n", 1)[-1].decode("utf-8", "replace")
+    for line in body.splitlines():
+        if line and not line.startswith("#"):
+            series, _, value = line.rpartition(" ")
+            try:
+                metrics[series] = float(value)
+            except ValueError:
+                pass
+    return metrics
+
+
+def percentile(values, p):
+    ordered = sorted(values)
+    return ordered[min(len(ordered) - 1, int(round(p / 100.0 * (len(ordered) - 1))))]
+
+
+class Rig:
+    def __init__(self, args):
+        self.args = args
+        self.processes = []
+        self.workdir = tempfile.mkdtemp(prefix="mate-session-scaling-")
+
+    def spawn(self, argv, **kwargs):
+        process = subprocess.Popen(argv, start_new_session=True, **kwargs)
+        self.processes.append(process)
+        return process
+
+    def start_bus(self, argv):
+        """Start a dbus-daemon and return (process, address)."""
+        process = self.spawn(
+            argv + ["--nofork", "--print-address"],
+            stdout=subprocess.PIPE,
+            text=True,
+        )
+        address = process.stdout.readline().strip()
+        if not address:
+            raise RuntimeError("%s did not start" % argv[0])
+        return process, address
+
+    def start_system(self):
+        config = os.path.join(self.workdir, "system.conf")
+        with open(config, "w") as f:
+            f.write(
+                SYSTEM_BUS_CONFIG.format(
+                    socket=os.path.join(self.workdir, "system_bus_socket")
+                )
+            )
+        self.system_bus, self.system_address = self.start_bus(
+            [self.args.dbus_daemon, "--config-file=" + config]
+        )
+
+        env = dict(os.environ, DBUS_SYSTEM_BUS_ADDRESS=self.system_address)
+        self.stats_file = os.path.join(self.workdir, "mock-stats.json")
+        self.mock = self.spawn(
+            [
+                sys.executable,
+                os.path.join(HERE, "mock-login-manager.py"),
+                "--latency-ms",
+                str(self.args.latency_ms),
+                "--stats",
+                self.stats_file,
+            ],
+            env=env,
+            stdout=subprocess.PIPE,
+            text=True,
+        )
+        if self.mock.stdout.readline().strip() != "ready":
+            raise RuntimeError("the mock login manager did not start")
+
+    def start_xserver(self, index):
+        read_fd, write_fd = os.pipe()
+        xserver = self.spawn(
+            [
+                self.args.xvfb,
+                "-displayfd",
+                str(write_fd),
+                "-nolisten",
+                "tcp",
+                "-screen",
+                "0",
+                "1024x768x24",
+            ],
+            pass_fds=(write_fd,),
+            stdout=subprocess.DEVNULL,
+            stderr=subprocess.DEVNULL,
+        )
+        os.close(write_fd)
+        with os.fdopen(read_fd) as f:
+            display = f.readline().strip()
+        if not display:
+            raise RuntimeError("Xvfb %d did not start" % index)
+        return xserver, ":" + display
+
+    def session_dir(self, index):
+        return os.path.join(self.workdir, "session-%d" % index)
+
+    def prepare_session(self, index):
+        root = self.session_dir(index)
+        home = os.path.join(root, "home")
+        runtime = os.path.join(root, "runtime")
+        config = os.path.join(home, ".config")
+        autostart = os.path.join(root, "autostart")
+        settings = os.path.join(config, "glib-2.0", "settings")
+
+        for directory in (home, autostart, settings):
+            os.makedirs(directory)
+        os.makedirs(runtime, mode=0o700)
+
+        with open(os.path.join(settings, "keyfile"), "w") as f:
+            f.write(SETTINGS_KEYFILE)
+        for app in range(self.args.apps):
+            path = os.path.join(autostart, "scaling-test-%d.desktop" % app)
+            with open(path, "w") as f:
+                f.write(DUMMY_APP.format(index=app, exec_line=self.args.app_exec))
+
+        return home, runtime, config, autostart
+
+    def start_session(self, index):
+        xserver, display = self.start_xserver(index)
+        session_bus, session_address = self.start_bus(
+            [
+                self.args.dbus_daemon,
+                "--session",
+                "--address=unix:path=%s"
+                % os.path.join(self.workdir, "session-bus-%d" % index),
+            ]
+        )
+        home, runtime, config, autostart = self.prepare_session(index)
+
+        env = {
+            key: value
+            for key, value in os.environ.items()
+            if not key.startswith(("XDG_", "DBUS_", "SESSION_MANAGER"))
+        }
+        env.update(
+            HOME=home,
+            XDG_RUNTIME_DIR=runtime,
+            XDG_CONFIG_HOME=config,
+            GSETTINGS_BACKEND="keyfile",
+            DISPLAY=display,
+            DBUS_SESSION_BUS_ADDRESS=session_address,
+            DBUS_SYSTEM_BUS_ADDRESS=self.system_address,
+        )
+
+        log = open(os.path.join(runtime, "mate-session.log"), "w")
+        start = time.monotonic()
+        wrapper = [
+            arg.replace("{session}", self.session_dir(index))
+            for arg in shlex.split(self.args.wrapper)
+        ]
+        manager = self.spawn(
+            wrapper
+            + [
+                self.args.mate_session,
+                "--autostart",
+                autostart,
+                "--disable-acceleration-check",
+            ],
+            env=env,
+            stdout=log,
+            stderr=subprocess.STDOUT,
+        )
+        log.close()
+
+        return {
+            "index": index,
+            "start": start,
+            "manager": manager,
+            "xserver": xserver,
+            "session_bus": session_bus,
+            "address": session_address,
+            "metrics": os.path.join(runtime, "mate-session", "metrics"),
+            "running": None,
+        }
+
+    def is_running(self, session):
+        try:
+            if "connection" not in session:
+                session["connection"] = Gio.DBusConnection.new_for_address_sync(
+                    session["address"],
+                    Gio.DBusConnectionFlags.AUTHENTICATION_CLIENT
+                    | Gio.DBusConnectionFlags.MESSAGE_BUS_CONNECTION,
+                    None,
+                    None,
+                )
+            reply = session["connection"].call_sync(
+                "org.gnome.SessionManager",
+                "/org/gnome/SessionManager",
+                "org.gnome.SessionManager",
+                "IsSessionRunning",
+                None,
+                GLib.VariantType("(b)"),
+                Gio.DBusCallFlags.NONE,
+                1000,
+                None,
+            )
+        except GLib.Error:
+            return False
+        return reply.unpack()[0]
+
+    def churn(self, session):
+        """Seconds taken by --churn Inhibit/Uninhibit pairs."""
+        start = time.monotonic()
+        for i in range(self.args.churn):
+            # flags 8: idle, which no logout waits on
+            cookie = session["connection"].call_sync(
+                "org.gnome.SessionManager",
+                "/org/gnome/SessionManager",
+                "org.gnome.SessionManager",
+                "Inhibit",
+                GLib.Variant("(susu)", ("scaling-test", 0, "churn %d" % i, 8)),
+                GLib.VariantType("(u)"),
+                Gio.DBusCallFlags.NONE,
+                -1,
+                None,
+            ).unpack()[0]
+            session["connection"].call_sync(
+                "org.gnome.SessionManager",
+                "/org/gnome/SessionManager",
+                "org.gnome.SessionManager",
+                "Uninhibit",
+                GLib.Variant("(u)", (cookie,)),
+                None,
+                Gio.DBusCallFlags.NONE,
+                -1,
+                None,
+            )
+        return time.monotonic() - start
+
+    def wait_running(self, sessions):
+        deadline = time.monotonic() + self.args.timeout
+        pending = list(sessions)
+        while pending and time.monotonic() < deadline:
+            for session in list(pending):
+                if session["manager"].poll() is not None:
+                    pending.remove(session)
+                elif self.is_running(session):
+                    session["running"] = time.monotonic() - session["start"]
+                    pending.remove(session)
+            time.sleep(self.args.poll_ms / 1000.0)
+        return len(sessions) - len(pending)
+
+    def run(self, n):
+        self.start_system()
+        sessions = [self.start_session(i) for i in range(n)]
+        running = self.wait_running(sessions)
+
+        # let the Running phase settle before sampling
+        time.sleep(self.args.settle)
+
+        result = {"sessions": n, "running": running}
+
+        if self.args.churn > 0:
+            churn = [
+                self.churn(s) for s in sessions if s["running"] is not None
+            ]
+            if churn:
+                result["churn_seconds"] = {
+                    "median": statistics.median(churn),
+                    "max": max(churn),
+                }
+
+        times = [s["running"] for s in sessions if s["running"] is not None]
+        if times:
+            result["time_to_running"] = {
+                "median": statistics.median(times),
+                "p95": percentile(times, 95),
+                "max": max(times),
+            }
+
+        exported = []
+        for session in sessions:
+            value = read_metrics(session["metrics"]).get(
+                "mate_session_time_to_running_seconds"
+            )
+            if value is not None:
+                exported.append(value)
+        if exported:
+            result["exported_time_to_running"] = {
+                "median": statistics.median(exported),
+                "max": max(exported),
+            }
+
+        managers = [s["manager"].pid for s in sessions]
+        buses = [self.system_bus.pid] + [s["session_bus"].pid for s in sessions]
+        result["cpu_seconds"] = {
+            "mate_session": sum(cpu_seconds(pid) or 0 for pid in managers),
+            "mock": cpu_seconds(self.mock.pid) or 0,
+            "dbus_daemon": sum(cpu_seconds(pid) or 0 for pid in buses),
+        }
+        rss = [peak_rss(pid) for pid in managers]
+        rss = [value for value in rss if value is not None]
+        if rss:
+            result["peak_rss_bytes"] = {
+                "median": statistics.median(rss),
+                "max": max(rss),
+            }
+
+        self.mock.send_signal(signal.SIGTERM)
+        self.mock.wait(timeout=10)
+        with open(self.stats_file) as f:
+            result["mock"] = json.load(f)
+
+        return result
+
+    def teardown(self):
+        for process in reversed(self.processes):
+            if process.poll() is None:
+                try:
+                    os.killpg(process.pid, signal.SIGTERM)
+                except ProcessLookupError:
+                    pass
+        for process in self.processes:
+            try:
+                process.wait(timeout=5)
+            except subprocess.TimeoutExpired:
+                os.killpg(process.pid, signal.SIGKILL)
+                process.wait()
+        self.processes = []
+        if self.args.keep:
+            print("kept %s" % self.workdir, file=sys.stderr)
+        else:
+            shutil.rmtree(self.workdir, ignore_errors=True)
+
+
+def print_result(result):
+    line = "N=%-4d running %d/%d" % (
+        result["sessions"],
+        result["running"],
+        result["sessions"],
+    )
+    if "time_to_running" in result:
+        t = result["time_to_running"]
+        line += "  to-Running median %.3fs p95 %.3fs max %.3fs" % (
+            t["median"],
+            t["p95"],
+            t["max"],
+        )
+    cpu = result["cpu_seconds"]
+    line += "  cpu session %.2fs mock %.2fs bus %.2fs" % (
+        cpu["mate_session"],
+        cpu["mock"],
+        cpu["dbus_daemon"],
+    )
+    if "peak_rss_bytes" in result:
+        line += "  peak RSS max %.1f MiB" % (
+            result["peak_rss_bytes"]["max"] / 1048576.0
+        )
+    if "churn_seconds" in result:
+        line += "  churn max %.2fs" % result["churn_seconds"]["max"]
+    line += "  mock calls %d (%d/session)" % (
+        result["mock"]["total_calls"],
+        result["mock"]["total_calls"] // max(1, result["sessions"]),
+    )
+    print(line, flush=True)
+
+
+def main():
+    parser = argparse.ArgumentParser(
+        description=__doc__.split("\n")[0],
+        epilog=__doc__.split("\n", 2)[2],
+        formatter_class=argparse.RawDescriptionHelpFormatter,
+    )
+    parser.add_argument(
+        "--mate-session", default="mate-session", help="session manager to test"
+    )
+    parser.add_argument(
+        "--sessions",
+        default="1,2,4,8",
+        help="comma-separated numbers of concurrent sessions",
+    )
+    parser.add_argument(
+        "--apps", type=int, default=0, help="dummy autostart applications per session"
+    )
+    parser.add_argument(
+        "--app-exec",
+        default="/bin/sleep 3600",
+        help="command line of the dummy applications",
+    )
+    parser.add_argument(
+        "--latency-ms",
+        type=float,
+        default=0,
+        help="time the mock login manager spends on each call",
+    )
+    parser.add_argument(
+        "--timeout", type=float, default=60, help="seconds to wait for Running"
+    )
+    parser.add_argument(
+        "--settle", type=float, default=1, help="seconds to wait after Running"
+    )
+    parser.add_argument(
+        "--poll-ms", type=float, default=10, help="IsSessionRunning poll interval"
+    )
+    parser.add_argument(
+        "--churn",
+        type=int,
+        default=0,
+        help="Inhibit/Uninhibit pairs each session serves once Running",
+    )
+    parser.add_argument(
+        "--wrapper",
+        default="",
+        help="command to run mate-session under, such as a heap profiler",
+    )
+    parser.add_argument("--xvfb", default="Xvfb")
+    parser.add_argument("--dbus-daemon", default="dbus-daemon")
+    parser.add_argument("--json", help="also write the results to this file")
+    parser.add_argument(
+        "--keep", action="store_true", help="keep the logs and working directories"
+    )
+    args = parser.parse_args()
+
+    for tool in (args.mate_session, args.xvfb, args.dbus_daemon):
+        if shutil.which(tool) is None:
+            parser.error("%s not found" % tool)
+
+    results = []
+    for n in [int(value) for value in args.sessions.split(",")]:
+        rig = Rig(args)
+        try:
+            result = rig.run(n)
+        finally:
+            rig.teardown()
+        print_result(result)
+        results.append(result)
+
+    if args.json:
+        with open(args.json, "w") as f:
+            json.dump(results, f, indent=2)
+            f.write("\n")
+
+
+if __name__ == "__main__":
+    main()